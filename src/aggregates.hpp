@@ -0,0 +1,183 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include "indexed_heap.hpp"
+
+#include <metricq/types.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <vector>
+
+/**
+ * A sum of values that can be updated by replacing single values.
+ *
+ * Finite values are accumulated with Neumaier's compensated summation, so that adding and later
+ * removing values does not accumulate rounding errors as quickly.  Infinities are only counted,
+ * as subtracting them again would result in NaN.  NaNs are ignored.
+ */
+class RunningSum
+{
+public:
+    void replace(metricq::Value old_value, metricq::Value new_value)
+    {
+        remove(old_value);
+        add(new_value);
+    }
+
+    void add(metricq::Value value)
+    {
+        if (std::isnan(value))
+        {
+            return;
+        }
+        if (std::isinf(value))
+        {
+            (value > 0 ? positive_infinities_ : negative_infinities_)++;
+            return;
+        }
+
+        auto t = sum_ + value;
+        if (std::abs(sum_) >= std::abs(value))
+        {
+            compensation_ += (sum_ - t) + value;
+        }
+        else
+        {
+            compensation_ += (value - t) + sum_;
+        }
+        sum_ = t;
+    }
+
+    void remove(metricq::Value value)
+    {
+        if (std::isinf(value))
+        {
+            (value > 0 ? positive_infinities_ : negative_infinities_)--;
+            return;
+        }
+        add(-value);
+    }
+
+    // Recompute the sum from scratch to get rid of any accumulated error
+    void reset(const std::vector<metricq::Value>& values)
+    {
+        sum_ = 0;
+        compensation_ = 0;
+        positive_infinities_ = 0;
+        negative_infinities_ = 0;
+        for (auto value : values)
+        {
+            add(value);
+        }
+    }
+
+    metricq::Value value() const
+    {
+        if (positive_infinities_ > 0 && negative_infinities_ > 0)
+        {
+            return std::numeric_limits<metricq::Value>::quiet_NaN();
+        }
+        if (positive_infinities_ > 0)
+        {
+            return std::numeric_limits<metricq::Value>::infinity();
+        }
+        if (negative_infinities_ > 0)
+        {
+            return -std::numeric_limits<metricq::Value>::infinity();
+        }
+        return sum_ + compensation_;
+    }
+
+private:
+    metricq::Value sum_ = 0;
+    metricq::Value compensation_ = 0;
+    std::size_t positive_infinities_ = 0;
+    std::size_t negative_infinities_ = 0;
+};
+
+/**
+ * Decides when to recompute a RunningSum from scratch, to limit the rounding errors that
+ * accumulate over time: at the first value of every period of the timestamps.
+ *
+ * As this is aligned to the timestamps instead of, e.g., counting values, the rounding of the sum
+ * only depends on the values since the start of the current period, no matter when the
+ * evaluation started.  A backfill chunk whose warmup covers such a point thus ends up in the same
+ * state as evaluating everything before it.
+ */
+class RecomputeSchedule
+{
+public:
+    static constexpr metricq::Duration period = std::chrono::minutes(1);
+
+    // Whether to recompute before aggregating the values of this time
+    bool due(metricq::TimePoint time)
+    {
+        auto current = time.time_since_epoch() / period;
+        if (current == current_)
+        {
+            return false;
+        }
+        current_ = current;
+        return true;
+    }
+
+private:
+    metricq::Duration::rep current_ = std::numeric_limits<metricq::Duration::rep>::min();
+};
+
+/**
+ * The minimum (or with std::greater, the maximum) of a set of indexed values, ignoring NaNs.
+ */
+template <typename Compare = std::less<metricq::Value>>
+class RunningExtremum
+{
+public:
+    RunningExtremum(std::size_t count) : heap_(count)
+    {
+    }
+
+    void replace(std::size_t index, metricq::Value value)
+    {
+        if (std::isnan(value))
+        {
+            heap_.erase(index);
+        }
+        else
+        {
+            heap_.set(index, value);
+        }
+    }
+
+    metricq::Value value() const
+    {
+        if (heap_.empty())
+        {
+            return std::numeric_limits<metricq::Value>::quiet_NaN();
+        }
+        return heap_.top_key();
+    }
+
+private:
+    IndexedHeap<metricq::Value, Compare> heap_;
+};
@@ -0,0 +1,348 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#include "backfill.hpp"
+#include "combined_metric.hpp"
+#include "input_patterns.hpp"
+#include "metric_id.hpp"
+#include "partition.hpp"
+#include "snapshot.hpp"
+
+#include <algorithm>
+#include <optional>
+#include <stdexcept>
+
+namespace
+{
+using Series = Backfill::Series;
+using Rep = metricq::TimePoint::duration::rep;
+
+Rep ticks(metricq::TimePoint time)
+{
+    return time.time_since_epoch().count();
+}
+
+Rep floor_div(Rep value, Rep divisor)
+{
+    return value / divisor - (value % divisor != 0 && (value < 0) != (divisor < 0));
+}
+
+// One combined metric, fed from complete series of its inputs
+class Evaluation
+{
+public:
+    Evaluation(const metricq::json& expression, const Backfill::SeriesByName& series)
+    : metric_(expression), inputs_(metric_.collect_metric_inputs()),
+      outputs_(metric_.outputs().size())
+    {
+        for (auto& [id, nodes] : inputs_)
+        {
+            const auto& name = MetricIds::global().name(id);
+            auto it = series.find(name);
+            if (it == series.end())
+            {
+                throw std::runtime_error("no input series for metric " + name);
+            }
+            feeds_.push_back({ &it->second, &nodes, 0 });
+        }
+    }
+
+    Evaluation(const Evaluation&) = delete;
+    Evaluation& operator=(const Evaluation&) = delete;
+
+    const CombinedMetric& metric() const
+    {
+        return metric_;
+    }
+
+    // The range of time covered by the inputs, if there is any input at all
+    std::optional<std::pair<Rep, Rep>> time_range() const
+    {
+        std::optional<std::pair<Rep, Rep>> range;
+        for (const auto& feed : feeds_)
+        {
+            if (feed.series->empty())
+            {
+                continue;
+            }
+            auto first = ticks(feed.series->front().time);
+            auto last = ticks(feed.series->back().time);
+            range = range ? std::make_pair(std::min(range->first, first),
+                                           std::max(range->second, last)) :
+                            std::make_pair(first, last);
+        }
+        return range;
+    }
+
+    // Feed all input values within (from, to] in steps aligned to multiples of step
+    void evaluate(Rep from, Rep to, Rep step, bool keep_outputs)
+    {
+        for (auto& feed : feeds_)
+        {
+            feed.next = std::upper_bound(feed.series->begin(), feed.series->end(), from,
+                                         [](Rep time, metricq::TimeValue tv) {
+                                             return time < ticks(tv.time);
+                                         }) -
+                        feed.series->begin();
+        }
+
+        while (true)
+        {
+            std::optional<Rep> next;
+            for (const auto& feed : feeds_)
+            {
+                if (feed.next < feed.series->size())
+                {
+                    auto time = ticks((*feed.series)[feed.next].time);
+                    if (time <= to && (!next || time < *next))
+                    {
+                        next = time;
+                    }
+                }
+            }
+            if (!next)
+            {
+                break;
+            }
+
+            // Skip steps without any input
+            auto step_end = std::min(to, -floor_div(-*next, step) * step);
+            for (auto& feed : feeds_)
+            {
+                const auto& series = *feed.series;
+                while (feed.next < series.size() && ticks(series[feed.next].time) <= step_end)
+                {
+                    for (auto* node : *feed.nodes)
+                    {
+                        node->put(series[feed.next]);
+                    }
+                    feed.next++;
+                }
+            }
+
+            metric_.update();
+            const auto& outputs = metric_.outputs();
+            for (std::size_t i = 0; i < outputs.size(); ++i)
+            {
+                auto& node = *outputs[i].second;
+                while (node.has_input())
+                {
+                    if (keep_outputs)
+                    {
+                        outputs_[i].push_back(node.peek());
+                    }
+                    node.discard();
+                }
+            }
+        }
+    }
+
+    std::vector<char> state() const
+    {
+        SnapshotWriter writer;
+        metric_.save_state(writer);
+        return writer.buffer();
+    }
+
+    void restore(const std::vector<char>& state)
+    {
+        SnapshotReader reader(state.data(), state.data() + state.size());
+        metric_.restore_state(reader);
+    }
+
+    std::vector<Series>& outputs()
+    {
+        return outputs_;
+    }
+
+private:
+    struct Feed
+    {
+        const Series* series;
+        std::vector<MetricInputNode*>* nodes;
+        std::size_t next;
+    };
+
+    CombinedMetric metric_;
+    MetricInputNodes inputs_;
+    std::vector<Feed> feeds_;
+    std::vector<Series> outputs_;
+};
+} // namespace
+
+Backfill::Backfill(const BackfillSettings& settings)
+: settings_(settings), pool_(std::max<std::size_t>(settings.threads, 1))
+{
+    if (settings_.step <= metricq::Duration::zero() ||
+        settings_.chunk.count() % settings_.step.count() != 0)
+    {
+        throw std::invalid_argument("the chunk length must be a multiple of the step length");
+    }
+}
+
+std::vector<std::pair<std::string, metricq::json>>
+Backfill::expressions(const metricq::json& metrics, const std::set<std::string>& known_metrics)
+{
+    std::vector<std::pair<std::string, metricq::json>> result;
+    for (const auto& [name, config] : metrics.items())
+    {
+        // Large sums are split up like in the combinator, even without patterns
+        result.emplace_back(name, InputPatterns::expand(config.at("expression"), known_metrics));
+    }
+    return result;
+}
+
+std::vector<std::string> Backfill::run(const metricq::json& metrics, SeriesByName& series)
+{
+    std::set<std::string> known_metrics;
+    for (const auto& [name, _] : series)
+    {
+        known_metrics.insert(name);
+    }
+    auto combined = expressions(metrics, known_metrics);
+
+    std::map<std::string, std::size_t> producers;
+    std::vector<Partition::Metric> described;
+    for (std::size_t i = 0; i < combined.size(); ++i)
+    {
+        described.push_back(Partition::describe(combined[i].first, combined[i].second));
+        for (const auto& output : described.back().outputs)
+        {
+            producers.emplace(output, i);
+        }
+    }
+
+    std::vector<std::string> output_names;
+    std::vector<bool> done(combined.size(), false);
+    for (std::size_t remaining = combined.size(); remaining > 0;)
+    {
+        std::vector<std::size_t> ready;
+        for (std::size_t i = 0; i < combined.size(); ++i)
+        {
+            auto inputs_done = std::all_of(
+                described[i].inputs.begin(), described[i].inputs.end(), [&](const auto& input) {
+                    auto producer = producers.find(input);
+                    return producer == producers.end() || done[producer->second];
+                });
+            if (!done[i] && inputs_done)
+            {
+                ready.push_back(i);
+                // Intern all names of the metric before evaluating metrics concurrently
+                CombinedMetric check(combined[i].second);
+            }
+        }
+        if (ready.empty())
+        {
+            throw std::runtime_error("circular dependency between combined metrics");
+        }
+
+        std::vector<std::vector<std::pair<std::string, Series>>> results(ready.size());
+        pool_.run(ready.size(), [&](std::size_t j) {
+            results[j] = evaluate(combined[ready[j]].second, series);
+        });
+
+        for (std::size_t j = 0; j < ready.size(); ++j)
+        {
+            for (auto& [suffix, output] : results[j])
+            {
+                auto name = combined[ready[j]].first + suffix;
+                series[name] = std::move(output);
+                output_names.push_back(name);
+            }
+            done[ready[j]] = true;
+            remaining--;
+        }
+    }
+    return output_names;
+}
+
+std::vector<std::pair<std::string, Series>> Backfill::evaluate(const metricq::json& expression,
+                                                               const SeriesByName& series)
+{
+    std::vector<std::pair<std::string, Series>> result;
+    std::optional<std::pair<Rep, Rep>> range;
+    {
+        Evaluation evaluation(expression, series);
+        for (const auto& [suffix, _] : evaluation.metric().outputs())
+        {
+            result.emplace_back(suffix, Series());
+        }
+        range = evaluation.time_range();
+    }
+    if (!range)
+    {
+        return result;
+    }
+
+    // Chunks are aligned to multiples of their length, the first one contains the first value
+    auto chunk = settings_.chunk.count();
+    auto step = settings_.step.count();
+    auto first_chunk = floor_div(range->first - 1, chunk);
+    auto chunk_count =
+        static_cast<std::size_t>(floor_div(range->second - 1, chunk) - first_chunk + 1);
+    auto chunk_start = [&](std::size_t i) { return (first_chunk + static_cast<Rep>(i)) * chunk; };
+
+    struct ChunkRun
+    {
+        std::vector<char> start_state;
+        std::vector<char> end_state;
+        std::vector<Series> outputs;
+    };
+    std::vector<ChunkRun> runs(chunk_count);
+
+    pool_.run(chunk_count, [&](std::size_t i) {
+        Evaluation evaluation(expression, series);
+        auto start = chunk_start(i);
+        if (i > 0)
+        {
+            auto warmup_start = floor_div(start - settings_.warmup.count(), step) * step;
+            evaluation.evaluate(warmup_start, start, step, false);
+            runs[i].start_state = evaluation.state();
+        }
+        evaluation.evaluate(start, start + chunk, step, true);
+        runs[i].end_state = evaluation.state();
+        runs[i].outputs = std::move(evaluation.outputs());
+    });
+    chunks_ += chunk_count;
+
+    // Chunks whose warmup did not end up in the state the preceding chunk ended with
+    for (std::size_t i = 1; i < chunk_count; ++i)
+    {
+        if (runs[i].start_state == runs[i - 1].end_state)
+        {
+            continue;
+        }
+        Evaluation evaluation(expression, series);
+        evaluation.restore(runs[i - 1].end_state);
+        evaluation.evaluate(chunk_start(i), chunk_start(i) + chunk, step, true);
+        runs[i].end_state = evaluation.state();
+        runs[i].outputs = std::move(evaluation.outputs());
+        reruns_++;
+    }
+
+    for (auto& run : runs)
+    {
+        for (std::size_t i = 0; i < result.size(); ++i)
+        {
+            auto& output = result[i].second;
+            output.insert(output.end(), run.outputs[i].begin(), run.outputs[i].end());
+        }
+    }
+    return result;
+}
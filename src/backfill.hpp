@@ -0,0 +1,104 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include "work_stealing_pool.hpp"
+
+#include <metricq/json.hpp>
+#include <metricq/types.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct BackfillSettings
+{
+    // The time range is split into chunks of this length, which are evaluated in parallel
+    metricq::Duration chunk = std::chrono::hours(24);
+    // Input before the start of a chunk that is evaluated to rebuild the state of its nodes
+    metricq::Duration warmup = std::chrono::hours(1);
+    // Input is fed to combined metrics in steps of this length, as if it arrived live
+    metricq::Duration step = std::chrono::seconds(10);
+    std::size_t threads = 1;
+};
+
+/**
+ * Evaluates combined metrics over complete input time series, e.g. to compute a new combined
+ * metric over months of existing data.
+ *
+ * Chunks of the time range are evaluated in parallel.  All but the first start by evaluating the
+ * warmup period before them, assuming that this brings all nodes into the same state as evaluating
+ * everything before.  This is then checked by comparing the snapshot of their state at the start
+ * with that at the end of the preceding chunk.  Chunks for which it does not hold, e.g. because a
+ * window is longer than the warmup, are evaluated again from the actual state, so the result is
+ * always the same as evaluating the whole time range in one go.
+ */
+class Backfill
+{
+public:
+    using Series = std::vector<metricq::TimeValue>;
+    using SeriesByName = std::map<std::string, Series>;
+
+    struct Stats
+    {
+        std::size_t chunks = 0;
+        // Chunks that had to be evaluated again, as the warmup did not suffice
+        std::size_t reruns = 0;
+    };
+
+    explicit Backfill(const BackfillSettings& settings);
+
+    /*
+     * Expressions of the combined metrics of a configuration, with input patterns expanded
+     * against the given metrics.
+     */
+    static std::vector<std::pair<std::string, metricq::json>>
+    expressions(const metricq::json& metrics, const std::set<std::string>& known_metrics);
+
+    /*
+     * Evaluate all combined metrics of a configuration and add their outputs to series.  Combined
+     * metrics that use the output of others as input are evaluated after those.
+     * Returns the names of all outputs.
+     */
+    std::vector<std::string> run(const metricq::json& metrics, SeriesByName& series);
+
+    /*
+     * The outputs of one combined metric, by suffix, see CombinedMetric::outputs().
+     * Names of input metrics are interned while constructing the combined metric, which has to
+     * happen before evaluating it concurrently with others, see MetricIds.
+     */
+    std::vector<std::pair<std::string, Series>> evaluate(const metricq::json& expression,
+                                                         const SeriesByName& series);
+
+    Stats stats() const
+    {
+        return { chunks_, reruns_ };
+    }
+
+private:
+    BackfillSettings settings_;
+    WorkStealingPool pool_;
+    std::atomic<std::size_t> chunks_ = 0;
+    std::atomic<std::size_t> reruns_ = 0;
+};
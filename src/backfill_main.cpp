@@ -0,0 +1,209 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#include "backfill.hpp"
+#include "column_file.hpp"
+#include "combined_metric.hpp"
+#include "partition.hpp"
+
+#include <metricq/json.hpp>
+#include <metricq/logger/nitro.hpp>
+
+#include <nitro/options/parser.hpp>
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using Log = metricq::logger::nitro::Log;
+
+constexpr const char* column_file_extension = ".col";
+
+struct Options
+{
+    Options(int argc, const char* argv[])
+    {
+        nitro::options::parser parser;
+        parser
+            .option("config",
+                    "A JSON file with the configuration of the combined metrics to compute, as "
+                    "sent by the metricq manager.")
+            .short_name("c");
+        parser
+            .option("input-directory",
+                    "A directory with one column file <metric>.col per input metric.")
+            .short_name("i");
+        parser
+            .option("output-directory", "Write one column file per computed metric to here.")
+            .short_name("o");
+        parser.option("chunk", "Length of the chunks of time evaluated in parallel.")
+            .default_value("24h");
+        parser
+            .option("warmup",
+                    "How much input before each chunk to evaluate to rebuild the state at its "
+                    "start.")
+            .default_value("1h");
+        parser.option("step", "Feed input to combined metrics in steps of this length.")
+            .default_value("10s");
+        parser.option("threads", "Number of threads to evaluate chunks with.")
+            .default_value(std::to_string(std::max(1u, std::thread::hardware_concurrency())));
+        parser.toggle("verbose").short_name("v");
+        parser.toggle("quiet").short_name("q");
+        parser.toggle("help").short_name("h");
+
+        try
+        {
+            auto options = parser.parse(argc, argv);
+
+            metricq::logger::nitro::initialize();
+            metricq::logger::nitro::set_severity(nitro::log::severity_level::info);
+
+            if (options.given("help"))
+            {
+                parser.usage();
+                std::exit(EXIT_SUCCESS);
+            }
+
+            if (options.given("verbose"))
+            {
+                metricq::logger::nitro::set_severity(nitro::log::severity_level::debug);
+            }
+            else if (options.given("quiet"))
+            {
+                metricq::logger::nitro::set_severity(nitro::log::severity_level::warn);
+            }
+
+            this->config = options.get("config");
+            this->input_directory = options.get("input-directory");
+            this->output_directory = options.get("output-directory");
+            this->settings.chunk = metricq::duration_parse(options.get("chunk"));
+            this->settings.warmup = metricq::duration_parse(options.get("warmup"));
+            this->settings.step = metricq::duration_parse(options.get("step"));
+            this->settings.threads = std::stoul(options.get("threads"));
+        }
+        catch (nitro::options::parsing_error& e)
+        {
+            Log::warn() << "Error parsing options: " << e.what();
+            parser.usage();
+            std::exit(EXIT_FAILURE);
+        }
+        catch (std::exception& e)
+        {
+            Log::error() << "Unhandled exception: " << e.what();
+            parser.usage();
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    std::string config;
+    std::string input_directory;
+    std::string output_directory;
+    BackfillSettings settings;
+};
+
+// The "metrics" of a transformer configuration, or a file with only those
+static metricq::json read_metrics(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        throw std::runtime_error("failed to open " + path);
+    }
+    auto config = metricq::json::parse(file);
+    if (auto metrics = config.find("metrics"); metrics != config.end())
+    {
+        return *metrics;
+    }
+    return config;
+}
+
+int main(int argc, const char* argv[])
+{
+    Options options{ argc, argv };
+
+    try
+    {
+        auto metrics = read_metrics(options.config);
+
+        std::set<std::string> available;
+        for (const auto& entry : std::filesystem::directory_iterator(options.input_directory))
+        {
+            if (entry.path().extension() == column_file_extension)
+            {
+                available.insert(entry.path().stem().string());
+            }
+        }
+
+        // Only read the series that are inputs, but not computed themselves
+        std::set<std::string> inputs;
+        std::set<std::string> outputs;
+        for (const auto& [name, expression] : Backfill::expressions(metrics, available))
+        {
+            auto metric = Partition::describe(name, expression);
+            inputs.insert(metric.inputs.begin(), metric.inputs.end());
+            outputs.insert(metric.outputs.begin(), metric.outputs.end());
+        }
+
+        Backfill::SeriesByName series;
+        for (const auto& name : inputs)
+        {
+            if (outputs.count(name) == 0)
+            {
+                auto path = std::filesystem::path(options.input_directory) /
+                            (name + column_file_extension);
+                series[name] = ColumnFile::read(path.string());
+                Log::debug() << "Read " << series[name].size() << " values of " << name;
+            }
+        }
+        Log::info() << "Read " << series.size() << " input metrics, evaluating "
+                    << metrics.size() << " combined metrics with " << options.settings.threads
+                    << " threads";
+
+        Backfill backfill(options.settings);
+        auto names = backfill.run(metrics, series);
+
+        std::filesystem::create_directories(options.output_directory);
+        for (const auto& name : names)
+        {
+            auto path = std::filesystem::path(options.output_directory) /
+                        (name + column_file_extension);
+            ColumnFile::write(path.string(), series.at(name));
+            Log::debug() << "Wrote " << series.at(name).size() << " values of " << name;
+        }
+
+        auto stats = backfill.stats();
+        Log::info() << "Wrote " << names.size() << " metrics, evaluated " << stats.chunks
+                    << " chunks of which " << stats.reruns
+                    << " had to be evaluated again as their warmup was too short";
+    }
+    catch (const CombinedMetric::ParseError& e)
+    {
+        Log::error() << "Error parsing configuration: " << e.what();
+        return EXIT_FAILURE;
+    }
+    catch (const std::exception& e)
+    {
+        Log::error() << "Backfill failed: " << e.what();
+        return EXIT_FAILURE;
+    }
+}
@@ -19,53 +19,58 @@
 // along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "binary_node.hpp"
+#include "snapshot.hpp"
+#include "tracer.hpp"
 
-#include <metricq/logger/nitro.hpp>
+#include <algorithm>
 
-#include <fmt/format.h>
-
-using Log = metricq::logger::nitro::Log;
-
-void BinaryNode::update()
+void BinaryNode::skip_covered(InputNode& input, std::optional<metricq::TimeValue>& held)
 {
-    left_->update();
-    right_->update();
-
-    while (left_->has_input() && right_->has_input())
+    while (input.has_input() && input.peek().time <= last_time_)
     {
-        auto l = left_->peek();
-        auto r = right_->peek();
-
-        metricq::TimePoint new_time;
-        {
-            if (l.time < r.time)
-            {
-                new_time = l.time;
-                left_->discard();
-            }
-            else if (l.time > r.time)
-            {
-                new_time = r.time;
-                right_->discard();
-            }
-            else // (l.time == r.time)
-            {
-                new_time = l.time;
-                left_->discard();
-                right_->discard();
-            }
-        }
-
-        auto new_value = combine(l.value, r.value);
+        held = input.peek();
+        input.discard();
+    }
+}
 
-        put(metricq::TimeValue{ new_time, new_value });
+void BinaryNode::trace() const
+{
+    if (Tracer::active())
+    {
+        Tracer::global().record(TraceEventKind::binary, this, last_time_, left_->queue_length(),
+                                right_->queue_length(), queue_length());
     }
-    Log::trace() << fmt::format("Remaining queued values: {{ left: {}, right: {}, output: {} }}",
-                                left_->queue_length(), right_->queue_length(), queue_length());
 }
 
-void BinaryNode::collect_metric_inputs(MetricInputNodesByName& inputs)
+void BinaryNode::collect_metric_inputs(std::vector<MetricInputNode*>& inputs)
 {
     left_->collect_metric_inputs(inputs);
     right_->collect_metric_inputs(inputs);
 }
+
+void BinaryNode::collect_nodes(std::vector<const InputNode*>& nodes) const
+{
+    left_->collect_nodes(nodes);
+    right_->collect_nodes(nodes);
+    nodes.push_back(this);
+}
+
+void BinaryNode::save_state(SnapshotWriter& writer) const
+{
+    InputQueue::save_state(writer);
+    writer.write(held_left_);
+    writer.write(held_right_);
+    writer.write(last_time_);
+    left_->save_state(writer);
+    right_->save_state(writer);
+}
+
+void BinaryNode::restore_state(SnapshotReader& reader)
+{
+    InputQueue::restore_state(reader);
+    held_left_ = reader.read_optional_time_value();
+    held_right_ = reader.read_optional_time_value();
+    last_time_ = reader.read_time_point();
+    left_->restore_state(reader);
+    right_->restore_state(reader);
+}
@@ -20,34 +20,232 @@
 #pragma once
 
 #include "input_node.hpp"
+#include "join_options.hpp"
+#include "node_arena.hpp"
+#include "profiler.hpp"
 
 #include <metricq/types.hpp>
 
+#include <algorithm>
 #include <cmath>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <utility>
 
+/**
+ * Joins the values of two inputs by time.
+ *
+ * The operator is a template parameter of the subclasses, instead of a virtual function, so that
+ * it is inlined into the merge loop of each operation, see BinaryOperatorNode.
+ */
 struct BinaryNode : CalculationNode
 {
 public:
-    BinaryNode(std::unique_ptr<InputNode> left, std::unique_ptr<InputNode> right)
-    : left_(std::move(left)), right_(std::move(right))
+    BinaryNode(NodePtr<InputNode> left, NodePtr<InputNode> right,
+               JoinOptions options = {})
+    : left_(std::move(left)), right_(std::move(right)), options_(options)
     {
     }
 
-    void update() override;
-    virtual metricq::Value combine(metricq::Value a, metricq::Value b) = 0;
+    void collect_metric_inputs(std::vector<MetricInputNode*>&) override;
+    void collect_nodes(std::vector<const InputNode*>&) const override;
 
-    void collect_metric_inputs(MetricInputNodesByName&) override;
+    void save_state(SnapshotWriter&) const override;
+    void restore_state(SnapshotReader&) override;
+
+protected:
+    // Update both inputs, then produce all output values that are complete
+    template <typename Operator>
+    void merge(Operator combine);
+
+    // Discard values that are not newer than the last output, remembering them for holding
+    void skip_covered(InputNode& input, std::optional<metricq::TimeValue>& held);
+
+    std::size_t queued_inputs() const
+    {
+        return left_->queue_length() + right_->queue_length();
+    }
+
+    void trace() const;
+
+protected:
+    NodePtr<InputNode> left_;
+    NodePtr<InputNode> right_;
+    JoinOptions options_;
+
+    // Last values discarded from each input, only used when holding values
+    std::optional<metricq::TimeValue> held_left_;
+    std::optional<metricq::TimeValue> held_right_;
+    metricq::TimePoint last_time_ = Timestamp::genesis();
+};
+
+template <typename Operator>
+void BinaryNode::merge(Operator combine)
+{
+    left_->update();
+    right_->update();
+
+    Profiler::NodeScope profile(
+        *this, [this] { return queued_inputs(); }, [this] { return queue_length(); });
+
+    while (true)
+    {
+        if (options_.hold)
+        {
+            skip_covered(*left_, held_left_);
+            skip_covered(*right_, held_right_);
+        }
+
+        metricq::TimeValue new_tv;
+        if (left_->has_input() && right_->has_input())
+        {
+            auto l = left_->peek();
+            auto r = right_->peek();
+
+            // Consume whichever input comes first, or both if they agree on the time
+            new_tv = { std::min(l.time, r.time), combine(l.value, r.value) };
+            if (options_.coincides(l.time, new_tv.time))
+            {
+                left_->discard();
+                held_left_ = l;
+            }
+            if (options_.coincides(r.time, new_tv.time))
+            {
+                right_->discard();
+                held_right_ = r;
+            }
+        }
+        else if (left_->has_input() && held_right_ &&
+                 options_.holds_at(*held_right_, left_->peek().time))
+        {
+            auto l = left_->peek();
+            left_->discard();
+            held_left_ = l;
+            new_tv = { l.time, combine(l.value, held_right_->value) };
+        }
+        else if (right_->has_input() && held_left_ &&
+                 options_.holds_at(*held_left_, right_->peek().time))
+        {
+            auto r = right_->peek();
+            right_->discard();
+            held_right_ = r;
+            new_tv = { r.time, combine(held_left_->value, r.value) };
+        }
+        else
+        {
+            break;
+        }
+
+        last_time_ = new_tv.time;
+        put(new_tv);
+    }
+    trace();
+}
+
+template <typename Operator>
+class BinaryOperatorNode final : public BinaryNode
+{
+public:
+    using BinaryNode::BinaryNode;
+
+    void update() override
+    {
+        merge(Operator());
+    }
+};
+
+/**
+ * An operator with a ConstantInput on one side.
+ *
+ * As the constant always has a value, no joining is needed: every value of the other input
+ * produces an output value at its time.  These are applied in the contiguous runs in which the
+ * input queue stores them.
+ */
+template <typename Operator, bool ConstantLeft>
+class ConstantOperandNode final : public BinaryNode
+{
+public:
+    ConstantOperandNode(NodePtr<InputNode> left, NodePtr<InputNode> right,
+                        JoinOptions options = {})
+    : BinaryNode(std::move(left), std::move(right), options),
+      constant_(static_cast<const ConstantInput&>(ConstantLeft ? *left_ : *right_)
+                    .get_constant()
+                    .value)
+    {
+    }
+
+    void update() override
+    {
+        auto& input = ConstantLeft ? *right_ : *left_;
+        input.update();
+
+        Profiler::NodeScope profile(
+            *this, [this] { return queued_inputs(); }, [this] { return queue_length(); });
+
+        Apply apply(*this);
+        input.drain(apply);
+        trace();
+    }
 
 private:
-    std::unique_ptr<InputNode> left_;
-    std::unique_ptr<InputNode> right_;
+    struct Apply : SpanConsumer
+    {
+        explicit Apply(ConstantOperandNode& node) : node(node)
+        {
+        }
+
+        void consume(const metricq::TimeValue* values, std::size_t count) override
+        {
+            Operator combine;
+            auto constant = node.constant_;
+            auto hold = node.options_.hold;
+            auto last_time = node.last_time_;
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                // Like skip_covered(), drop values that are not newer than the last output
+                if (hold && values[i].time <= last_time)
+                {
+                    continue;
+                }
+                auto value = ConstantLeft ? combine(constant, values[i].value)
+                                          : combine(values[i].value, constant);
+                // Bypassing the virtual put(), as the node has no other output
+                node.InputQueue::put({ values[i].time, value });
+                last_time = values[i].time;
+            }
+            node.last_time_ = last_time;
+        }
+
+        ConstantOperandNode& node;
+    };
+
+    metricq::Value constant_;
 };
 
-class AddNode : public BinaryNode
+// Creates the node for an operator, using a ConstantOperandNode if exactly one side is constant
+template <typename Operator>
+NodePtr<BinaryNode> make_binary_node(NodeArena& arena, NodePtr<InputNode> left,
+                                     NodePtr<InputNode> right, JoinOptions options)
+{
+    bool left_constant = dynamic_cast<const ConstantInput*>(left.get()) != nullptr;
+    bool right_constant = dynamic_cast<const ConstantInput*>(right.get()) != nullptr;
+    if (left_constant && !right_constant)
+    {
+        return arena.make<ConstantOperandNode<Operator, true>>(std::move(left), std::move(right),
+                                                               options);
+    }
+    if (right_constant && !left_constant)
+    {
+        return arena.make<ConstantOperandNode<Operator, false>>(std::move(left), std::move(right),
+                                                                options);
+    }
+    return arena.make<BinaryOperatorNode<Operator>>(std::move(left), std::move(right), options);
+}
+
+struct AddOperator
 {
-    metricq::Value combine(metricq::Value a, metricq::Value b) override
+    metricq::Value operator()(metricq::Value a, metricq::Value b) const
     {
         /*
          * For practical reasons, we give NaNs a special interpretation here:
@@ -74,40 +272,36 @@ class AddNode : public BinaryNode
         }
         return a + b;
     }
-
-public:
-    using BinaryNode::BinaryNode;
 };
 
-class SubtractNode : public BinaryNode
+/*
+ * Compares the values of both inputs, producing 1 if the comparison holds and 0 otherwise.  NaN
+ * inputs produce NaN, so a missing value is not mistaken for a false condition.
+ */
+template <typename Compare>
+struct ComparisonOperator
 {
-    metricq::Value combine(metricq::Value a, metricq::Value b) override
+    metricq::Value operator()(metricq::Value a, metricq::Value b) const
     {
-        return a - b;
+        if (std::isnan(a) || std::isnan(b))
+        {
+            return std::nan("");
+        }
+        return Compare()(a, b) ? 1. : 0.;
     }
-
-public:
-    using BinaryNode::BinaryNode;
 };
 
-class MultipyNode : public BinaryNode
-{
-    metricq::Value combine(metricq::Value a, metricq::Value b) override
-    {
-        return a * b;
-    }
-
-public:
-    using BinaryNode::BinaryNode;
-};
+using SubtractOperator = std::minus<metricq::Value>;
+using MultiplyOperator = std::multiplies<metricq::Value>;
+using DivideOperator = std::divides<metricq::Value>;
 
-class DivideNode : public BinaryNode
-{
-    metricq::Value combine(metricq::Value a, metricq::Value b) override
-    {
-        return a / b;
-    }
+using GreaterOperator = ComparisonOperator<std::greater<metricq::Value>>;
+using LessOperator = ComparisonOperator<std::less<metricq::Value>>;
+using GreaterEqualOperator = ComparisonOperator<std::greater_equal<metricq::Value>>;
+using LessEqualOperator = ComparisonOperator<std::less_equal<metricq::Value>>;
+using EqualOperator = ComparisonOperator<std::equal_to<metricq::Value>>;
 
-public:
-    using BinaryNode::BinaryNode;
-};
+using AddNode = BinaryOperatorNode<AddOperator>;
+using SubtractNode = BinaryOperatorNode<SubtractOperator>;
+using MultipyNode = BinaryOperatorNode<MultiplyOperator>;
+using DivideNode = BinaryOperatorNode<DivideOperator>;
@@ -0,0 +1,98 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#include "column_file.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+constexpr char magic[8] = { 'M', 'Q', 'C', 'O', 'L', 'S', '1', '\0' };
+} // namespace
+
+std::vector<metricq::TimeValue> ColumnFile::read(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        throw ColumnFileError("failed to open " + path);
+    }
+
+    char header[sizeof(magic)];
+    std::uint64_t count = 0;
+    file.read(header, sizeof(header));
+    file.read(reinterpret_cast<char*>(&count), sizeof(count));
+    if (!file || std::memcmp(header, magic, sizeof(magic)) != 0)
+    {
+        throw ColumnFileError(path + " is not a column file");
+    }
+
+    std::vector<std::int64_t> times(count);
+    std::vector<double> values(count);
+    file.read(reinterpret_cast<char*>(times.data()), count * sizeof(std::int64_t));
+    file.read(reinterpret_cast<char*>(values.data()), count * sizeof(double));
+    if (!file)
+    {
+        throw ColumnFileError(path + " is truncated");
+    }
+
+    using duration = metricq::TimePoint::duration;
+    std::vector<metricq::TimeValue> series;
+    series.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        if (i > 0 && times[i] <= times[i - 1])
+        {
+            throw ColumnFileError(path + " has timestamps out of order");
+        }
+        series.emplace_back(metricq::TimePoint(duration(times[i])), values[i]);
+    }
+    return series;
+}
+
+void ColumnFile::write(const std::string& path, const std::vector<metricq::TimeValue>& series)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        throw ColumnFileError("failed to create " + path);
+    }
+
+    std::uint64_t count = series.size();
+    std::vector<std::int64_t> times;
+    std::vector<double> values;
+    times.reserve(count);
+    values.reserve(count);
+    for (auto tv : series)
+    {
+        times.push_back(tv.time.time_since_epoch().count());
+        values.push_back(tv.value);
+    }
+
+    file.write(magic, sizeof(magic));
+    file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    file.write(reinterpret_cast<const char*>(times.data()), count * sizeof(std::int64_t));
+    file.write(reinterpret_cast<const char*>(values.data()), count * sizeof(double));
+    if (!file.flush())
+    {
+        throw ColumnFileError("failed to write " + path);
+    }
+}
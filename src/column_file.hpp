@@ -0,0 +1,44 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <metricq/types.hpp>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+class ColumnFileError : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * A time series stored column by column: a header, then all timestamps (nanoseconds since the
+ * epoch, int64) and then all values (double), in native byte order.  Timestamps are strictly
+ * increasing.
+ */
+class ColumnFile
+{
+public:
+    static std::vector<metricq::TimeValue> read(const std::string& path);
+    static void write(const std::string& path, const std::vector<metricq::TimeValue>& series);
+};
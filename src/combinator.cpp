@@ -18,19 +18,47 @@
 // You should have received a copy of the GNU General Public License
 // along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
 #include "combinator.hpp"
+#include "input_patterns.hpp"
+#include "partition.hpp"
+#include "profiler.hpp"
+#include "tracer.hpp"
+#include "work_stealing_pool.hpp"
 
+#include <asio/post.hpp>
 #include <metricq/logger/nitro.hpp>
 #include <metricq/source.hpp>
 #include <metricq/utils.hpp>
 
 #include <fmt/format.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
 #include <numeric>
+#include <sstream>
 
 using Log = metricq::logger::nitro::Log;
 
-Combinator::Combinator(const std::string& manager_host, const std::string& token)
-: metricq::Transformer(token), signals_(io_service, SIGINT, SIGTERM)
+Combinator::Combinator(const std::string& manager_host, const std::string& token,
+                       const CombinatorSettings& settings)
+: Combinator(token, settings, nullptr)
+{
+    connect(manager_host);
+}
+
+Combinator::Combinator(const CombinatorSettings& settings, OutputSink& output)
+: Combinator("combinator-offline", settings, &output)
+{
+}
+
+Combinator::Combinator(const std::string& token, const CombinatorSettings& settings,
+                       OutputSink* output)
+: metricq::Transformer(token), signals_(io_service, SIGINT, SIGTERM), trace_signals_(io_service),
+  profile_signals_(io_service), settings_(settings), snapshot_timer_(io_service),
+  profile_timer_(io_service), sink_(*this), output_(output),
+  spill_timer_(io_service), pattern_timer_(io_service),
+  scheduler_(settings.update_budget, settings.shed_age)
 {
     signals_.async_wait([this](auto, auto signal) {
         if (!signal)
@@ -39,10 +67,94 @@ Combinator::Combinator(const std::string& manager_host, const std::string& token
         }
 
         Log::info() << "Shutting down... (received signal " << signal << ")";
+        trace_signals_.cancel();
+        profile_signals_.cancel();
+        profile_timer_.cancel();
+        write_snapshot();
         close();
     });
 
-    connect(manager_host);
+    if (!settings_.trace_metrics.empty())
+    {
+        if (Tracer::compiled)
+        {
+            auto& tracer = Tracer::global();
+            tracer.configure(settings_.trace_buffer_size, settings_.trace_sample_interval);
+            for (const auto& name : settings_.trace_metrics)
+            {
+                tracer.select(MetricIds::global().intern(name));
+            }
+            trace_signals_.add(SIGUSR2);
+            wait_for_trace_signal();
+            Log::info() << "Tracing every " << settings_.trace_sample_interval << ". step of "
+                        << settings_.trace_metrics.size()
+                        << " combined metric(s), send SIGUSR2 to dump the trace to "
+                        << settings_.trace_path;
+        }
+        else
+        {
+            Log::warn() << "Not tracing combined metrics, this build does not support tracing";
+        }
+    }
+
+    if (settings_.profile_sample_interval > 0)
+    {
+        if (Profiler::compiled)
+        {
+            Profiler::global().configure(settings_.profile_sample_interval);
+            profile_signals_.add(SIGUSR1);
+            wait_for_profile_signal();
+            Log::info() << "Profiling every " << settings_.profile_sample_interval
+                        << ". update of each combined metric, send SIGUSR1 for a report";
+        }
+        else
+        {
+            Log::warn() << "Not profiling combined metrics, this build does not support profiling";
+        }
+    }
+
+    if (!settings_.snapshot_path.empty())
+    {
+        try
+        {
+            restored_snapshot_ = Snapshot::load(settings_.snapshot_path);
+            Log::info() << "Loaded snapshot " << settings_.snapshot_path << " with state for "
+                        << restored_snapshot_->size() << " combined metric(s)";
+        }
+        catch (const std::exception& e)
+        {
+            Log::warn() << "Not restoring state from snapshot: " << e.what();
+        }
+    }
+
+    if (settings_.update_threads > 1)
+    {
+        WorkStealingPool::configure_global(settings_.update_threads);
+        Log::info() << "Updating subtrees of large expressions with " << settings_.update_threads
+                    << " threads";
+    }
+
+    if (!settings_.spill_directory.empty())
+    {
+        spill_ = std::make_unique<SpillBuffer>(output_ ? *output_ : sink_,
+                                               settings_.spill_directory,
+                                               settings_.spill_memory_limit);
+
+        if (!settings_.spill_metrics_prefix.empty())
+        {
+            const auto& prefix = settings_.spill_metrics_prefix;
+            (*this)[prefix + ".pending_bytes"].metadata.json(
+                { { "unit", "B" },
+                  { "rate", 1.0 },
+                  { "description", "Output values waiting to be sent, in memory or on disk" } });
+            (*this)[prefix + ".spilled_bytes"].metadata.json(
+                { { "unit", "B" },
+                  { "rate", 1.0 },
+                  { "description", "Output values written to disk since startup" } });
+            spill_metrics_ = SpillMetrics{ spill_->metric_id(prefix + ".pending_bytes"),
+                                           spill_->metric_id(prefix + ".spilled_bytes") };
+        }
+    }
 }
 
 Combinator::~Combinator()
@@ -51,21 +163,94 @@ Combinator::~Combinator()
 
 void Combinator::on_transformer_config(const metricq::json& config)
 {
+    Log::trace() << "config: " << config;
+    config_ = config;
+    apply_config();
+
+    if (request_pattern_matches())
+    {
+        // Keep the snapshot until the combined metrics with input patterns have been created
+        return;
+    }
+
+    // State from the snapshot is only meaningful right after a restart, later configuration
+    // updates preserve the state of unchanged combined metrics by themselves.
+    restored_snapshot_.reset();
+}
+
+void Combinator::apply_config()
+{
+    auto& ids = MetricIds::global();
     input_metrics.clear();
-    CombinedMetricByName updated_combined_metrics;
+    CombinedMetricById updated_combined_metrics;
+    std::vector<bool> combined_outputs;
 
-    Log::trace() << "config: " << config;
-    auto& combined_metrics = config.at("metrics");
+    // Expressions are compared and fingerprinted with their patterns expanded, so that the state
+    // of a combined metric is only lost if the set of metrics it matches changed.
+    struct ConfiguredMetric
+    {
+        std::string name;
+        const metricq::json* config;
+        metricq::json expression;
+        bool has_patterns;
+    };
+    std::vector<ConfiguredMetric> configured;
+
+    auto& combined_metrics = config_.at("metrics");
     for (auto it = combined_metrics.begin(); it != combined_metrics.end(); ++it)
     {
-        auto& combined_config = it.value();
-        auto combined_name = it.key();
-        auto& combined_expression = combined_config.at("expression");
+        auto& configured_expression = it.value().at("expression");
+        bool has_patterns = InputPatterns::contains_patterns(configured_expression);
+        // Also splits up large sums, minimums and maximums given without patterns
+        metricq::json combined_expression;
+        try
+        {
+            combined_expression = InputPatterns::expand(configured_expression, pattern_matches_);
+        }
+        catch (const CombinedMetric::ParseError& e)
+        {
+            Log::warn() << "Not creating combined metric '" << it.key()
+                        << "' with input patterns: " << e.what();
+            continue;
+        }
+        configured.push_back(
+            { it.key(), &it.value(), std::move(combined_expression), has_patterns });
+    }
+
+    if (settings_.shard_count > 1)
+    {
+        std::vector<Partition::Metric> partition_metrics;
+        partition_metrics.reserve(configured.size());
+        for (const auto& metric : configured)
+        {
+            partition_metrics.push_back(Partition::describe(metric.name, metric.expression));
+        }
+        auto shards = Partition::assign(partition_metrics, settings_.shard_count);
+
+        std::vector<ConfiguredMetric> own;
+        for (std::size_t i = 0; i < configured.size(); ++i)
+        {
+            if (shards[i] == settings_.shard_index)
+            {
+                own.push_back(std::move(configured[i]));
+            }
+        }
+        Log::info() << "Shard " << settings_.shard_index << " of " << settings_.shard_count
+                    << " takes over " << own.size() << " of " << configured.size()
+                    << " combined metric(s)";
+        configured = std::move(own);
+    }
+
+    for (const auto& [combined_name, combined_config_ptr, combined_expression, has_patterns] :
+         configured)
+    {
+        const auto& combined_config = *combined_config_ptr;
+        auto combined_id = ids.intern(combined_name);
 
         // Check if combined metric is already present and that its configuration did not change.
         // If yes, we can simply reuse the already existing combined metric and do not lose any of
         // its state.
-        if (auto metric_it = combined_metrics_.find(combined_name);
+        if (auto metric_it = combined_metrics_.find(combined_id);
             metric_it != combined_metrics_.end() &&
             metric_it->second.expression() == combined_expression)
         {
@@ -77,95 +262,360 @@ void Combinator::on_transformer_config(const metricq::json& config)
         else
         {
             Log::info() << "Updating configuration for combined metric '" << combined_name << "'";
-            updated_combined_metrics.emplace(
-                combined_name, CombinedMetricContainer::from_config(combined_expression));
+            try
+            {
+                updated_combined_metrics.emplace(
+                    combined_id,
+                    CombinedMetricContainer::from_config(combined_id, combined_expression));
+            }
+            catch (const CombinedMetric::ParseError& e)
+            {
+                if (!has_patterns)
+                {
+                    throw;
+                }
+                // Most likely, a pattern did not match any metric (yet)
+                Log::warn() << "Not creating combined metric '" << combined_name
+                            << "' with input patterns: " << e.what();
+                continue;
+            }
+            restore_from_snapshot(combined_id, combined_expression, updated_combined_metrics);
+        }
+        auto& container = updated_combined_metrics.at(combined_id);
+
+        container.priority = Priority::normal;
+        if (auto priority_it = combined_config.find("priority");
+            priority_it != combined_config.end())
+        {
+            auto priority = priority_it->is_string() ?
+                                parse_priority(priority_it->get<std::string>()) :
+                                std::nullopt;
+            if (priority)
+            {
+                container.priority = *priority;
+            }
+            else
+            {
+                Log::warn() << "Unknown priority " << priority_it->dump() << " for combined metric "
+                            << combined_name << ", using normal priority";
+            }
         }
-        auto& combined_metric = updated_combined_metrics.at(combined_name).metric;
 
         Log::debug() << "Deriving new metric: " << combined_name;
 
         // Register input metrics with sink
-        for (const auto& [input_name, _] : combined_metric.collect_metric_inputs())
+        for (const auto& [input_id, _] : container.inputs)
         {
-            input_metrics.emplace(input_name);
+            input_metrics.emplace(ids.name(input_id));
         }
 
-        // Register the combined metric as a new source metric
-        auto& metric = (*this)[combined_name];
-
-        if (combined_config.count("chunk_size"))
+        // Register the outputs of the combined metric as new source metrics
+        for (const auto& [suffix, _] : container.metric.outputs())
         {
-            auto chunk_size = combined_config["chunk_size"].get<int>();
-            if (chunk_size > 0)
+            auto output_name = combined_name + suffix;
+            auto output_id = ids.intern(output_name);
+            if (output_id >= combined_outputs.size())
             {
-                metric.chunk_size(chunk_size);
-                Log::debug() << fmt::format("Using chunk_size ({}) for metric '{}'.", chunk_size,
-                                            combined_name);
+                combined_outputs.resize(output_id + 1);
             }
-            else
+            if (combined_outputs[output_id])
             {
-                Log::warn() << fmt::format(
-                    "The given chunk_size ({}) for the metric '{}' is invalid. Ignoring.",
-                    chunk_size, combined_name);
+                Log::fatal() << "Metric " << output_name
+                             << " is produced by more than one combined metric";
+                throw std::runtime_error("duplicate combined metric");
             }
+            combined_outputs[output_id] = true;
+            declare_combined_metric(output_name, combined_config);
+        }
+    }
+
+    this->combined_metrics_.swap(updated_combined_metrics);
+    this->combined_outputs_.swap(combined_outputs);
+    build_routes();
+}
+
+void Combinator::build_routes()
+{
+    auto& ids = MetricIds::global();
+    input_routes_.assign(ids.size(), {});
+    // The scheduler may still refer to combined metrics that are gone now
+    scheduler_.clear();
+    std::vector<CombinedMetricContainer*> scheduled;
+
+    for (auto& [combined_id, container] : combined_metrics_)
+    {
+        if (container.scheduled)
+        {
+            scheduled.push_back(&container);
+        }
+
+        container.outputs.clear();
+        for (const auto& [suffix, output_node] : container.metric.outputs())
+        {
+            auto output_name = container.name() + suffix;
+            auto output_id = ids.intern(output_name);
+            container.outputs.push_back({ output_id, output_node,
+                                          &get_combined_metric(output_name),
+                                          &output_chunks_[output_id],
+                                          spill_ ? spill_->metric_id(output_name) : 0 });
+        }
+
+        for (auto& [input_id, nodes] : container.inputs)
+        {
+            input_routes_[input_id].push_back({ &container, &nodes });
         }
+    }
+
+    // Nodes of changed combined metrics are gone, so start over
+    if (Profiler::global().enabled())
+    {
+        auto& profiler = Profiler::global();
+        profiler.clear();
+        for (const auto& [combined_id, container] : combined_metrics_)
+        {
+            profiler.add(combined_id, container.metric.collect_nodes());
+        }
+    }
+
+    std::sort(scheduled.begin(), scheduled.end(), [](const auto* a, const auto* b) {
+        return a->scheduled_since < b->scheduled_since;
+    });
+    for (auto* container : scheduled)
+    {
+        scheduler_.schedule(*container, container->priority, container->scheduled_since);
+    }
+}
+
+bool Combinator::request_pattern_matches()
+{
+    std::vector<std::string> selectors;
+    for (const auto& [combined_name, combined_config] : config_.at("metrics").items())
+    {
+        InputPatterns::collect_selectors(combined_config.at("expression"), selectors);
+    }
+    if (selectors.empty())
+    {
+        return false;
+    }
+
+    // Ask the manager once for all metrics that match any of the patterns
+    std::string selector;
+    for (const auto& pattern : selectors)
+    {
+        selector += (selector.empty() ? "(" : "|(") + pattern + ")";
+    }
+    rpc("get_metrics", [this](const metricq::json& response) { on_pattern_matches(response); },
+        { { "format", "array" }, { "selector", selector } });
+    return true;
+}
 
-        // Optionally declare metadata for this combined metric, which are
-        // sourced from combined_config["metadata"], if the key exists
-        if (auto metadata_it = combined_config.find("metadata");
-            metadata_it != combined_config.end())
+void Combinator::on_pattern_matches(const metricq::json& response)
+{
+    std::set<std::string> matches;
+    for (const auto& metric : response.at("metrics"))
+    {
+        // Depending on the format, metrics are either names or objects with their metadata
+        matches.insert(metric.is_string() ? metric.get<std::string>() :
+                                            metric.at("id").get<std::string>());
+    }
+
+    if (matches != pattern_matches_)
+    {
+        Log::info() << "Input patterns now match " << matches.size() << " metric(s), was "
+                    << pattern_matches_.size();
+        pattern_matches_ = std::move(matches);
+
+        auto previous_inputs = input_metrics;
+        apply_config();
+
+        std::vector<std::string> new_inputs;
+        for (const auto& input : input_metrics)
         {
-            auto& metadata = *metadata_it;
-            if (metadata.is_object())
+            if (!previous_inputs.count(input))
             {
-                Log::debug() << "Declaring metadata for metric " << combined_name << ": "
-                             << metricq::truncate_string(metadata.dump(), 100);
-                metric.metadata.json(metadata);
+                new_inputs.push_back(input);
             }
-            else
+        }
+        if (!new_inputs.empty())
+        {
+            subscribe(new_inputs);
+        }
+
+        std::vector<std::string> removed_inputs;
+        for (const auto& input : previous_inputs)
+        {
+            if (!input_metrics.count(input))
             {
-                Log::warn() << "Metadata for combined metric " << combined_name
-                            << " are not an object, ignoring.";
+                removed_inputs.push_back(input);
             }
         }
+        if (!removed_inputs.empty())
+        {
+            unsubscribe(removed_inputs);
+        }
+        declare_metrics();
     }
 
-    this->combined_metrics_.swap(updated_combined_metrics);
+    restored_snapshot_.reset();
+}
+
+void Combinator::declare_combined_metric(const std::string& combined_name,
+                                         const metricq::json& combined_config)
+{
+    // Register the combined metric as a new source metric
+    auto& metric = (*this)[combined_name];
+    auto& chunk = output_chunks_[MetricIds::global().intern(combined_name)];
+    chunk.chunk_size = 0;
+
+    if (combined_config.count("chunk_size"))
+    {
+        auto chunk_size = combined_config["chunk_size"].get<int>();
+        if (chunk_size > 0)
+        {
+            metric.chunk_size(chunk_size);
+            chunk.chunk_size = chunk_size;
+            Log::debug() << fmt::format("Using chunk_size ({}) for metric '{}'.", chunk_size,
+                                        combined_name);
+        }
+        else
+        {
+            Log::warn() << fmt::format(
+                "The given chunk_size ({}) for the metric '{}' is invalid. Ignoring.",
+                chunk_size, combined_name);
+        }
+    }
+
+    // Optionally declare metadata for this combined metric, which are
+    // sourced from combined_config["metadata"], if the key exists
+    if (auto metadata_it = combined_config.find("metadata"); metadata_it != combined_config.end())
+    {
+        auto& metadata = *metadata_it;
+        if (metadata.is_object())
+        {
+            Log::debug() << "Declaring metadata for metric " << combined_name << ": "
+                         << metricq::truncate_string(metadata.dump(), 100);
+            metric.metadata.json(metadata);
+        }
+        else
+        {
+            Log::warn() << "Metadata for combined metric " << combined_name
+                        << " are not an object, ignoring.";
+        }
+    }
+}
+
+void Combinator::restore_from_snapshot(MetricId combined_id,
+                                       const metricq::json& combined_expression,
+                                       CombinedMetricById& combined_metrics)
+{
+    if (!restored_snapshot_)
+    {
+        return;
+    }
+
+    auto& container = combined_metrics.at(combined_id);
+    const auto& combined_name = container.name();
+    auto reader = restored_snapshot_->find(combined_name, container.fingerprint());
+    if (!reader)
+    {
+        return;
+    }
+
+    try
+    {
+        container.metric.restore_state(*reader);
+        Log::info() << "Restored state of combined metric '" << combined_name
+                    << "' from snapshot";
+    }
+    catch (const SnapshotError& e)
+    {
+        Log::warn() << "Failed to restore state of combined metric '" << combined_name
+                    << "' from snapshot: " << e.what();
+        // Start over with a clean state instead of a partially restored one
+        combined_metrics.erase(combined_id);
+        combined_metrics.emplace(combined_id,
+                                 CombinedMetricContainer::from_config(combined_id,
+                                                                      combined_expression));
+    }
+}
+
+void Combinator::write_snapshot()
+{
+    if (settings_.snapshot_path.empty())
+    {
+        return;
+    }
+
+    std::vector<Snapshot::Entry> entries;
+    entries.reserve(combined_metrics_.size());
+    for (const auto& [combined_id, metric_container] : combined_metrics_)
+    {
+        SnapshotWriter writer;
+        metric_container.metric.save_state(writer);
+        entries.push_back(
+            { metric_container.name(), metric_container.fingerprint(), writer.buffer() });
+    }
+
+    try
+    {
+        Snapshot::write(settings_.snapshot_path, entries);
+        Log::debug() << "Wrote snapshot of " << entries.size() << " combined metric(s) to "
+                     << settings_.snapshot_path;
+    }
+    catch (const std::exception& e)
+    {
+        Log::error() << "Failed to write snapshot: " << e.what();
+    }
 }
 
 void Combinator::on_transformer_ready()
 {
+    if (settings_.dry_run)
+    {
+        plan();
+        close();
+        return;
+    }
+
     // At this point, the metadata of all direct input metrics is available in this->metadata_
     // so we can calculate the rate of the combined metrics.
     // However, the metedata of input metrics that are combined from the same config may not yet be
     // available, so we need to be able to defer these metrics.
     bool missing_inputs = false;
 
-    std::queue<const CombinedMetricByName::value_type*> resolver_queue;
+    auto& ids = MetricIds::global();
+    std::queue<const CombinedMetricContainer*> resolver_queue;
 
-    for (const auto& elem : combined_metrics_)
+    for (const auto& [combined_id, metric_container] : combined_metrics_)
     {
         // Delete metadata from manager for metrics that we are responsible for instead
-        metadata_.erase(elem.first);
-        resolver_queue.emplace(&elem);
+        for (const auto& output : metric_container.outputs)
+        {
+            metadata_.erase(ids.name(output.id));
+        }
+        resolver_queue.emplace(&metric_container);
     }
 
     std::size_t max_deferrals = (resolver_queue.size() - 2) * (resolver_queue.size() - 1) / 2;
     while (!resolver_queue.empty())
     {
         auto current_queue_element = resolver_queue.front();
-        auto& [combined_name, metric_container] = *current_queue_element;
+        const auto& metric_container = *current_queue_element;
+        const auto& combined_name = metric_container.name();
         resolver_queue.pop();
 
-        auto& metric = get_combined_metric(combined_name);
+        // All outputs of a combined metric share its metadata, so only look at the first one
+        const auto& outputs = metric_container.outputs;
+        auto& metric = *outputs.front().metric;
 
         // do not overwrite if rate was already set in the config
         if (std::isnan(metric.metadata.rate()))
         {
             auto rate = 0.;
 
-            for (auto& [input_metric, input_nodes] : metric_container.inputs)
+            for (auto& [input_id, input_nodes] : metric_container.inputs)
             {
+                const auto& input_metric = ids.name(input_id);
                 // if rate was not set, this returns NaN, which will propagate through
                 try
                 {
@@ -173,7 +623,15 @@ void Combinator::on_transformer_ready()
                 }
                 catch (const std::out_of_range&)
                 {
-                    if (combined_metrics_.count(input_metric))
+                    if (pattern_matches_.count(input_metric))
+                    {
+                        // Subscribed to after the other inputs, when its pattern matched
+                        Log::debug() << "No metadata yet for input " << input_metric
+                                     << " of combined metric " << combined_name;
+                        continue;
+                    }
+
+                    if (is_combined_output(input_id))
                     {
                         Log::info() << "deferring resolving of indirectly combined metric "
                                     << combined_name << " due to yet missing " << input_metric;
@@ -200,7 +658,15 @@ void Combinator::on_transformer_ready()
                 metric.metadata.rate(rate);
             }
         }
-        metadata_[combined_name] = metric.metadata;
+        for (const auto& handle : outputs)
+        {
+            auto& output = *handle.metric;
+            if (!std::isnan(metric.metadata.rate()))
+            {
+                output.metadata.rate(metric.metadata.rate());
+            }
+            metadata_[ids.name(handle.id)] = output.metadata;
+        }
         // It was PHILIPP!!!
     continue_main_loop:;
     }
@@ -211,47 +677,398 @@ void Combinator::on_transformer_ready()
         throw std::runtime_error("missing inputs");
     }
 
+    // Metrics matching input patterns may come and go, so look for them again from time to time
+    if (settings_.pattern_refresh_interval > metricq::Duration::zero() &&
+        !pattern_timer_.running())
+    {
+        pattern_timer_.start(
+            [this](auto) {
+                request_pattern_matches();
+                return metricq::Timer::TimerResult::repeat;
+            },
+            settings_.pattern_refresh_interval);
+    }
+
+    if (!settings_.snapshot_path.empty() &&
+        settings_.snapshot_interval > metricq::Duration::zero() && !snapshot_timer_.running())
+    {
+        snapshot_timer_.start(
+            [this](auto) {
+                write_snapshot();
+                return metricq::Timer::TimerResult::repeat;
+            },
+            settings_.snapshot_interval);
+    }
+
+    // Values that were spilled while sending stalled are otherwise only drained on new input
+    if (spill_ && !spill_timer_.running())
+    {
+        spill_timer_.start(
+            [this](auto) {
+                drain_spilled_values();
+                return metricq::Timer::TimerResult::repeat;
+            },
+            std::chrono::seconds(1));
+    }
+
+    if (Profiler::global().enabled() &&
+        settings_.profile_report_interval > metricq::Duration::zero() && !profile_timer_.running())
+    {
+        profile_timer_.start(
+            [this](auto) {
+                report_profile();
+                return metricq::Timer::TimerResult::repeat;
+            },
+            settings_.profile_report_interval);
+    }
+
     Log::info() << "Combinator ready.";
 }
 
-void Combinator::on_data(const std::string& input_metric, const metricq::DataChunk& data)
+void Combinator::plan()
 {
-    Log::trace() << fmt::format("Got data from input metric {}", input_metric);
+    std::unordered_map<std::string, double> rates;
+    for (const auto& [name, metadata] : metadata_)
+    {
+        rates.emplace(name, metadata.rate());
+    }
 
-    for (auto& [combined_name, metric_container] : combined_metrics_)
+    std::vector<std::pair<std::string, metricq::json>> metrics;
+    for (const auto& [combined_id, metric_container] : combined_metrics_)
     {
-        auto& [combined_metric, inputs_by_name, _config] = metric_container;
+        metrics.emplace_back(metric_container.name(), metric_container.expression());
+    }
+    std::sort(metrics.begin(), metrics.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
 
-        Log::trace() << fmt::format("Checking whether combined metric {} depends on {}...",
-                                    combined_name, input_metric);
+    CostModel model(std::move(rates));
+    auto estimates = model.estimate(metrics);
+    CostModel::print(std::cout, estimates, settings_.dry_run_limits);
 
-        auto inputs = inputs_by_name.find(input_metric);
-        if (inputs == inputs_by_name.end())
+    auto exceeding = std::count_if(estimates.begin(), estimates.end(), [this](const auto& e) {
+        return CostModel::exceeds(e, settings_.dry_run_limits);
+    });
+    auto unknown = std::count_if(estimates.begin(), estimates.end(),
+                                 [](const auto& e) { return std::isnan(e.memory); });
+    dry_run_passed_ = exceeding == 0;
+    Log::info() << "Dry run of " << estimates.size() << " combined metric(s): " << exceeding
+                << " exceed the limits, " << unknown
+                << " have an unknown cost as the rate of an input is unknown";
+}
+
+bool Combinator::MetricSink::output_ready() const
+{
+    return combinator.data_channel_ && combinator.data_channel_->usable();
+}
+
+void Combinator::MetricSink::output(const std::string& metric, metricq::TimeValue tv)
+{
+    combinator.get_combined_metric(metric).send(tv);
+}
+
+void Combinator::drain_spilled_values()
+{
+    auto pending_before = spill_->pending_bytes();
+    spill_->drain();
+    auto pending_after = spill_->pending_bytes();
+
+    if (spill_metrics_)
+    {
+        // Through the spill buffer like all output values, so they are sent once sending resumes
+        auto now = metricq::Clock::now();
+        spill_->send(spill_metrics_->pending_bytes,
+                     { now, static_cast<metricq::Value>(pending_after) });
+        spill_->send(spill_metrics_->spilled_bytes,
+                     { now, static_cast<metricq::Value>(spill_->spilled_bytes()) });
+    }
+
+    bool spilling = pending_after > 0;
+    if (spilling != spilling_)
+    {
+        spilling_ = spilling;
+        if (spilling)
         {
-            Log::trace() << "└── No, it does not.";
-            continue;
+            Log::info() << fmt::format("Buffering output values, {} bytes pending", pending_after);
+        }
+        else
+        {
+            Log::info() << fmt::format("Sent all buffered output values, {} bytes spilled to "
+                                       "disk in total",
+                                       spill_->spilled_bytes());
+        }
+    }
+    else if (spilling)
+    {
+        Log::debug() << fmt::format("Spill buffer: {} bytes pending ({} before draining), {} "
+                                    "bytes spilled to disk in total",
+                                    pending_after, pending_before, spill_->spilled_bytes());
+    }
+}
+
+void Combinator::wait_for_trace_signal()
+{
+    trace_signals_.async_wait([this](auto error, auto) {
+        if (error)
+        {
+            return;
+        }
+
+        try
+        {
+            Tracer::global().dump(settings_.trace_path);
+            Log::info() << "Dumped " << Tracer::global().size() << " trace events to "
+                        << settings_.trace_path;
+        }
+        catch (const TraceError& e)
+        {
+            Log::error() << "Failed to dump trace: " << e.what();
+        }
+        wait_for_trace_signal();
+    });
+}
+
+void Combinator::report_profile()
+{
+    std::ostringstream report;
+    Profiler::global().report(report, settings_.profile_top);
+    Log::info() << "Profile of combined metrics: " << report.str();
+}
+
+void Combinator::wait_for_profile_signal()
+{
+    profile_signals_.async_wait([this](auto error, auto) {
+        if (error)
+        {
+            return;
+        }
+
+        report_profile();
+        wait_for_profile_signal();
+    });
+}
+
+void Combinator::on_data(const std::string& input_metric, const metricq::DataChunk& data)
+{
+    if (spill_)
+    {
+        spill_->drain();
+    }
+
+    // The only lookup by name, everything else is resolved when the config is applied
+    auto input_id = MetricIds::global().find(input_metric);
+    if (!input_id || *input_id >= input_routes_.size())
+    {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    bool profiling = Profiler::global().enabled();
+    for (const auto& [container, input_nodes] : input_routes_[*input_id])
+    {
+        if (container->shed)
+        {
+            if (now < container->disabled_until)
+            {
+                shed_counts_.dropped_values += data.value_size() * input_nodes->size();
+                continue;
+            }
+            Log::info() << "Re-enabling combined metric " << container->name();
+            container->shed = false;
         }
 
-        Log::trace() << "└── Yes, it does.";
-        auto& input_list = inputs->second;
-        for (MetricInputNode* input_node : input_list)
+        Tracer::Scope trace(container->id, TraceEventKind::input);
+        for (MetricInputNode* input_node : *input_nodes)
         {
+            metricq::TimePoint last_time;
             for (metricq::TimeValue tv : data)
             {
                 input_node->put(tv);
+                last_time = tv.time;
+            }
+            if (Tracer::active())
+            {
+                Tracer::global().record(TraceEventKind::input, input_node, last_time,
+                                        data.value_size(), input_node->queue_length());
             }
-            Log::trace() << fmt::format("└── Put data into queue ({:p}), now has length {}",
-                                        (void*)input_node, input_node->queue_length());
         }
+        if (profiling)
+        {
+            Profiler::global().count(container->id, data.value_size() * input_nodes->size(), 0);
+        }
+
+        if (!container->scheduled)
+        {
+            container->scheduled = true;
+            container->scheduled_since = now;
+            scheduler_.schedule(*container, container->priority, now);
+        }
+    }
+
+    post_updates();
+}
 
-        combined_metric.update();
+void Combinator::post_updates()
+{
+    if (updates_posted_)
+    {
+        return;
+    }
+    updates_posted_ = true;
+    asio::post(io_service, [this]() { run_updates(); });
+}
+
+void Combinator::run_updates()
+{
+    updates_posted_ = false;
+    bool remaining = scheduler_.run(
+        [this](CombinedMetricContainer& container) { update_combined_metric(container); },
+        [this](CombinedMetricContainer& container, auto age) { shed_load(container, age); });
+    if (remaining)
+    {
+        post_updates();
+    }
+}
+
+void Combinator::update_combined_metric(CombinedMetricContainer& container)
+{
+    Tracer::Scope trace(container.id, TraceEventKind::update);
+    Profiler::Scope profile(container.id);
+    container.scheduled = false;
+    container.metric.update();
 
-        auto& metricq_metric = get_combined_metric(combined_name);
-        InputNode& input = combined_metric.input();
-        while (input.has_input())
+    std::uint32_t sent = 0;
+    metricq::TimePoint last_time;
+    for (const auto& output : container.outputs)
+    {
+        OutputWriter writer(*this, output);
+        auto drained = output.node->drain(writer);
+        if (drained == 0)
+        {
+            continue;
+        }
+        sent += drained;
+        last_time = writer.last_time;
+
+        if (!spill_ && !output_ && output.chunk->chunk_size == 0)
         {
-            metricq_metric.send(input.peek());
-            input.discard();
+            send_chunk(output.id, *output.chunk);
         }
     }
+
+    if (Profiler::global().enabled())
+    {
+        Profiler::global().count(container.id, 0, sent);
+    }
+
+    if (Tracer::active())
+    {
+        auto waited = std::chrono::steady_clock::now() - container.scheduled_since;
+        Tracer::global().record(
+            TraceEventKind::update, &container.metric, last_time, sent,
+            std::chrono::duration_cast<std::chrono::microseconds>(waited).count());
+    }
+}
+
+void Combinator::OutputWriter::consume(const metricq::TimeValue* values, std::size_t count)
+{
+    last_time = values[count - 1].time;
+    if (combinator.spill_)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            combinator.spill_->send(output.spill_id, values[i]);
+        }
+    }
+    else if (combinator.output_)
+    {
+        const auto& name = MetricIds::global().name(output.id);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            combinator.output_->output(name, values[i]);
+        }
+    }
+    else
+    {
+        auto& chunk = *output.chunk;
+        if (chunk.chunk_size == 0)
+        {
+            combinator.encode(chunk, values, count);
+            return;
+        }
+
+        // Split into chunks of exactly chunk_size values, like metricq::Metric does
+        while (count > 0)
+        {
+            auto space = chunk.chunk_size - static_cast<std::size_t>(chunk.data.value_size());
+            auto n = std::min(count, space);
+            combinator.encode(chunk, values, n);
+            values += n;
+            count -= n;
+            if (n == space)
+            {
+                combinator.send_chunk(output.id, chunk);
+            }
+        }
+    }
+}
+
+void Combinator::encode(OutputChunk& chunk, const metricq::TimeValue* values, std::size_t count)
+{
+    auto* time_deltas = chunk.data.mutable_time_delta();
+    auto* data_values = chunk.data.mutable_value();
+    time_deltas->Reserve(time_deltas->size() + static_cast<int>(count));
+    data_values->Reserve(data_values->size() + static_cast<int>(count));
+
+    auto previous = chunk.previous_time;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        auto time = values[i].time.time_since_epoch().count();
+        time_deltas->Add(time - previous);
+        data_values->Add(values[i].value);
+        previous = time;
+    }
+    chunk.previous_time = previous;
+}
+
+void Combinator::send_chunk(MetricId id, OutputChunk& chunk)
+{
+    if (chunk.data.value_size() == 0)
+    {
+        return;
+    }
+    send(MetricIds::global().name(id), chunk.data);
+    // Clearing keeps the capacity, so the next chunk is encoded without allocating
+    chunk.data.clear_time_delta();
+    chunk.data.clear_value();
+    chunk.previous_time = 0;
+}
+
+void Combinator::shed_load(CombinedMetricContainer& container,
+                           std::chrono::steady_clock::duration age)
+{
+    container.scheduled = false;
+    container.shed = true;
+    container.disabled_until = std::chrono::steady_clock::now() + settings_.shed_disable_duration;
+
+    std::size_t dropped = 0;
+    for (auto& [input_id, input_nodes] : container.inputs)
+    {
+        for (auto* input_node : input_nodes)
+        {
+            while (input_node->has_input())
+            {
+                input_node->discard();
+                dropped++;
+            }
+        }
+    }
+    shed_counts_.disabled_metrics++;
+    shed_counts_.dropped_values += dropped;
+
+    using seconds = std::chrono::duration<double>;
+    Log::warn() << fmt::format(
+        "Overloaded: disabling low priority combined metric {} for {:.0f}s, dropped {} input "
+        "value(s) that waited for {:.1f}s (so far disabled {} time(s), dropped {} value(s))",
+        container.name(), seconds(settings_.shed_disable_duration).count(), dropped,
+        seconds(age).count(), shed_counts_.disabled_metrics, shed_counts_.dropped_values);
 }
@@ -20,21 +20,98 @@
 #pragma once
 
 #include "combined_metric.hpp"
+#include "cost_model.hpp"
 #include "input_node.hpp"
+#include "metric_id.hpp"
+#include "snapshot.hpp"
+#include "spill_buffer.hpp"
+#include "update_scheduler.hpp"
 
 #include <asio/signal_set.hpp>
+#include <metricq/timer.hpp>
 #include <metricq/transformer.hpp>
 
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct CombinatorSettings
+{
+    // Where to save node state for warm restarts, disabled if empty
+    std::string snapshot_path;
+    metricq::Duration snapshot_interval = metricq::Duration::zero();
+
+    // Where to spill output values that cannot be sent right away, disabled if empty
+    std::string spill_directory;
+    std::size_t spill_memory_limit = 64 * 1024 * 1024;
+    // Publish the size of the spill buffer as <prefix>.pending_bytes and <prefix>.spilled_bytes
+    std::string spill_metrics_prefix;
+
+    // How often to look for new metrics matching input patterns, never if zero
+    metricq::Duration pattern_refresh_interval = std::chrono::minutes(5);
+
+    // Threads used to update independent subtrees of large expressions in parallel
+    std::size_t update_threads = 1;
+
+    // Only take over the combined metrics of this shard out of shard_count
+    std::size_t shard_index = 0;
+    std::size_t shard_count = 1;
+
+    // How long to keep updating combined metrics before accepting new input again
+    metricq::Duration update_budget = std::chrono::milliseconds(50);
+    // Low priority combined metrics whose input waited for longer are disabled for a while
+    metricq::Duration shed_age = std::chrono::seconds(10);
+    metricq::Duration shed_disable_duration = std::chrono::minutes(1);
+
+    // Trace the evaluation of these combined metrics, see Tracer, and dump it on SIGUSR2
+    std::vector<std::string> trace_metrics;
+    std::uint32_t trace_sample_interval = 1;
+    std::size_t trace_buffer_size = 65536;
+    std::string trace_path = "metricq-combinator.trace";
+
+    // Attribute CPU time to the nodes of combined metrics, see Profiler, and report the most
+    // expensive ones on SIGUSR1 and every profile_report_interval, if not zero
+    std::uint32_t profile_sample_interval = 0;
+    metricq::Duration profile_report_interval = metricq::Duration::zero();
+    std::size_t profile_top = 20;
+
+    // Only print the estimated cost of the configuration, see CostModel, instead of running it
+    bool dry_run = false;
+    CostModel::Limits dry_run_limits;
+};
+
 class Combinator : public metricq::Transformer
 {
 private:
     using MetricName = std::string;
 
 public:
-    Combinator(const std::string& manager_host, const std::string& token);
+    Combinator(const std::string& manager_host, const std::string& token,
+               const CombinatorSettings& settings = {});
+    // Evaluate without connecting to MetricQ, passing all output values to output instead
+    Combinator(const CombinatorSettings& settings, OutputSink& output);
     ~Combinator();
 
+    // Write the state of all combined metrics to the snapshot file, if one is configured.
+    void write_snapshot();
+
+    // Whether no combined metric exceeded the limits of a dry run
+    bool dry_run_passed() const
+    {
+        return dry_run_passed_;
+    }
+
 private:
+    // Stands in for the manager and the broker, see tests/load_test.cpp
+    friend class LoadTest;
+
+    Combinator(const std::string& token, const CombinatorSettings& settings, OutputSink* output);
+
     void on_transformer_config(const metricq::json& config) override;
     void on_transformer_ready() override;
     void on_data(const std::string& metric_name, const metricq::DataChunk&) override;
@@ -44,19 +121,87 @@ private:
         return (*this)[combined_name];
     }
 
+    void apply_config();
+
+    // Ask the manager for metrics matching the input patterns, returns false if there are none
+    bool request_pattern_matches();
+    void on_pattern_matches(const metricq::json& response);
+
+    void declare_combined_metric(const std::string& combined_name,
+                                 const metricq::json& combined_config);
+
+    void drain_spilled_values();
+
+    // Print the estimated cost of all combined metrics, using the rates of their inputs
+    void plan();
+
+    // Dump the trace on every SIGUSR2
+    void wait_for_trace_signal();
+
+    // Log the most expensive combined metrics, on every SIGUSR1
+    void report_profile();
+    void wait_for_profile_signal();
+
+    // Update the scheduled combined metrics soon, but after input that is already waiting
+    void post_updates();
+    void run_updates();
+
 private:
+    // Values of one output, delta-encoded for the broker until the chunk is complete
+    struct OutputChunk
+    {
+        metricq::DataChunk data;
+        std::int64_t previous_time = 0;
+        // Send once that many values are encoded, or after every update if zero
+        std::size_t chunk_size = 0;
+    };
+
+    // Where the values of one output of a combined metric go, resolved once at config time
+    struct OutputHandle
+    {
+        MetricId id;
+        InputNode* node;
+        metricq::Metric<metricq::Transformer>* metric;
+        OutputChunk* chunk;
+        std::uint32_t spill_id;
+    };
+
+    // Hands the values drained from an output node on, one contiguous run at a time
+    struct OutputWriter : SpanConsumer
+    {
+        OutputWriter(Combinator& combinator, const OutputHandle& output)
+        : combinator(combinator), output(output)
+        {
+        }
+
+        void consume(const metricq::TimeValue* values, std::size_t count) override;
+
+        Combinator& combinator;
+        const OutputHandle& output;
+        metricq::TimePoint last_time;
+    };
+
+    void encode(OutputChunk& chunk, const metricq::TimeValue* values, std::size_t count);
+    void send_chunk(MetricId id, OutputChunk& chunk);
+
     struct CombinedMetricContainer
     {
     private:
-        CombinedMetricContainer(const metricq::json& config)
-        : metric(config), inputs(metric.collect_metric_inputs()), expression_(config)
+        CombinedMetricContainer(MetricId id, const metricq::json& config)
+        : id(id), metric(config), inputs(metric.collect_metric_inputs()), expression_(config),
+          fingerprint_(Snapshot::fingerprint(config))
         {
         }
 
     public:
-        static CombinedMetricContainer from_config(const metricq::json& config)
+        static CombinedMetricContainer from_config(MetricId id, const metricq::json& config)
         {
-            return CombinedMetricContainer(config);
+            return CombinedMetricContainer(id, config);
+        }
+
+        const std::string& name() const
+        {
+            return MetricIds::global().name(id);
         }
 
         const metricq::json& expression() const
@@ -64,13 +209,109 @@ private:
             return expression_;
         }
 
+        std::uint64_t fingerprint() const
+        {
+            return fingerprint_;
+        }
+
+        MetricId id;
         CombinedMetric metric;
-        MetricInputNodesByName inputs;
+        MetricInputNodes inputs;
+        std::vector<OutputHandle> outputs;
         metricq::json expression_;
+        std::uint64_t fingerprint_;
+
+        Priority priority = Priority::normal;
+        // Whether there is input waiting for an update, and since when
+        bool scheduled = false;
+        std::chrono::steady_clock::time_point scheduled_since;
+        // Input is dropped until then after load was shed
+        bool shed = false;
+        std::chrono::steady_clock::time_point disabled_until;
     };
 
-    using CombinedMetricByName = std::unordered_map<MetricName, CombinedMetricContainer>;
+    using CombinedMetricById = std::unordered_map<MetricId, CombinedMetricContainer>;
+
+    void restore_from_snapshot(MetricId combined_id, const metricq::json& combined_expression,
+                               CombinedMetricById& combined_metrics);
+
+    // Resolve output handles and rebuild input_routes_ for the current combined metrics
+    void build_routes();
+
+    void update_combined_metric(CombinedMetricContainer& container);
+    void shed_load(CombinedMetricContainer& container, std::chrono::steady_clock::duration age);
+
+    bool is_combined_output(MetricId id) const
+    {
+        return id < combined_outputs_.size() && combined_outputs_[id];
+    }
 
     asio::signal_set signals_;
-    CombinedMetricByName combined_metrics_;
+    asio::signal_set trace_signals_;
+    asio::signal_set profile_signals_;
+    metricq::json config_;
+    CombinedMetricById combined_metrics_;
+    // Marks all metrics produced by combined metrics, including each output of aggregates
+    std::vector<bool> combined_outputs_;
+
+    // The input nodes of one combined metric that consume a given input metric
+    struct InputRoute
+    {
+        CombinedMetricContainer* container;
+        std::vector<MetricInputNode*>* nodes;
+    };
+    // Indexed by the ID of the input metric, so incoming data needs a single name lookup
+    std::vector<std::vector<InputRoute>> input_routes_;
+
+    CombinatorSettings settings_;
+    std::optional<Snapshot> restored_snapshot_;
+    metricq::Timer snapshot_timer_;
+    metricq::Timer profile_timer_;
+
+    // Sends values to the broker, as long as its data channel is usable
+    struct MetricSink : OutputSink
+    {
+        MetricSink(Combinator& combinator) : combinator(combinator)
+        {
+        }
+
+        bool output_ready() const override;
+        void output(const std::string& metric, metricq::TimeValue tv) override;
+
+        Combinator& combinator;
+    };
+
+    MetricSink sink_;
+    // Replaces sending to MetricQ when running without a connection
+    OutputSink* output_;
+    // By output metric, the map keeps their addresses stable for OutputHandle
+    std::unordered_map<MetricId, OutputChunk> output_chunks_;
+    std::unique_ptr<SpillBuffer> spill_;
+    metricq::Timer spill_timer_;
+    // Whether values were pending at the last drain, only changes are logged
+    bool spilling_ = false;
+    // Spill buffer IDs of the metrics about the spill buffer itself, if published
+    struct SpillMetrics
+    {
+        std::uint32_t pending_bytes;
+        std::uint32_t spilled_bytes;
+    };
+    std::optional<SpillMetrics> spill_metrics_;
+
+    // All metrics known to match any of the input patterns
+    std::set<MetricName> pattern_matches_;
+    metricq::Timer pattern_timer_;
+
+    UpdateScheduler<CombinedMetricContainer> scheduler_;
+    bool updates_posted_ = false;
+
+    // Load shed since startup, for the log
+    struct ShedCounts
+    {
+        std::uint64_t disabled_metrics = 0;
+        std::uint64_t dropped_values = 0;
+    };
+    ShedCounts shed_counts_;
+
+    bool dry_run_passed_ = true;
 };
@@ -19,13 +19,26 @@
 // along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
 #include "combined_metric.hpp"
 #include "binary_node.hpp"
+#include "deadband_node.hpp"
 #include "input_node.hpp"
+#include "quantile_node.hpp"
+#include "snapshot.hpp"
 #include "throttle_node.hpp"
 #include "variadic_node.hpp"
 
 #include <metricq/json.hpp>
 
-std::unique_ptr<CalculationNode> CombinedMetric::parse_calc_node(const metricq::json& config)
+#include <algorithm>
+#include <limits>
+
+template <typename Operator>
+NodePtr<CalculationNode> CombinedMetric::parse_binary_node(const metricq::json& config)
+{
+    return make_binary_node<Operator>(*arena_, parse_input(config.at("left")),
+                                      parse_input(config.at("right")), parse_join_options(config));
+}
+
+NodePtr<CalculationNode> CombinedMetric::parse_calc_node(const metricq::json& config)
 {
     // TODO: Check that not all inputs are ConstantInput.
     // Otherwise the update algorithm will constantly try to update the
@@ -34,56 +47,224 @@ std::unique_ptr<CalculationNode> CombinedMetric::parse_calc_node(const metricq::
     std::string op = config.at("operation");
     if (op == "+")
     {
-        return std::make_unique<AddNode>(parse_input(config.at("left")),
-                                         parse_input(config.at("right")));
+        return parse_binary_node<AddOperator>(config);
     }
     else if (op == "-")
     {
-        return std::make_unique<SubtractNode>(parse_input(config.at("left")),
-                                              parse_input(config.at("right")));
+        return parse_binary_node<SubtractOperator>(config);
     }
     else if (op == "*")
     {
-        return std::make_unique<MultipyNode>(parse_input(config.at("left")),
-                                             parse_input(config.at("right")));
+        return parse_binary_node<MultiplyOperator>(config);
     }
     else if (op == "/")
     {
-        return std::make_unique<DivideNode>(parse_input(config.at("left")),
-                                            parse_input(config.at("right")));
+        return parse_binary_node<DivideOperator>(config);
+    }
+    else if (op == ">")
+    {
+        return parse_binary_node<GreaterOperator>(config);
+    }
+    else if (op == "<")
+    {
+        return parse_binary_node<LessOperator>(config);
+    }
+    else if (op == ">=")
+    {
+        return parse_binary_node<GreaterEqualOperator>(config);
+    }
+    else if (op == "<=")
+    {
+        return parse_binary_node<LessEqualOperator>(config);
+    }
+    else if (op == "==")
+    {
+        return parse_binary_node<EqualOperator>(config);
+    }
+    else if (op == "select")
+    {
+        return arena_->make<SelectNode>(parse_input(config.at("condition")),
+                                        parse_input(config.at("then")),
+                                        parse_input(config.at("else")),
+                                        parse_join_options(config));
+    }
+    else if (op == "clamp")
+    {
+        if (!config.count("min") && !config.count("max"))
+        {
+            throw CombinedMetric::ParseError("clamp needs at least one of \"min\" and \"max\"");
+        }
+        // A missing bound does not limit the input
+        auto bound = [this, &config](const char* key, double unbounded) -> NodePtr<InputNode> {
+            if (auto it = config.find(key); it != config.end())
+            {
+                return parse_input(*it);
+            }
+            return arena_->make<ConstantInput>(unbounded);
+        };
+        auto infinity = std::numeric_limits<double>::infinity();
+        return arena_->make<ClampNode>(parse_input(config.at("input")), bound("min", -infinity),
+                                       bound("max", infinity), parse_join_options(config));
     }
     else if (op == "min")
     {
-        return std::make_unique<MinNode>(parse_inputs(config.at("inputs")));
+        return arena_->make<MinNode>(parse_inputs(config.at("inputs")),
+                                     parse_join_options(config));
     }
     else if (op == "max")
     {
-        return std::make_unique<MaxNode>(parse_inputs(config.at("inputs")));
+        return arena_->make<MaxNode>(parse_inputs(config.at("inputs")),
+                                     parse_join_options(config));
     }
     else if (op == "sum")
     {
-        return std::make_unique<SumNode>(parse_inputs(config.at("inputs")));
+        return arena_->make<SumNode>(parse_inputs(config.at("inputs")),
+                                     parse_join_options(config));
+    }
+    else if (op == "median" || op == "quantile")
+    {
+        double quantile = 0.5;
+        if (op == "quantile")
+        {
+            quantile = config.at("quantile").get<double>();
+            if (!(quantile >= 0 && quantile <= 1))
+            {
+                throw CombinedMetric::ParseError("quantile {} is not within [0, 1]", quantile);
+            }
+        }
+
+        // Over time within each window of a single input, or across several inputs
+        if (auto it = config.find("window"); it != config.end())
+        {
+            auto window = metricq::duration_parse(it->get<std::string>());
+            if (window <= metricq::Duration::zero())
+            {
+                throw CombinedMetric::ParseError("window of {} must be positive", op);
+            }
+            return arena_->make<WindowedQuantileNode>(parse_input(config.at("input")),
+                                                      quantile, window);
+        }
+        return arena_->make<QuantileNode>(parse_inputs(config.at("inputs")), quantile,
+                                          parse_join_options(config));
+    }
+    else if (op == "aggregate")
+    {
+        throw CombinedMetric::ParseError(
+            "operation \"aggregate\" is only allowed at the top level of an expression");
     }
     else if (op == "throttle")
     {
         auto cooldown_period =
             metricq::duration_parse(config.at("cooldown_period").get<std::string>());
-        return std::make_unique<ThrottleNode>(parse_input(config.at("input")), cooldown_period);
+        return arena_->make<ThrottleNode>(parse_input(config.at("input")), cooldown_period);
+    }
+    else if (op == "deadband")
+    {
+        DeadbandNode::Thresholds thresholds;
+        thresholds.absolute = config.value("threshold", 0.0);
+        thresholds.relative = config.value("relative_threshold", 0.0);
+        if (thresholds.absolute < 0 || thresholds.relative < 0)
+        {
+            throw CombinedMetric::ParseError("thresholds of deadband must not be negative");
+        }
+        thresholds.max_silence = parse_max_silence(config);
+        return arena_->make<DeadbandNode>(parse_input(config.at("input")), thresholds);
+    }
+    else if (op == "swinging_door")
+    {
+        auto deviation = config.at("deviation").get<double>();
+        if (!(deviation >= 0))
+        {
+            throw CombinedMetric::ParseError("deviation of swinging_door must not be negative");
+        }
+        return arena_->make<SwingingDoorNode>(parse_input(config.at("input")), deviation,
+                                              parse_max_silence(config));
     }
     throw CombinedMetric::ParseError("unknown operation \"{}\"", op);
 }
 
-std::unique_ptr<InputNode> CombinedMetric::parse_input(const metricq::json& config)
+JoinOptions CombinedMetric::parse_join_options(const metricq::json& config)
+{
+    JoinOptions options;
+    if (auto it = config.find("hold"); it != config.end())
+    {
+        options.hold = metricq::duration_parse(it->get<std::string>());
+    }
+    if (auto it = config.find("tolerance"); it != config.end())
+    {
+        options.tolerance = metricq::duration_parse(it->get<std::string>());
+    }
+    return options;
+}
+
+std::optional<metricq::Duration> CombinedMetric::parse_max_silence(const metricq::json& config)
+{
+    if (auto it = config.find("max_silence"); it != config.end())
+    {
+        return metricq::duration_parse(it->get<std::string>());
+    }
+    return std::nullopt;
+}
+
+NodePtr<AggregateNode> CombinedMetric::parse_aggregate_node(const metricq::json& config)
+{
+    try
+    {
+        std::vector<AggregateNode::Aggregate> aggregates;
+        if (auto it = config.find("outputs"); it != config.end())
+        {
+            if (!it->is_array() || it->empty())
+            {
+                throw ParseError("outputs are not a non-empty array: {}", it->dump());
+            }
+            for (const auto& output : *it)
+            {
+                auto name = output.get<std::string>();
+                const auto& names = AggregateNode::aggregate_names();
+                auto known =
+                    std::find_if(names.begin(), names.end(),
+                                 [&name](const auto& entry) { return entry.first == name; });
+                if (known == names.end())
+                {
+                    throw ParseError("unknown aggregate \"{}\"", name);
+                }
+                // Each output is published as a metric of its own, which must be unique
+                if (std::find(aggregates.begin(), aggregates.end(), known->second) !=
+                    aggregates.end())
+                {
+                    throw ParseError("duplicate aggregate \"{}\"", name);
+                }
+                aggregates.push_back(known->second);
+            }
+        }
+        else
+        {
+            for (const auto& [name, aggregate] : AggregateNode::aggregate_names())
+            {
+                aggregates.push_back(aggregate);
+            }
+        }
+
+        return arena_->make<AggregateNode>(parse_inputs(config.at("inputs")),
+                                           std::move(aggregates), parse_join_options(config));
+    }
+    catch (const metricq::json::exception& e)
+    {
+        throw ParseError("failed to parse configuration: {}", e.what());
+    }
+}
+
+NodePtr<InputNode> CombinedMetric::parse_input(const metricq::json& config)
 {
     try
     {
         if (config.is_number())
         {
-            return std::make_unique<ConstantInput>(config.get<double>());
+            return arena_->make<ConstantInput>(config.get<double>());
         }
         else if (config.is_string())
         {
-            return std::make_unique<MetricInputNode>(config.get<std::string>());
+            return arena_->make<MetricInputNode>(config.get<std::string>());
         }
         else if (config.is_object())
         {
@@ -100,7 +281,7 @@ std::unique_ptr<InputNode> CombinedMetric::parse_input(const metricq::json& conf
     }
 }
 
-std::vector<std::unique_ptr<InputNode>> CombinedMetric::parse_inputs(const metricq::json& configs)
+std::vector<NodePtr<InputNode>> CombinedMetric::parse_inputs(const metricq::json& configs)
 {
     if (!configs.is_array())
     {
@@ -110,7 +291,7 @@ std::vector<std::unique_ptr<InputNode>> CombinedMetric::parse_inputs(const metri
     {
         throw ParseError("empty inputs array.");
     }
-    std::vector<std::unique_ptr<InputNode>> result;
+    std::vector<NodePtr<InputNode>> result;
     result.reserve(configs.size());
     for (const auto& config : configs)
     {
@@ -119,8 +300,38 @@ std::vector<std::unique_ptr<InputNode>> CombinedMetric::parse_inputs(const metri
     return result;
 }
 
-CombinedMetric::CombinedMetric(const metricq::json& config) : input_(parse_input(config))
+// A rough guess of the memory needed for the nodes of an expression, to make the arena of
+// small expressions a single allocation
+static std::size_t estimate_arena_size(const metricq::json& config)
+{
+    std::size_t size = 128;
+    if (config.is_structured())
+    {
+        for (const auto& value : config)
+        {
+            size += estimate_arena_size(value);
+        }
+    }
+    return size;
+}
+
+CombinedMetric::CombinedMetric(const metricq::json& config)
+: arena_(std::make_unique<NodeArena>(estimate_arena_size(config)))
 {
+    if (config.is_object() && config.value("operation", "") == "aggregate")
+    {
+        auto aggregate = parse_aggregate_node(config);
+        for (const auto& [name, node] : aggregate->outputs())
+        {
+            outputs_.emplace_back("." + name, node);
+        }
+        input_ = std::move(aggregate);
+    }
+    else
+    {
+        input_ = parse_input(config);
+        outputs_.emplace_back("", input_.get());
+    }
 }
 
 void CombinedMetric::update()
@@ -128,9 +339,37 @@ void CombinedMetric::update()
     input_->update();
 }
 
-MetricInputNodesByName CombinedMetric::collect_metric_inputs()
+MetricInputNodes CombinedMetric::collect_metric_inputs()
 {
-    MetricInputNodesByName inputs;
+    std::vector<MetricInputNode*> inputs;
     input_->collect_metric_inputs(inputs);
-    return inputs;
+    return MetricInputNodes(inputs);
+}
+
+std::vector<const InputNode*> CombinedMetric::collect_nodes() const
+{
+    std::vector<const InputNode*> nodes;
+    input_->collect_nodes(nodes);
+    for (const auto& [suffix, output] : outputs_)
+    {
+        if (output != input_.get())
+        {
+            nodes.push_back(output);
+        }
+    }
+    return nodes;
+}
+
+void CombinedMetric::save_state(SnapshotWriter& writer) const
+{
+    input_->save_state(writer);
+}
+
+void CombinedMetric::restore_state(SnapshotReader& reader)
+{
+    input_->restore_state(reader);
+    if (!reader.at_end())
+    {
+        throw SnapshotError("snapshot contains excess state");
+    }
 }
@@ -20,15 +20,22 @@
 #pragma once
 
 #include "input_node.hpp"
+#include "join_options.hpp"
+#include "node_arena.hpp"
 
 #include <metricq/json.hpp>
 #include <metricq/types.hpp>
 
 #include <fmt/format.h>
 
+#include <memory>
+#include <optional>
 #include <string>
+#include <utility>
 #include <vector>
 
+class AggregateNode;
+
 class CombinedMetric
 {
 public:
@@ -55,13 +62,39 @@ public:
         return *input_;
     }
 
-    MetricInputNodesByName collect_metric_inputs();
+    /*
+     * The metrics produced by this combined metric, as suffixes to its name with the node their
+     * values are taken from.  Only "aggregate" expressions have more than one output, all others
+     * have a single output with an empty suffix, i.e. input().
+     */
+    const std::vector<std::pair<std::string, InputNode*>>& outputs() const
+    {
+        return outputs_;
+    }
+
+    MetricInputNodes collect_metric_inputs();
+
+    // All nodes of the expression, depth-first with children before their parent, and the
+    // separate output queues of an aggregate last
+    std::vector<const InputNode*> collect_nodes() const;
+
+    void save_state(SnapshotWriter&) const;
+    void restore_state(SnapshotReader&);
 
 private:
-    static std::unique_ptr<InputNode> parse_input(const metricq::json&);
-    static std::vector<std::unique_ptr<InputNode>> parse_inputs(const metricq::json&);
-    static std::unique_ptr<CalculationNode> parse_calc_node(const metricq::json&);
+    // Nodes are created in arena_, see NodeArena for their layout
+    NodePtr<InputNode> parse_input(const metricq::json&);
+    std::vector<NodePtr<InputNode>> parse_inputs(const metricq::json&);
+    NodePtr<CalculationNode> parse_calc_node(const metricq::json&);
+    template <typename Operator>
+    NodePtr<CalculationNode> parse_binary_node(const metricq::json&);
+    NodePtr<AggregateNode> parse_aggregate_node(const metricq::json&);
+    static JoinOptions parse_join_options(const metricq::json&);
+    static std::optional<metricq::Duration> parse_max_silence(const metricq::json&);
 
 private:
-    std::unique_ptr<InputNode> input_;
+    // Declared first, so that it outlives all nodes in it
+    std::unique_ptr<NodeArena> arena_;
+    NodePtr<InputNode> input_;
+    std::vector<std::pair<std::string, InputNode*>> outputs_;
 };
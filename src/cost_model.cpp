@@ -0,0 +1,293 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#include "cost_model.hpp"
+#include "partition.hpp"
+
+#include <metricq/types.hpp>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <ostream>
+
+namespace
+{
+const double unknown = std::nan("");
+const double infinite = std::numeric_limits<double>::infinity();
+
+// Roughly what a node takes in the arena of its combined metric, see CombinedMetric
+constexpr double node_bytes = 128;
+// Values a KllSketch with the default k keeps at most
+constexpr double sketch_values = 600;
+
+double worst(double a, double b)
+{
+    return std::isnan(a) || std::isnan(b) ? unknown : std::max(a, b);
+}
+
+double seconds(const metricq::json& duration)
+{
+    using seconds = std::chrono::duration<double>;
+    return seconds(metricq::duration_parse(duration.get<std::string>())).count();
+}
+
+std::string format_bytes(double bytes)
+{
+    if (std::isnan(bytes))
+    {
+        return "unknown";
+    }
+    if (std::isinf(bytes))
+    {
+        return "unbounded";
+    }
+    const char* units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+    std::size_t unit = 0;
+    while (bytes >= 1024 && unit + 1 < std::size(units))
+    {
+        bytes /= 1024;
+        unit++;
+    }
+    return fmt::format("{:.1f} {}", bytes, units[unit]);
+}
+
+std::string format_number(double value)
+{
+    return std::isnan(value) ? "unknown" : fmt::format("{:.4g}", value);
+}
+} // namespace
+
+CostModel::CostModel(std::unordered_map<std::string, double> input_rates)
+: input_rates_(std::move(input_rates))
+{
+}
+
+std::vector<CostModel::Estimate>
+CostModel::estimate(const std::vector<std::pair<std::string, metricq::json>>& metrics)
+{
+    expressions_.clear();
+    producers_.clear();
+    estimates_.clear();
+    for (const auto& [name, expression] : metrics)
+    {
+        expressions_[name] = &expression;
+        for (const auto& output : Partition::describe(name, expression).outputs)
+        {
+            producers_[output] = name;
+        }
+    }
+
+    std::vector<Estimate> result;
+    for (const auto& [name, _] : metrics)
+    {
+        result.push_back(estimate(name));
+    }
+    // Unknown estimates last
+    auto key = [](const Estimate& estimate) {
+        return std::isnan(estimate.memory) ? -1.0 : estimate.memory;
+    };
+    std::stable_sort(result.begin(), result.end(),
+                     [&key](const auto& a, const auto& b) { return key(a) > key(b); });
+    return result;
+}
+
+const CostModel::Estimate& CostModel::estimate(const std::string& name)
+{
+    if (auto it = estimates_.find(name); it != estimates_.end())
+    {
+        return it->second;
+    }
+
+    in_progress_.insert(name);
+    auto result = flow(*expressions_.at(name));
+    in_progress_.erase(name);
+
+    Estimate estimate{
+        name,
+        result.constant ? 0 : result.rate,
+        result.queue_depth,
+        static_cast<double>(result.nodes) * node_bytes +
+            result.queued * sizeof(metricq::TimeValue),
+        result.updates,
+        result.input_rate > 0 ? result.updates / result.input_rate : 0,
+    };
+    return estimates_.emplace(name, estimate).first->second;
+}
+
+double CostModel::rate(const std::string& metric)
+{
+    if (auto it = producers_.find(metric); it != producers_.end())
+    {
+        // Circular dependencies never produce anything
+        return in_progress_.count(it->second) ? unknown : estimate(it->second).output_rate;
+    }
+    if (auto it = input_rates_.find(metric); it != input_rates_.end())
+    {
+        return it->second;
+    }
+    return unknown;
+}
+
+CostModel::Flow CostModel::flow(const metricq::json& expression)
+{
+    Flow result;
+    result.nodes = 1;
+    if (expression.is_string())
+    {
+        result.rate = rate(expression.get<std::string>());
+        result.input_rate = result.rate;
+        result.updates = result.rate;
+        return result;
+    }
+    if (!expression.is_object())
+    {
+        result.constant = true;
+        return result;
+    }
+
+    auto op = expression.value("operation", "");
+    if (expression.count("left"))
+    {
+        return join(expression, { flow(expression.at("left")), flow(expression.at("right")) });
+    }
+    if (op == "select")
+    {
+        return join(expression, { flow(expression.at("condition")), flow(expression.at("then")),
+                                  flow(expression.at("else")) });
+    }
+    if (op == "clamp")
+    {
+        // A missing bound is a constant
+        return join(expression, { flow(expression.at("input")),
+                                  flow(expression.value("min", metricq::json())),
+                                  flow(expression.value("max", metricq::json())) });
+    }
+    if (auto inputs = expression.find("inputs"); inputs != expression.end())
+    {
+        std::vector<Flow> flows;
+        for (const auto& input : *inputs)
+        {
+            flows.push_back(flow(input));
+        }
+        return join(expression, std::move(flows));
+    }
+
+    auto input = flow(expression.at("input"));
+    result = input;
+    result.nodes++;
+    if (input.constant)
+    {
+        return result;
+    }
+
+    if (auto window = expression.find("window"); window != expression.end())
+    {
+        // Quantiles over time, sketching the values of each window
+        auto length = seconds(*window);
+        result.rate = input.rate > 0 ? 1 / length : input.rate;
+        result.queued += std::min(input.rate * length, sketch_values);
+    }
+    else if (op == "throttle")
+    {
+        result.rate = std::min(input.rate, 1 / seconds(expression.at("cooldown_period")));
+    }
+    result.updates += input.rate + result.rate;
+    return result;
+}
+
+CostModel::Flow CostModel::join(const metricq::json& expression, std::vector<Flow> inputs)
+{
+    Flow result;
+    result.nodes = 1;
+    result.constant = true;
+    double slowest = infinite;
+    double fastest = 0;
+    double total = 0;
+    std::size_t joined = 0;
+    for (const auto& input : inputs)
+    {
+        result.nodes += input.nodes;
+        result.queued += input.queued;
+        result.updates += input.updates;
+        result.input_rate += input.input_rate;
+        result.queue_depth = worst(result.queue_depth, input.queue_depth);
+        if (!input.constant)
+        {
+            result.constant = false;
+            joined++;
+            slowest = std::min(slowest, input.rate);
+            fastest = std::max(fastest, input.rate);
+            total += input.rate;
+        }
+    }
+    if (result.constant)
+    {
+        return result;
+    }
+    if (std::isnan(total))
+    {
+        result.rate = unknown;
+        result.queue_depth = unknown;
+        result.queued = unknown;
+        result.updates = unknown;
+        return result;
+    }
+
+    result.rate = expression.contains("tolerance") ? fastest : total;
+    if (joined > 1 && !expression.contains("hold"))
+    {
+        // Faster inputs queue up while waiting for the next value of the slowest one
+        for (const auto& input : inputs)
+        {
+            if (!input.constant && input.rate > 0)
+            {
+                auto depth = slowest > 0 ? input.rate / slowest : infinite;
+                result.queue_depth = worst(result.queue_depth, depth);
+                result.queued += depth;
+            }
+        }
+    }
+    result.updates += total + result.rate;
+    return result;
+}
+
+bool CostModel::exceeds(const Estimate& estimate, const Limits& limits)
+{
+    return (limits.memory > 0 && estimate.memory > limits.memory) ||
+           (limits.queue_depth > 0 && estimate.queue_depth > limits.queue_depth);
+}
+
+void CostModel::print(std::ostream& out, const std::vector<Estimate>& estimates,
+                      const Limits& limits)
+{
+    out << fmt::format("{:>12} {:>12} {:>12} {:>12} {:>14}  {}\n", "memory", "queue depth",
+                       "output [Hz]", "updates/s", "updates/value", "combined metric");
+    for (const auto& estimate : estimates)
+    {
+        out << fmt::format("{:>12} {:>12} {:>12} {:>12} {:>14}  {}{}\n",
+                           format_bytes(estimate.memory), format_number(estimate.queue_depth),
+                           format_number(estimate.output_rate), format_number(estimate.updates),
+                           format_number(estimate.updates_per_value), estimate.name,
+                           exceeds(estimate, limits) ? "  (exceeds limits)" : "");
+    }
+}
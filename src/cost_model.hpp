@@ -0,0 +1,111 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <metricq/json.hpp>
+
+#include <cstddef>
+#include <iosfwd>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Estimates the cost of combined metrics from their expressions and the rates of their inputs,
+ * before running them.
+ *
+ * The estimates are worst cases for inputs that report at a steady rate:
+ * - A join without "hold" waits for the next value of its slowest input, while values of faster
+ *   inputs queue up: rate(fast) / rate(slow) of them.  With "hold", values do not queue up.
+ * - Joins produce a value for each distinct timestamp of their inputs, i.e. the sum of their
+ *   rates, unless a "tolerance" lines them up, then the largest rate.
+ * - Throttles produce at most one value per cooldown period, windowed quantiles one per window,
+ *   deadbands and swinging doors at most as many as they get.
+ *
+ * The cost of evaluating is given in node updates, i.e. values consumed or produced by any node.
+ * Rates of inputs that are combined metrics themselves are estimated as well, unknown rates are
+ * NaN and so is everything that depends on them.
+ */
+class CostModel
+{
+public:
+    struct Estimate
+    {
+        std::string name;
+        // Output values per second, of each output of an aggregate
+        double output_rate;
+        // Most values queued at any input of a node of the expression
+        double queue_depth;
+        // Bytes for nodes and queued values
+        double memory;
+        // Values consumed or produced by all nodes per second
+        double updates;
+        // Node updates per value of the input metrics
+        double updates_per_value;
+    };
+
+    struct Limits
+    {
+        // Per combined metric, not limited if zero
+        double memory = 0;
+        double queue_depth = 0;
+    };
+
+    explicit CostModel(std::unordered_map<std::string, double> input_rates);
+
+    // Estimate all combined metrics of a configuration, the ones using the most memory first
+    std::vector<Estimate>
+    estimate(const std::vector<std::pair<std::string, metricq::json>>& metrics);
+
+    // Whether an estimate exceeds a limit, unknown estimates do not
+    static bool exceeds(const Estimate& estimate, const Limits& limits);
+
+    static void print(std::ostream& out, const std::vector<Estimate>& estimates,
+                      const Limits& limits);
+
+private:
+    struct Flow
+    {
+        double rate = 0;
+        // Constants always have a value, so they never hold up a join
+        bool constant = false;
+        double queue_depth = 0;
+        double queued = 0;
+        double updates = 0;
+        double input_rate = 0;
+        std::size_t nodes = 0;
+    };
+
+    Flow flow(const metricq::json& expression);
+    Flow join(const metricq::json& expression, std::vector<Flow> inputs);
+    double rate(const std::string& metric);
+    const Estimate& estimate(const std::string& name);
+
+private:
+    std::unordered_map<std::string, double> input_rates_;
+    std::map<std::string, const metricq::json*> expressions_;
+    // Combined metric producing each output
+    std::unordered_map<std::string, std::string> producers_;
+    std::map<std::string, Estimate> estimates_;
+    std::set<std::string> in_progress_;
+};
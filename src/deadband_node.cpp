@@ -0,0 +1,218 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "deadband_node.hpp"
+#include "profiler.hpp"
+#include "snapshot.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+double nanoseconds_between(metricq::TimePoint from, metricq::TimePoint to)
+{
+    return static_cast<double>((to - from).count());
+}
+} // namespace
+
+bool DeadbandNode::changed(metricq::Value value) const
+{
+    auto last = last_passed_->value;
+    if (std::isnan(last) || std::isnan(value))
+    {
+        return std::isnan(last) != std::isnan(value);
+    }
+
+    auto difference = std::abs(value - last);
+    if (std::isinf(difference))
+    {
+        return value != last;
+    }
+    return difference > thresholds_.absolute &&
+           difference > thresholds_.relative * std::abs(last);
+}
+
+void DeadbandNode::update()
+{
+    input_->update();
+
+    Profiler::NodeScope profile(
+        *this, [this] { return input_->queue_length(); }, [this] { return queue_length(); });
+
+    while (input_->has_input())
+    {
+        auto tv = input_->peek();
+        input_->discard();
+
+        if (!last_passed_)
+        {
+            last_passed_ = tv;
+            put(tv);
+            continue;
+        }
+
+        bool silent_too_long =
+            thresholds_.max_silence && tv.time - last_passed_->time >= *thresholds_.max_silence;
+        if (changed(tv.value))
+        {
+            if (last_suppressed_)
+            {
+                put(*last_suppressed_);
+            }
+        }
+        else if (!silent_too_long)
+        {
+            last_suppressed_ = tv;
+            continue;
+        }
+
+        last_suppressed_.reset();
+        last_passed_ = tv;
+        put(tv);
+    }
+}
+
+void DeadbandNode::collect_metric_inputs(std::vector<MetricInputNode*>& inputs)
+{
+    input_->collect_metric_inputs(inputs);
+}
+
+void DeadbandNode::collect_nodes(std::vector<const InputNode*>& nodes) const
+{
+    input_->collect_nodes(nodes);
+    nodes.push_back(this);
+}
+
+void DeadbandNode::save_state(SnapshotWriter& writer) const
+{
+    InputQueue::save_state(writer);
+    writer.write(last_passed_);
+    writer.write(last_suppressed_);
+    input_->save_state(writer);
+}
+
+void DeadbandNode::restore_state(SnapshotReader& reader)
+{
+    InputQueue::restore_state(reader);
+    last_passed_ = reader.read_optional_time_value();
+    last_suppressed_ = reader.read_optional_time_value();
+    input_->restore_state(reader);
+}
+
+void SwingingDoorNode::start_segment(metricq::TimeValue tv)
+{
+    put(tv);
+    start_ = tv;
+    last_.reset();
+    upper_slope_ = -std::numeric_limits<double>::infinity();
+    lower_slope_ = std::numeric_limits<double>::infinity();
+}
+
+void SwingingDoorNode::update()
+{
+    input_->update();
+
+    Profiler::NodeScope profile(
+        *this, [this] { return input_->queue_length(); }, [this] { return queue_length(); });
+
+    while (input_->has_input())
+    {
+        auto tv = input_->peek();
+        input_->discard();
+
+        if (!start_ || !std::isfinite(start_->value))
+        {
+            start_segment(tv);
+            continue;
+        }
+
+        if (std::isnan(tv.value) || std::isinf(tv.value) ||
+            (max_silence_ && tv.time - start_->time > *max_silence_))
+        {
+            // End the segment with the last value before, so it is interpolated correctly
+            if (last_)
+            {
+                put(*last_);
+            }
+            start_segment(tv);
+            continue;
+        }
+
+        auto elapsed = nanoseconds_between(start_->time, tv.time);
+        if (elapsed <= 0)
+        {
+            // Values that are not newer than the start of the segment cannot be interpolated
+            continue;
+        }
+
+        auto difference = tv.value - start_->value;
+        auto slope = difference / elapsed;
+        if (last_ && (slope < upper_slope_ || slope > lower_slope_))
+        {
+            // The line to this value would leave the door, so the segment ends at the previous
+            // value, which was still within it
+            start_segment(*last_);
+            elapsed = nanoseconds_between(start_->time, tv.time);
+            if (elapsed <= 0)
+            {
+                // Same as above, for the start of the new segment
+                continue;
+            }
+            difference = tv.value - start_->value;
+        }
+
+        upper_slope_ = std::max(upper_slope_, (difference - deviation_) / elapsed);
+        lower_slope_ = std::min(lower_slope_, (difference + deviation_) / elapsed);
+        last_ = tv;
+    }
+}
+
+void SwingingDoorNode::collect_metric_inputs(std::vector<MetricInputNode*>& inputs)
+{
+    input_->collect_metric_inputs(inputs);
+}
+
+void SwingingDoorNode::collect_nodes(std::vector<const InputNode*>& nodes) const
+{
+    input_->collect_nodes(nodes);
+    nodes.push_back(this);
+}
+
+void SwingingDoorNode::save_state(SnapshotWriter& writer) const
+{
+    InputQueue::save_state(writer);
+    writer.write(start_);
+    writer.write(last_);
+    writer.write(upper_slope_);
+    writer.write(lower_slope_);
+    input_->save_state(writer);
+}
+
+void SwingingDoorNode::restore_state(SnapshotReader& reader)
+{
+    InputQueue::restore_state(reader);
+    start_ = reader.read_optional_time_value();
+    last_ = reader.read_optional_time_value();
+    upper_slope_ = reader.read<double>();
+    lower_slope_ = reader.read<double>();
+    input_->restore_state(reader);
+}
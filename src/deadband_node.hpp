@@ -0,0 +1,115 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include "input_node.hpp"
+
+#include <metricq/types.hpp>
+
+#include <memory>
+#include <optional>
+
+/**
+ * Only passes on values that differ from the last passed value by more than a threshold.
+ *
+ * A value at time t stands for the interval since the previous value, so to keep the shape of
+ * the signal, the last suppressed value is passed on right before a value that changed.  Like
+ * this, each level lasts up to the time it was last observed.  After max_silence without output,
+ * the current value is passed on regardless.
+ */
+struct DeadbandNode : CalculationNode
+{
+public:
+    struct Thresholds
+    {
+        // Changes up to this much are suppressed
+        metricq::Value absolute = 0;
+        // Changes up to this fraction of the last passed value are suppressed
+        metricq::Value relative = 0;
+        std::optional<metricq::Duration> max_silence;
+    };
+
+    DeadbandNode(NodePtr<InputNode> input, Thresholds thresholds)
+    : input_(std::move(input)), thresholds_(thresholds)
+    {
+    }
+
+    void update() override;
+
+    void collect_metric_inputs(std::vector<MetricInputNode*>&) override;
+    void collect_nodes(std::vector<const InputNode*>&) const override;
+
+    void save_state(SnapshotWriter&) const override;
+    void restore_state(SnapshotReader&) override;
+
+private:
+    bool changed(metricq::Value value) const;
+
+private:
+    NodePtr<InputNode> input_;
+    Thresholds thresholds_;
+
+    std::optional<metricq::TimeValue> last_passed_;
+    std::optional<metricq::TimeValue> last_suppressed_;
+};
+
+/**
+ * Swinging door compression: Only passes on the values needed to reconstruct the signal by
+ * linear interpolation between them with an error of at most `deviation`.
+ *
+ * For the current segment starting at the last passed value, the "door" is the range of slopes
+ * of lines from its start that stay within the deviation of all values since.  Once the line to a
+ * new value leaves the door, the value before it is passed on and starts the next segment.  NaNs
+ * and infinities always end a segment and are passed on, as is any value after max_silence
+ * without output.
+ */
+struct SwingingDoorNode : CalculationNode
+{
+public:
+    SwingingDoorNode(NodePtr<InputNode> input, metricq::Value deviation,
+                     std::optional<metricq::Duration> max_silence = std::nullopt)
+    : input_(std::move(input)), deviation_(deviation), max_silence_(max_silence)
+    {
+    }
+
+    void update() override;
+
+    void collect_metric_inputs(std::vector<MetricInputNode*>&) override;
+    void collect_nodes(std::vector<const InputNode*>&) const override;
+
+    void save_state(SnapshotWriter&) const override;
+    void restore_state(SnapshotReader&) override;
+
+private:
+    void start_segment(metricq::TimeValue tv);
+
+private:
+    NodePtr<InputNode> input_;
+    metricq::Value deviation_;
+    std::optional<metricq::Duration> max_silence_;
+
+    // Start of the current segment, i.e. the last passed value
+    std::optional<metricq::TimeValue> start_;
+    // The last value received, not yet passed on
+    std::optional<metricq::TimeValue> last_;
+    // Slopes of the door, in units per nanosecond
+    double upper_slope_ = 0;
+    double lower_slope_ = 0;
+};
@@ -0,0 +1,175 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+/**
+ * A binary heap of the indices 0..capacity-1, ordered by a key per index.
+ *
+ * In contrast to std::priority_queue, the key of any index can be changed and any index can be
+ * removed in O(log n).  With the default comparison, top() is the index with the smallest key.
+ */
+template <typename Key, typename Compare = std::less<Key>>
+class IndexedHeap
+{
+public:
+    IndexedHeap(std::size_t capacity = 0) : keys_(capacity), positions_(capacity, npos)
+    {
+        heap_.reserve(capacity);
+    }
+
+    bool empty() const
+    {
+        return heap_.empty();
+    }
+
+    std::size_t size() const
+    {
+        return heap_.size();
+    }
+
+    bool contains(std::size_t index) const
+    {
+        return positions_[index] != npos;
+    }
+
+    std::size_t top() const
+    {
+        assert(!empty());
+        return heap_.front();
+    }
+
+    const Key& top_key() const
+    {
+        return keys_[top()];
+    }
+
+    // Insert index with the given key, or change its key if it is already contained
+    void set(std::size_t index, Key key)
+    {
+        keys_[index] = std::move(key);
+        if (!contains(index))
+        {
+            positions_[index] = heap_.size();
+            heap_.push_back(index);
+            sift_up(heap_.size() - 1);
+        }
+        else
+        {
+            sift_up(positions_[index]);
+            sift_down(positions_[index]);
+        }
+    }
+
+    void erase(std::size_t index)
+    {
+        if (!contains(index))
+        {
+            return;
+        }
+        auto pos = positions_[index];
+        positions_[index] = npos;
+
+        auto last = heap_.back();
+        heap_.pop_back();
+        if (pos < heap_.size())
+        {
+            heap_[pos] = last;
+            positions_[last] = pos;
+            sift_up(pos);
+            sift_down(positions_[last]);
+        }
+    }
+
+    void pop()
+    {
+        erase(top());
+    }
+
+    void clear()
+    {
+        for (auto index : heap_)
+        {
+            positions_[index] = npos;
+        }
+        heap_.clear();
+    }
+
+private:
+    static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+    bool before(std::size_t a, std::size_t b) const
+    {
+        return Compare()(keys_[heap_[a]], keys_[heap_[b]]);
+    }
+
+    void swap(std::size_t a, std::size_t b)
+    {
+        std::swap(heap_[a], heap_[b]);
+        positions_[heap_[a]] = a;
+        positions_[heap_[b]] = b;
+    }
+
+    void sift_up(std::size_t pos)
+    {
+        while (pos > 0)
+        {
+            auto parent = (pos - 1) / 2;
+            if (!before(pos, parent))
+            {
+                return;
+            }
+            swap(pos, parent);
+            pos = parent;
+        }
+    }
+
+    void sift_down(std::size_t pos)
+    {
+        while (true)
+        {
+            auto first = pos;
+            for (auto child : { 2 * pos + 1, 2 * pos + 2 })
+            {
+                if (child < heap_.size() && before(child, first))
+                {
+                    first = child;
+                }
+            }
+            if (first == pos)
+            {
+                return;
+            }
+            swap(pos, first);
+            pos = first;
+        }
+    }
+
+private:
+    std::vector<Key> keys_;
+    std::vector<std::size_t> positions_;
+    std::vector<std::size_t> heap_;
+};
@@ -18,8 +18,88 @@
 // You should have received a copy of the GNU General Public License
 // along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
 #include "input_node.hpp"
+#include "snapshot.hpp"
 
-void MetricInputNode::collect_metric_inputs(MetricInputNodesByName& inputs)
+#include <algorithm>
+#include <stdexcept>
+
+MetricInputNodes::MetricInputNodes(const std::vector<MetricInputNode*>& nodes)
+{
+    auto sorted = nodes;
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](auto* a, auto* b) { return a->id() < b->id(); });
+    for (auto* node : sorted)
+    {
+        if (entries_.empty() || entries_.back().first != node->id())
+        {
+            entries_.emplace_back(node->id(), std::vector<MetricInputNode*>());
+        }
+        entries_.back().second.push_back(node);
+    }
+}
+
+MetricInputNodes::iterator MetricInputNodes::find(MetricId id)
+{
+    auto it = std::lower_bound(entries_.begin(), entries_.end(), id,
+                               [](const Entry& entry, MetricId id) { return entry.first < id; });
+    return it != entries_.end() && it->first == id ? it : entries_.end();
+}
+
+MetricInputNodes::iterator MetricInputNodes::find(const std::string& name)
+{
+    auto id = MetricIds::global().find(name);
+    return id ? find(*id) : entries_.end();
+}
+
+std::vector<MetricInputNode*>& MetricInputNodes::at(MetricId id)
+{
+    auto it = find(id);
+    if (it == entries_.end())
+    {
+        throw std::out_of_range("no input nodes for metric");
+    }
+    return it->second;
+}
+
+std::vector<MetricInputNode*>& MetricInputNodes::at(const std::string& name)
+{
+    auto it = find(name);
+    if (it == entries_.end())
+    {
+        throw std::out_of_range("no input nodes for metric " + name);
+    }
+    return it->second;
+}
+
+void MetricInputNode::collect_metric_inputs(std::vector<MetricInputNode*>& inputs)
+{
+    inputs.emplace_back(this);
+}
+
+void InputQueue::save_state(SnapshotWriter& writer) const
+{
+    writer.write(static_cast<std::uint64_t>(queue_.size()));
+    queue_.for_each([&writer](metricq::TimeValue tv) { writer.write(tv); });
+}
+
+void InputQueue::restore_state(SnapshotReader& reader)
+{
+    queue_.clear();
+    auto size = reader.read<std::uint64_t>();
+    for (std::uint64_t i = 0; i < size; ++i)
+    {
+        queue_.push_back(reader.read_time_value());
+    }
+}
+
+void SinglyBufferedInputQueue::save_state(SnapshotWriter& writer) const
+{
+    InputQueue::save_state(writer);
+    writer.write(buffered_value_);
+}
+
+void SinglyBufferedInputQueue::restore_state(SnapshotReader& reader)
 {
-    inputs[name_].emplace_back(this);
+    InputQueue::restore_state(reader);
+    buffered_value_ = reader.read_time_value();
 }
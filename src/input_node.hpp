@@ -19,16 +19,85 @@
 // along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 
+#include "metric_id.hpp"
+#include "node_arena.hpp"
+#include "time_value_queue.hpp"
 #include "timestamp.hpp"
 
 #include <metricq/json.hpp>
 
-#include <deque>
 #include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
 class MetricInputNode;
-using MetricInputNodesByName = std::unordered_map<std::string, std::vector<MetricInputNode*>>;
+class SnapshotReader;
+class SnapshotWriter;
+
+/**
+ * The metric input nodes of an expression, grouped by metric.
+ *
+ * Entries are sorted by metric ID in a flat array.  Lookups by name are meant for configuration
+ * time and tests, they do not intern unknown names.
+ */
+class MetricInputNodes
+{
+public:
+    using Entry = std::pair<MetricId, std::vector<MetricInputNode*>>;
+    using iterator = std::vector<Entry>::iterator;
+    using const_iterator = std::vector<Entry>::const_iterator;
+
+    MetricInputNodes() = default;
+    explicit MetricInputNodes(const std::vector<MetricInputNode*>& nodes);
+
+    iterator find(MetricId id);
+    iterator find(const std::string& name);
+
+    std::vector<MetricInputNode*>& at(MetricId id);
+    std::vector<MetricInputNode*>& at(const std::string& name);
+
+    std::size_t count(const std::string& name)
+    {
+        return find(name) == end() ? 0 : 1;
+    }
+
+    iterator begin()
+    {
+        return entries_.begin();
+    }
+
+    iterator end()
+    {
+        return entries_.end();
+    }
+
+    const_iterator begin() const
+    {
+        return entries_.begin();
+    }
+
+    const_iterator end() const
+    {
+        return entries_.end();
+    }
+
+    std::size_t size() const
+    {
+        return entries_.size();
+    }
+
+private:
+    std::vector<Entry> entries_;
+};
+
+// Receives the values drained from an InputNode, in contiguous runs
+struct SpanConsumer
+{
+    virtual ~SpanConsumer() = default;
+
+    virtual void consume(const metricq::TimeValue* values, std::size_t count) = 0;
+};
 
 struct InputNode
 {
@@ -38,15 +107,42 @@ struct InputNode
     virtual metricq::TimeValue peek() const = 0;
     virtual void discard() = 0;
 
+    // Discard all values, handing them to consumer first.  Returns the number of values.
+    virtual std::size_t drain(SpanConsumer& consumer)
+    {
+        std::size_t count = 0;
+        for (; has_input(); discard(), count++)
+        {
+            auto tv = peek();
+            consumer.consume(&tv, 1);
+        }
+        return count;
+    }
+
     virtual void update()
     {
     }
 
-    virtual void collect_metric_inputs(MetricInputNodesByName&)
+    virtual void collect_metric_inputs(std::vector<MetricInputNode*>&)
     {
     }
 
+    // Append this node and all nodes below it, children before their parent
+    virtual void collect_nodes(std::vector<const InputNode*>& nodes) const
+    {
+        nodes.push_back(this);
+    }
+
     virtual std::size_t queue_length() const = 0;
+
+    // Serialize/restore all state of this node and its children in a fixed, depth-first order.
+    virtual void save_state(SnapshotWriter&) const
+    {
+    }
+
+    virtual void restore_state(SnapshotReader&)
+    {
+    }
 };
 
 struct OutputNode
@@ -80,13 +176,25 @@ public:
         queue_.pop_front();
     }
 
+    std::size_t drain(SpanConsumer& consumer) override
+    {
+        auto drained = queue_.size();
+        queue_.drain([&consumer](const metricq::TimeValue* values, std::size_t count) {
+            consumer.consume(values, count);
+        });
+        return drained;
+    }
+
     std::size_t queue_length() const override
     {
         return queue_.size();
     }
 
+    void save_state(SnapshotWriter&) const override;
+    void restore_state(SnapshotReader&) override;
+
 private:
-    std::deque<metricq::TimeValue> queue_;
+    TimeValueQueue queue_;
 };
 
 class ConstantInput : public InputNode
@@ -127,19 +235,24 @@ private:
 class MetricInputNode : public InputQueue
 {
 public:
-    MetricInputNode(const std::string& name) : name_(name)
+    MetricInputNode(const std::string& name) : id_(MetricIds::global().intern(name))
     {
     }
 
-    void collect_metric_inputs(MetricInputNodesByName&) override;
+    void collect_metric_inputs(std::vector<MetricInputNode*>&) override;
+
+    MetricId id() const
+    {
+        return id_;
+    }
 
     const std::string& name() const
     {
-        return name_;
+        return MetricIds::global().name(id_);
     }
 
 private:
-    std::string name_;
+    MetricId id_;
 };
 
 class SinglyBufferedInputQueue : public InputQueue
@@ -165,11 +278,20 @@ public:
         InputQueue::discard();
     }
 
+    // Values are handed out one behind the queue, so they are not contiguous
+    std::size_t drain(SpanConsumer& consumer) override
+    {
+        return InputNode::drain(consumer);
+    }
+
     std::size_t queue_length() const override
     {
         return 1 + InputQueue::queue_length();
     }
 
+    void save_state(SnapshotWriter&) const override;
+    void restore_state(SnapshotReader&) override;
+
 private:
     metricq::TimeValue buffered_value_;
 };
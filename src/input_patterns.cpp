@@ -0,0 +1,211 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "input_patterns.hpp"
+#include "combined_metric.hpp"
+
+#include <regex>
+#include <string_view>
+#include <unordered_set>
+
+bool InputPatterns::is_pattern(const metricq::json& input)
+{
+    return input.is_object() && (input.count("glob") || input.count("regex"));
+}
+
+bool InputPatterns::contains_patterns(const metricq::json& expression)
+{
+    std::vector<std::string> selectors;
+    collect_selectors(expression, selectors);
+    return !selectors.empty();
+}
+
+void InputPatterns::collect_selectors(const metricq::json& expression,
+                                      std::vector<std::string>& selectors)
+{
+    if (!expression.is_object())
+    {
+        return;
+    }
+
+    for (const auto& [key, value] : expression.items())
+    {
+        if (key == "inputs" && value.is_array())
+        {
+            for (const auto& input : value)
+            {
+                if (!is_pattern(input))
+                {
+                    collect_selectors(input, selectors);
+                }
+                else if (auto it = input.find("glob"); it != input.end())
+                {
+                    selectors.push_back(glob_to_regex(it->get<std::string>()));
+                }
+                else
+                {
+                    selectors.push_back(input.at("regex").get<std::string>());
+                }
+            }
+        }
+        else
+        {
+            collect_selectors(value, selectors);
+        }
+    }
+}
+
+std::string InputPatterns::glob_to_regex(const std::string& glob)
+{
+    std::string regex;
+    for (std::size_t i = 0; i < glob.size(); ++i)
+    {
+        auto c = glob[i];
+        if (c == '*' && i + 1 < glob.size() && glob[i + 1] == '*')
+        {
+            regex += ".*";
+            ++i;
+        }
+        else if (c == '*')
+        {
+            regex += "[^.]*";
+        }
+        else if (c == '?')
+        {
+            regex += "[^.]";
+        }
+        else
+        {
+            if (std::string_view("\\^$.|+()[]{}").find(c) != std::string_view::npos)
+            {
+                regex += '\\';
+            }
+            regex += c;
+        }
+    }
+    return regex;
+}
+
+metricq::json InputPatterns::expand(const metricq::json& expression,
+                                    const std::set<std::string>& known_metrics,
+                                    std::size_t max_fan_in)
+{
+    if (!expression.is_object())
+    {
+        return expression;
+    }
+
+    metricq::json expanded = metricq::json::object();
+    for (const auto& [key, value] : expression.items())
+    {
+        if (key != "inputs" || !value.is_array())
+        {
+            expanded[key] = expand(value, known_metrics, max_fan_in);
+            continue;
+        }
+
+        // Metrics matched by several patterns or also given by name must only be used once
+        std::unordered_set<std::string> named;
+        for (const auto& input : value)
+        {
+            if (input.is_string())
+            {
+                named.insert(input.get<std::string>());
+            }
+        }
+
+        auto inputs = metricq::json::array();
+        for (const auto& input : value)
+        {
+            if (!is_pattern(input))
+            {
+                inputs.push_back(expand(input, known_metrics, max_fan_in));
+                continue;
+            }
+
+            std::vector<std::string> selectors;
+            collect_selectors({ { "inputs", { input } } }, selectors);
+            std::regex regex;
+            try
+            {
+                regex = std::regex(selectors.front(), std::regex::optimize);
+            }
+            catch (const std::regex_error& e)
+            {
+                throw CombinedMetric::ParseError("invalid input pattern {}: {}", input.dump(),
+                                                 e.what());
+            }
+
+            for (const auto& metric : known_metrics)
+            {
+                if (std::regex_match(metric, regex) && named.insert(metric).second)
+                {
+                    inputs.push_back(metric);
+                }
+            }
+        }
+        expanded[key] = std::move(inputs);
+    }
+
+    return balance(std::move(expanded), max_fan_in);
+}
+
+metricq::json InputPatterns::balance(metricq::json expression, std::size_t max_fan_in)
+{
+    auto operation = expression.find("operation");
+    auto inputs = expression.find("inputs");
+    if (operation == expression.end() || !operation->is_string() || inputs == expression.end() ||
+        !inputs->is_array() || inputs->size() <= max_fan_in || max_fan_in < 2)
+    {
+        return expression;
+    }
+
+    // Only these operations give the same result when applied to partial results
+    auto op = operation->get<std::string>();
+    if (op != "sum" && op != "min" && op != "max")
+    {
+        return expression;
+    }
+
+    // Split the inputs into as few groups as possible, all of about the same size
+    auto count = inputs->size();
+    auto groups = (count + max_fan_in - 1) / max_fan_in;
+    auto children = metricq::json::array();
+    for (std::size_t group = 0; group < groups; ++group)
+    {
+        auto begin = count * group / groups;
+        auto end = count * (group + 1) / groups;
+
+        /*
+         * Inner nodes join their inputs strictly.  Holding or coalescing values again at every
+         * level would add up, so that the root could use values up to depth times as old as
+         * "hold", or coalesce values up to depth times "tolerance" apart.  Only the root applies
+         * the join options, to the partial results.
+         */
+        auto child = expression;
+        child.erase("hold");
+        child.erase("tolerance");
+        child["inputs"] = metricq::json(inputs->begin() + begin, inputs->begin() + end);
+        children.push_back(std::move(child));
+    }
+
+    expression["inputs"] = std::move(children);
+    return balance(std::move(expression), max_fan_in);
+}
@@ -0,0 +1,65 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <metricq/json.hpp>
+
+#include <cstddef>
+#include <set>
+#include <string>
+#include <vector>
+
+/**
+ * Input patterns select input metrics by name instead of spelling out each of them.
+ *
+ * They can be used as entries of the "inputs" array of operations with several inputs, either as
+ * { "glob": "rack1.*.power" } or as { "regex": "rack1\\.node[0-9]+\\.power" }.  In globs, "*" and
+ * "?" do not match dots, so they stay within one component of a metric name, while "**" matches
+ * anything.  Both kinds of patterns have to match the whole metric name.
+ */
+class InputPatterns
+{
+public:
+    static constexpr std::size_t default_max_fan_in = 64;
+
+    static bool contains_patterns(const metricq::json& expression);
+
+    // Append the regular expressions of all patterns in this expression to selectors
+    static void collect_selectors(const metricq::json& expression,
+                                  std::vector<std::string>& selectors);
+
+    static std::string glob_to_regex(const std::string& glob);
+
+    /*
+     * Replace all patterns in an expression by the known metrics they match.
+     *
+     * Sums, minimums and maximums with more than max_fan_in inputs, whether matched by patterns
+     * or given by name, are split up into a balanced tree of the same operation, so that no
+     * single node has to line up thousands of inputs.  Only the root of such a tree keeps the
+     * join options.  Throws CombinedMetric::ParseError for invalid patterns.
+     */
+    static metricq::json expand(const metricq::json& expression,
+                                const std::set<std::string>& known_metrics,
+                                std::size_t max_fan_in = default_max_fan_in);
+
+private:
+    static bool is_pattern(const metricq::json& input);
+    static metricq::json balance(metricq::json expression, std::size_t max_fan_in);
+};
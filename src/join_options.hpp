@@ -0,0 +1,58 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <metricq/types.hpp>
+
+#include <optional>
+
+/**
+ * Controls how nodes with several inputs line up the values of their inputs.
+ */
+struct JoinOptions
+{
+    /*
+     * Zero-order hold: If set, an input that has no new value yet is assumed to keep its last
+     * value for up to this long.  This allows combining inputs with very different rates without
+     * waiting for (and buffering values until) the next value of the slowest input.
+     *
+     * Values of an input that arrive after their time has already been covered by held values
+     * only replace the held value, they do not produce output on their own.
+     */
+    std::optional<metricq::Duration> hold;
+
+    /*
+     * Values of different inputs whose timestamps are at most this far apart are treated as
+     * simultaneous, i.e. combined into a single output value at the earliest of their timestamps.
+     * Otherwise, inputs that sample at nominally the same time but with slightly different
+     * timestamps would produce twice as many output values.
+     */
+    metricq::Duration tolerance = metricq::Duration::zero();
+
+    bool coincides(metricq::TimePoint time, metricq::TimePoint earliest) const
+    {
+        return time <= earliest + tolerance;
+    }
+
+    bool holds_at(metricq::TimeValue held, metricq::TimePoint time) const
+    {
+        return hold && time <= held.time + *hold;
+    }
+};
@@ -0,0 +1,198 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "kll_sketch.hpp"
+#include "snapshot.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <utility>
+
+KllSketch::KllSketch(std::size_t k) : k_(std::max<std::size_t>(k, 8)), levels_(1)
+{
+    // Until the first compaction, which most windows of values never reach
+    levels_.front().reserve(k_);
+    weighted_.reserve(k_);
+}
+
+std::size_t KllSketch::capacity(std::size_t level) const
+{
+    // Lower levels hold values of less weight, so they get geometrically smaller capacities
+    auto depth = levels_.size() - level - 1;
+    auto capacity = static_cast<double>(k_) * std::pow(2.0 / 3.0, static_cast<double>(depth));
+    return std::max<std::size_t>(2, static_cast<std::size_t>(std::ceil(capacity)));
+}
+
+void KllSketch::add(metricq::Value value)
+{
+    levels_.front().push_back(value);
+    count_++;
+    retained_++;
+
+    std::size_t total_capacity = 0;
+    for (std::size_t level = 0; level < levels_.size(); ++level)
+    {
+        total_capacity += capacity(level);
+    }
+    if (retained_ > total_capacity)
+    {
+        compress();
+    }
+}
+
+void KllSketch::compress()
+{
+    for (std::size_t level = 0; level < levels_.size(); ++level)
+    {
+        if (levels_[level].size() < capacity(level))
+        {
+            continue;
+        }
+
+        if (level + 1 == levels_.size())
+        {
+            if (spare_levels_.empty())
+            {
+                levels_.emplace_back();
+            }
+            else
+            {
+                levels_.push_back(std::move(spare_levels_.back()));
+                spare_levels_.pop_back();
+            }
+        }
+
+        auto& values = levels_[level];
+        std::sort(values.begin(), values.end());
+
+        // Keep the largest value at this level if there is an odd number of them
+        std::optional<metricq::Value> leftover;
+        if (values.size() % 2 == 1)
+        {
+            leftover = values.back();
+            values.pop_back();
+        }
+
+        auto& next = levels_[level + 1];
+        for (std::size_t i = odd_ ? 1 : 0; i < values.size(); i += 2)
+        {
+            next.push_back(values[i]);
+        }
+        odd_ = !odd_;
+
+        retained_ -= values.size() / 2;
+        values.clear();
+        if (leftover)
+        {
+            values.push_back(*leftover);
+        }
+        return;
+    }
+}
+
+metricq::Value KllSketch::quantile(double q) const
+{
+    if (empty())
+    {
+        return std::nan("");
+    }
+
+    auto& weighted = weighted_;
+    weighted.clear();
+    weighted.reserve(retained_);
+    std::uint64_t total_weight = 0;
+    for (std::size_t level = 0; level < levels_.size(); ++level)
+    {
+        for (auto value : levels_[level])
+        {
+            weighted.emplace_back(value, std::uint64_t(1) << level);
+            total_weight += std::uint64_t(1) << level;
+        }
+    }
+    std::sort(weighted.begin(), weighted.end());
+
+    auto rank = std::clamp(q, 0.0, 1.0) * static_cast<double>(total_weight);
+    std::uint64_t cumulative_weight = 0;
+    for (const auto& [value, weight] : weighted)
+    {
+        cumulative_weight += weight;
+        if (static_cast<double>(cumulative_weight) >= rank)
+        {
+            return value;
+        }
+    }
+    return weighted.back().first;
+}
+
+void KllSketch::clear()
+{
+    for (auto& values : levels_)
+    {
+        values.clear();
+    }
+    while (levels_.size() > 1)
+    {
+        spare_levels_.push_back(std::move(levels_.back()));
+        levels_.pop_back();
+    }
+    count_ = 0;
+    retained_ = 0;
+    odd_ = false;
+}
+
+void KllSketch::save_state(SnapshotWriter& writer) const
+{
+    writer.write(static_cast<std::uint64_t>(count_));
+    writer.write(odd_);
+    writer.write(static_cast<std::uint64_t>(levels_.size()));
+    for (const auto& values : levels_)
+    {
+        writer.write(static_cast<std::uint64_t>(values.size()));
+        for (auto value : values)
+        {
+            writer.write(value);
+        }
+    }
+}
+
+void KllSketch::restore_state(SnapshotReader& reader)
+{
+    count_ = reader.read<std::uint64_t>();
+    odd_ = reader.read<bool>();
+    auto levels = reader.read<std::uint64_t>();
+    if (levels == 0 || levels > 64)
+    {
+        throw SnapshotError("invalid number of sketch levels");
+    }
+    levels_.resize(levels);
+    retained_ = 0;
+    for (auto& values : levels_)
+    {
+        values.clear();
+        auto size = reader.read<std::uint64_t>();
+        for (std::uint64_t i = 0; i < size; ++i)
+        {
+            values.push_back(reader.read<metricq::Value>());
+        }
+        retained_ += values.size();
+    }
+}
@@ -0,0 +1,90 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <metricq/types.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+class SnapshotReader;
+class SnapshotWriter;
+
+/**
+ * A KLL sketch for approximate quantiles of a stream of values in bounded memory.
+ *
+ * Values are kept in levels of compactors, a value in level l stands for 2^l values of the stream.
+ * Whenever a level exceeds its capacity, it is sorted and every other value is promoted to the
+ * next level.  With the default k = 200, the rank error is around 1% and only a few hundred
+ * values are kept, no matter how many values were added.
+ *
+ * Compactions alternate between keeping the even and the odd values instead of choosing
+ * randomly, so results are reproducible, e.g. after restoring a snapshot.
+ */
+class KllSketch
+{
+public:
+    explicit KllSketch(std::size_t k = 200);
+
+    void add(metricq::Value value);
+
+    // The value at rank q * count(), q in [0, 1], or NaN if no values were added
+    metricq::Value quantile(double q) const;
+
+    bool empty() const
+    {
+        return count_ == 0;
+    }
+
+    // The number of values added since the last clear()
+    std::size_t count() const
+    {
+        return count_;
+    }
+
+    // The number of values kept in the sketch
+    std::size_t retained() const
+    {
+        return retained_;
+    }
+
+    // Remove all values, but keep the memory of all levels for new ones
+    void clear();
+
+    void save_state(SnapshotWriter&) const;
+    void restore_state(SnapshotReader&);
+
+private:
+    std::size_t capacity(std::size_t level) const;
+    void compress();
+
+private:
+    std::size_t k_;
+    std::vector<std::vector<metricq::Value>> levels_;
+    // Levels removed by clear(), to be reused by compress()
+    std::vector<std::vector<metricq::Value>> spare_levels_;
+    // Scratch space of quantile(), which is thus not safe to call concurrently
+    mutable std::vector<std::pair<metricq::Value, std::uint64_t>> weighted_;
+    std::size_t count_ = 0;
+    std::size_t retained_ = 0;
+    bool odd_ = false;
+};
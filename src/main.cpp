@@ -26,6 +26,8 @@
 #include <nitro/options/parser.hpp>
 
 #include <cstdlib>
+#include <sstream>
+#include <stdexcept>
 #include <string>
 
 using Log = metricq::logger::nitro::Log;
@@ -46,6 +48,87 @@ struct Options
             .option("token",
                     "The token used for transformer authentication against the metricq manager.")
             .default_value("combinator-dummy");
+        parser
+            .option("snapshot-file",
+                    "Periodically save the state of all combined metrics to this file and restore "
+                    "it on startup.")
+            .default_value("");
+        parser.option("snapshot-interval", "The interval at which to write snapshots.")
+            .default_value("5min");
+        parser
+            .option("spill-directory",
+                    "Buffer output values on disk in this directory while they cannot be sent.")
+            .default_value("");
+        parser
+            .option("spill-memory-limit",
+                    "Number of bytes of output values to buffer in memory before spilling to disk.")
+            .default_value("67108864");
+        parser
+            .option("spill-metrics-prefix",
+                    "Publish the number of bytes pending in and spilled by the spill buffer as "
+                    "<prefix>.pending_bytes and <prefix>.spilled_bytes.")
+            .default_value("");
+        parser
+            .option("pattern-refresh-interval",
+                    "The interval at which to look for new metrics matching input patterns.")
+            .default_value("5min");
+        parser
+            .option("threads",
+                    "Number of threads to update independent parts of large expressions with.")
+            .default_value("1");
+        parser
+            .option("shards",
+                    "Split the combined metrics of the configuration across this many instances.")
+            .default_value("1");
+        parser
+            .option("shard-index",
+                    "Which of the --shards parts of the configuration this instance takes over.")
+            .default_value("0");
+        parser
+            .option("update-budget",
+                    "How long to keep updating combined metrics before accepting new input again.")
+            .default_value("50ms");
+        parser
+            .option("shed-age",
+                    "Disable low priority combined metrics whose input waited for longer than "
+                    "this.")
+            .default_value("10s");
+        parser
+            .option("shed-disable-duration",
+                    "How long to disable low priority combined metrics when overloaded.")
+            .default_value("1min");
+        parser
+            .option("trace-metrics",
+                    "Comma-separated combined metrics to trace the evaluation of, dumped to "
+                    "--trace-file on SIGUSR2.")
+            .default_value("");
+        parser.option("trace-sample", "Only trace every n-th step of each traced metric.")
+            .default_value("1");
+        parser.option("trace-buffer", "Number of most recent trace events to keep.")
+            .default_value("65536");
+        parser.option("trace-file", "Where to dump the trace to.")
+            .default_value("metricq-combinator.trace");
+        parser
+            .option("profile-sample",
+                    "Attribute CPU time to the nodes of combined metrics, measuring every n-th "
+                    "update of each (0: disabled).  A report is logged on SIGUSR1.")
+            .default_value("0");
+        parser
+            .option("profile-interval",
+                    "Also log the profile report at this interval (0s: only on SIGUSR1).")
+            .default_value("0s");
+        parser.option("profile-top", "Number of most expensive combined metrics to report.")
+            .default_value("20");
+        parser
+            .option("max-metric-memory",
+                    "Fail a dry run if a combined metric needs more bytes than this (0: no limit).")
+            .default_value("0");
+        parser
+            .option("max-queue-depth",
+                    "Fail a dry run if values of a combined metric can queue up more than this "
+                    "(0: no limit).")
+            .default_value("0");
+        parser.toggle("dry-run").short_name("n");
         parser.toggle("verbose").short_name("v");
         parser.toggle("trace").short_name("t");
         parser.toggle("quiet").short_name("q");
@@ -79,6 +162,44 @@ struct Options
 
             this->server = options.get("server");
             this->token = options.get("token");
+            this->settings.snapshot_path = options.get("snapshot-file");
+            this->settings.snapshot_interval =
+                metricq::duration_parse(options.get("snapshot-interval"));
+            this->settings.spill_directory = options.get("spill-directory");
+            this->settings.spill_memory_limit = std::stoull(options.get("spill-memory-limit"));
+            this->settings.spill_metrics_prefix = options.get("spill-metrics-prefix");
+            this->settings.pattern_refresh_interval =
+                metricq::duration_parse(options.get("pattern-refresh-interval"));
+            this->settings.update_threads = std::stoul(options.get("threads"));
+            this->settings.shard_count = std::stoul(options.get("shards"));
+            this->settings.shard_index = std::stoul(options.get("shard-index"));
+            if (this->settings.shard_count == 0 ||
+                this->settings.shard_index >= this->settings.shard_count)
+            {
+                throw std::invalid_argument("--shard-index must be less than --shards");
+            }
+            this->settings.update_budget = metricq::duration_parse(options.get("update-budget"));
+            this->settings.shed_age = metricq::duration_parse(options.get("shed-age"));
+            this->settings.shed_disable_duration =
+                metricq::duration_parse(options.get("shed-disable-duration"));
+            std::istringstream trace_metrics(options.get("trace-metrics"));
+            for (std::string name; std::getline(trace_metrics, name, ',');)
+            {
+                if (!name.empty())
+                {
+                    this->settings.trace_metrics.push_back(name);
+                }
+            }
+            this->settings.trace_sample_interval = std::stoul(options.get("trace-sample"));
+            this->settings.trace_buffer_size = std::stoull(options.get("trace-buffer"));
+            this->settings.trace_path = options.get("trace-file");
+            this->settings.profile_sample_interval = std::stoul(options.get("profile-sample"));
+            this->settings.profile_report_interval =
+                metricq::duration_parse(options.get("profile-interval"));
+            this->settings.profile_top = std::stoull(options.get("profile-top"));
+            this->settings.dry_run = options.given("dry-run");
+            this->settings.dry_run_limits.memory = std::stod(options.get("max-metric-memory"));
+            this->settings.dry_run_limits.queue_depth = std::stod(options.get("max-queue-depth"));
         }
         catch (nitro::options::parsing_error& e)
         {
@@ -96,6 +217,7 @@ struct Options
 
     std::string server;
     std::string token;
+    CombinatorSettings settings;
 };
 
 int main(int argc, const char* argv[])
@@ -107,12 +229,27 @@ int main(int argc, const char* argv[])
         Combinator combinator{
             options.server,
             options.token,
+            options.settings,
         };
 
         Log::info() << "MetricQ version " << metricq::version();
         Log::info() << "starting main loop...";
-        combinator.main_loop();
+        try
+        {
+            combinator.main_loop();
+        }
+        catch (...)
+        {
+            // We are about to be restarted, keep the state we have accumulated so far
+            combinator.write_snapshot();
+            throw;
+        }
         Log::info() << "stopped.";
+
+        if (options.settings.dry_run && !combinator.dry_run_passed())
+        {
+            return EXIT_FAILURE;
+        }
     }
     catch (const CombinedMetric::ParseError& e)
     {
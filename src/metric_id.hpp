@@ -0,0 +1,85 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+using MetricId = std::uint32_t;
+
+/**
+ * Interns metric names into dense integer IDs, so that each name is stored only once and
+ * per-metric data can be kept in flat arrays indexed by ID.  Names are only looked up when
+ * talking to the manager or broker.
+ *
+ * IDs are never reused, so this grows with the number of distinct metric names ever seen.
+ */
+class MetricIds
+{
+public:
+    // The IDs shared by all combined metrics of this process
+    static MetricIds& global()
+    {
+        static MetricIds ids;
+        return ids;
+    }
+
+    MetricId intern(std::string_view name)
+    {
+        if (auto it = ids_.find(name); it != ids_.end())
+        {
+            return it->second;
+        }
+        auto id = static_cast<MetricId>(names_.size());
+        // std::deque does not move its elements, so the views into them stay valid
+        const auto& stored = names_.emplace_back(name);
+        ids_.emplace(stored, id);
+        return id;
+    }
+
+    std::optional<MetricId> find(std::string_view name) const
+    {
+        if (auto it = ids_.find(name); it != ids_.end())
+        {
+            return it->second;
+        }
+        return std::nullopt;
+    }
+
+    const std::string& name(MetricId id) const
+    {
+        assert(id < names_.size());
+        return names_[id];
+    }
+
+    std::size_t size() const
+    {
+        return names_.size();
+    }
+
+private:
+    std::deque<std::string> names_;
+    std::unordered_map<std::string_view, MetricId> ids_;
+};
@@ -0,0 +1,70 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <utility>
+
+/**
+ * Nodes are placed in the arena of their combined metric, which releases their memory all at
+ * once.  Destroying a node through its pointer therefore only runs its destructor.
+ */
+struct NodeDeleter
+{
+    template <typename T>
+    void operator()(T* node) const
+    {
+        node->~T();
+    }
+};
+
+template <typename T>
+using NodePtr = std::unique_ptr<T, NodeDeleter>;
+
+/**
+ * Contiguous storage for the nodes of one expression tree.
+ *
+ * Nodes are allocated in the order in which they are created.  As the parser creates the
+ * children of a node before the node itself, each subtree ends up in one depth-first block, with
+ * children right in front of their parent.
+ */
+class NodeArena
+{
+public:
+    explicit NodeArena(std::size_t initial_size) : memory_(initial_size)
+    {
+    }
+
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    template <typename T, typename... Args>
+    NodePtr<T> make(Args&&... args)
+    {
+        void* memory = memory_.allocate(sizeof(T), alignof(T));
+        // Memory is only released together with the arena, even if the constructor throws
+        return NodePtr<T>(new (memory) T(std::forward<Args>(args)...));
+    }
+
+private:
+    std::pmr::monotonic_buffer_resource memory_;
+};
@@ -0,0 +1,142 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#include "partition.hpp"
+#include "fnv1a.hpp"
+#include "variadic_node.hpp"
+
+#include <numeric>
+#include <unordered_map>
+
+Partition::Metric Partition::describe(const std::string& name, const metricq::json& expression)
+{
+    Metric metric{ name, {}, {} };
+    collect_inputs(expression, metric.inputs);
+
+    // The expression is not validated yet, CombinedMetric reports invalid ones when creating them
+    auto operation = expression.is_object() ? expression.find("operation") : expression.end();
+    if (operation != expression.end() && *operation == "aggregate")
+    {
+        if (auto it = expression.find("outputs"); it != expression.end() && it->is_array())
+        {
+            for (const auto& output : *it)
+            {
+                if (output.is_string())
+                {
+                    metric.outputs.push_back(name + "." + output.get<std::string>());
+                }
+            }
+        }
+        else
+        {
+            for (const auto& [aggregate, _] : AggregateNode::aggregate_names())
+            {
+                metric.outputs.push_back(name + "." + aggregate);
+            }
+        }
+    }
+    else
+    {
+        metric.outputs.push_back(name);
+    }
+    return metric;
+}
+
+void Partition::collect_inputs(const metricq::json& expression, std::vector<std::string>& inputs)
+{
+    if (expression.is_string())
+    {
+        inputs.push_back(expression.get<std::string>());
+        return;
+    }
+    if (!expression.is_object())
+    {
+        return;
+    }
+
+    for (const char* key : { "left", "right", "input", "condition", "then", "else", "min", "max" })
+    {
+        if (auto it = expression.find(key); it != expression.end())
+        {
+            collect_inputs(*it, inputs);
+        }
+    }
+    if (auto it = expression.find("inputs"); it != expression.end() && it->is_array())
+    {
+        for (const auto& input : *it)
+        {
+            collect_inputs(input, inputs);
+        }
+    }
+}
+
+std::vector<std::size_t> Partition::assign(const std::vector<Metric>& metrics,
+                                           std::size_t shard_count)
+{
+    // Union-find over the indices of metrics, with path halving
+    std::vector<std::size_t> parent(metrics.size());
+    std::iota(parent.begin(), parent.end(), 0);
+    auto find = [&parent](std::size_t i) {
+        while (parent[i] != i)
+        {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    };
+
+    std::unordered_map<std::string, std::size_t> producers;
+    for (std::size_t i = 0; i < metrics.size(); ++i)
+    {
+        for (const auto& output : metrics[i].outputs)
+        {
+            producers.emplace(output, i);
+        }
+    }
+    for (std::size_t i = 0; i < metrics.size(); ++i)
+    {
+        for (const auto& input : metrics[i].inputs)
+        {
+            if (auto it = producers.find(input); it != producers.end())
+            {
+                parent[find(i)] = find(it->second);
+            }
+        }
+    }
+
+    // Name each component after its smallest member, which does not depend on the order of
+    // metrics in the configuration
+    std::vector<std::size_t> smallest(metrics.size());
+    std::iota(smallest.begin(), smallest.end(), 0);
+    for (std::size_t i = 0; i < metrics.size(); ++i)
+    {
+        auto& representative = smallest[find(i)];
+        if (metrics[i].name < metrics[representative].name)
+        {
+            representative = i;
+        }
+    }
+
+    std::vector<std::size_t> shards(metrics.size());
+    for (std::size_t i = 0; i < metrics.size(); ++i)
+    {
+        shards[i] = fnv1a(metrics[smallest[find(i)]].name) % shard_count;
+    }
+    return shards;
+}
@@ -0,0 +1,59 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <metricq/json.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Splits the combined metrics of one configuration across several combinator instances.
+ *
+ * Combined metrics that use the output of another one as input are kept together, as the metadata
+ * of such inputs is resolved within one instance.  Each connected component of this dependency
+ * graph is assigned to a shard by hashing the smallest name in it, so every instance with the same
+ * configuration comes to the same result without talking to the others.  Sharing a plain input
+ * metric does not connect combined metrics, that only means that several shards subscribe to it.
+ */
+class Partition
+{
+public:
+    struct Metric
+    {
+        std::string name;
+        // Names of the input metrics of its expression
+        std::vector<std::string> inputs;
+        // Names of the metrics it produces, i.e. its name, or one per aggregate
+        std::vector<std::string> outputs;
+    };
+
+    // Inputs and outputs of a combined metric with an expression without input patterns
+    static Metric describe(const std::string& name, const metricq::json& expression);
+
+    // The shard of each metric, in the same order
+    static std::vector<std::size_t> assign(const std::vector<Metric>& metrics,
+                                           std::size_t shard_count);
+
+private:
+    static void collect_inputs(const metricq::json& expression, std::vector<std::string>& inputs);
+};
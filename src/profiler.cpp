@@ -0,0 +1,199 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "profiler.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cxxabi.h>
+#include <memory>
+#include <numeric>
+#include <typeinfo>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace
+{
+// How many of the most expensive nodes of each combined metric are reported
+constexpr std::size_t reported_nodes = 3;
+
+std::string describe(const InputNode& node)
+{
+    int status = 0;
+    std::unique_ptr<char, decltype(&std::free)> name(
+        abi::__cxa_demangle(typeid(node).name(), nullptr, nullptr, &status), &std::free);
+    return status == 0 ? name.get() : typeid(node).name();
+}
+} // namespace
+
+double Profiler::MetricProfile::cycles() const
+{
+    auto sampled = std::accumulate(nodes.begin(), nodes.end(), std::uint64_t(0),
+                                   [](auto sum, const auto& node) { return sum + node.cycles; });
+    return scale() * static_cast<double>(sampled);
+}
+
+Profiler& Profiler::global()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+void Profiler::configure(std::uint32_t sample_interval)
+{
+    sample_interval_ = sample_interval;
+    clear();
+}
+
+void Profiler::clear()
+{
+    metrics_.clear();
+    slots_.clear();
+    nodes_.clear();
+}
+
+void Profiler::add(MetricId metric, const std::vector<const InputNode*>& nodes)
+{
+    if (metric >= slots_.size())
+    {
+        slots_.resize(metric + 1, 0);
+    }
+    slots_[metric] = metrics_.size() + 1;
+
+    auto& profile = metrics_.emplace_back();
+    profile.metric = metric;
+    for (std::uint32_t i = 0; i < nodes.size(); ++i)
+    {
+        profile.nodes.push_back({ nodes[i], i });
+        nodes_[nodes[i]] = { slots_[metric] - 1, i };
+    }
+}
+
+void Profiler::begin(MetricId metric)
+{
+    if (metric >= slots_.size() || slots_[metric] == 0)
+    {
+        return;
+    }
+    auto& profile = metrics_[slots_[metric] - 1];
+    if (profile.updates++ % sample_interval_ == 0)
+    {
+        profile.sampled_updates++;
+        active_ = true;
+    }
+}
+
+void Profiler::record(const InputNode& node, std::uint64_t cycles, std::size_t values_in,
+                      std::size_t values_out)
+{
+    auto it = nodes_.find(&node);
+    if (it == nodes_.end())
+    {
+        return;
+    }
+    auto [metric, index] = it->second;
+    auto& profile = metrics_[metric].nodes[index];
+    profile.cycles += cycles;
+    profile.values_in += values_in;
+    profile.values_out += values_out;
+}
+
+std::uint64_t Profiler::cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+#endif
+}
+
+std::vector<const Profiler::MetricProfile*> Profiler::top(std::size_t count) const
+{
+    std::vector<std::pair<double, const MetricProfile*>> by_cycles;
+    for (const auto& profile : metrics_)
+    {
+        by_cycles.emplace_back(profile.cycles(), &profile);
+    }
+    count = std::min(count, by_cycles.size());
+    std::partial_sort(by_cycles.begin(), by_cycles.begin() + count, by_cycles.end(),
+                      [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    std::vector<const MetricProfile*> result;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        result.push_back(by_cycles[i].second);
+    }
+    return result;
+}
+
+void Profiler::report(std::ostream& out, std::size_t count) const
+{
+    double total = 0;
+    std::uint64_t sampled_updates = 0;
+    for (const auto& profile : metrics_)
+    {
+        total += profile.cycles();
+        sampled_updates += profile.sampled_updates;
+    }
+    out << fmt::format("{:.4g} cycles estimated from {} sampled updates of {} combined metric(s), "
+                       "top {}:\n",
+                       total, sampled_updates, metrics_.size(), std::min(count, metrics_.size()));
+    out << fmt::format("{:>7}  {:>10}  {:>10}  {:>10}  {:>10}  {:>12}  {}\n", "share", "cycles",
+                       "updates", "values in", "values out", "cycles/value", "combined metric");
+
+    auto row = [&](double cycles, const std::string& updates, double values_in,
+                   double values_out, const std::string& name) {
+        out << fmt::format("{:>6.1f}%  {:>10.4g}  {:>10}  {:>10.4g}  {:>10.4g}  {:>12.4g}  {}\n",
+                           total > 0 ? 100 * cycles / total : 0., cycles, updates, values_in,
+                           values_out, values_in > 0 ? cycles / values_in : 0., name);
+    };
+
+    for (const auto* profile : top(count))
+    {
+        auto scale = profile->scale();
+        row(profile->cycles(), std::to_string(profile->updates),
+            static_cast<double>(profile->values_in), static_cast<double>(profile->values_out),
+            MetricIds::global().name(profile->metric));
+
+        std::vector<const NodeProfile*> nodes;
+        for (const auto& node : profile->nodes)
+        {
+            if (node.cycles > 0)
+            {
+                nodes.push_back(&node);
+            }
+        }
+        auto shown = std::min(nodes.size(), reported_nodes);
+        std::partial_sort(nodes.begin(), nodes.begin() + shown, nodes.end(),
+                          [](const auto* a, const auto* b) { return a->cycles > b->cycles; });
+        for (std::size_t i = 0; i < shown; ++i)
+        {
+            const auto& node = *nodes[i];
+            row(scale * node.cycles, "", scale * node.values_in, scale * node.values_out,
+                fmt::format("`-- node {} ({})", node.index, describe(*node.node)));
+        }
+    }
+}
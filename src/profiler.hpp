@@ -0,0 +1,203 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include "input_node.hpp"
+#include "metric_id.hpp"
+
+#include <cstdint>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Attributes the CPU time spent updating combined metrics to their nodes, to find the
+ * expressions responsible when the combinator saturates a core.
+ *
+ * Only every sample_interval-th update of each combined metric is measured, by reading the time
+ * stamp counter around the work each node does itself, i.e. after its inputs were updated.  The
+ * values a node took from its inputs and added to its output are counted in the same updates.
+ * Totals are estimated by scaling the samples with the number of updates, only the values in and
+ * out of each combined metric as a whole are counted in all updates, see count().  Whether an
+ * update is sampled is decided once by a Scope, nodes only check active(), i.e. a single global
+ * flag.  Without COMBINATOR_PROFILING, active() is constexpr false and all profiling is compiled
+ * out.
+ *
+ * Nodes may be measured concurrently by the threads of the WorkStealingPool, each node by one
+ * thread at a time, but Scopes, add(), clear() and report() must be used by a single thread.
+ */
+class Profiler
+{
+public:
+#ifdef COMBINATOR_PROFILING
+    static constexpr bool compiled = true;
+#else
+    static constexpr bool compiled = false;
+#endif
+
+    struct NodeProfile
+    {
+        const InputNode* node;
+        // Position in CombinedMetric::collect_nodes()
+        std::uint32_t index;
+        // Within sampled updates only
+        std::uint64_t cycles = 0;
+        std::uint64_t values_in = 0;
+        std::uint64_t values_out = 0;
+    };
+
+    struct MetricProfile
+    {
+        MetricId metric;
+        std::uint64_t updates = 0;
+        std::uint64_t sampled_updates = 0;
+        // Of all updates, see count()
+        std::uint64_t values_in = 0;
+        std::uint64_t values_out = 0;
+        std::vector<NodeProfile> nodes;
+
+        // Factor from the sampled updates to all updates
+        double scale() const
+        {
+            return sampled_updates == 0 ? 0. :
+                                          static_cast<double>(updates) / sampled_updates;
+        }
+
+        // Estimated cycles of all updates
+        double cycles() const;
+    };
+
+    static Profiler& global();
+
+    // Measure every sample_interval-th update of each combined metric, nothing if zero
+    void configure(std::uint32_t sample_interval);
+
+    // Forget all nodes and what was measured, e.g. before the configuration changes
+    void clear();
+    // Attribute the work of nodes, see CombinedMetric::collect_nodes(), to metric
+    void add(MetricId metric, const std::vector<const InputNode*>& nodes);
+
+    // Count values that arrived for and were sent by a combined metric
+    void count(MetricId metric, std::size_t values_in, std::size_t values_out)
+    {
+        if (metric < slots_.size() && slots_[metric] > 0)
+        {
+            auto& profile = metrics_[slots_[metric] - 1];
+            profile.values_in += values_in;
+            profile.values_out += values_out;
+        }
+    }
+
+    bool enabled() const
+    {
+        return compiled && sample_interval_ > 0;
+    }
+
+    static bool active()
+    {
+        return compiled && active_;
+    }
+
+    // Measures one update of a combined metric while it exists, if it is sampled
+    class Scope
+    {
+    public:
+        Scope(MetricId metric)
+        {
+            if (global().enabled())
+            {
+                global().begin(metric);
+            }
+        }
+
+        ~Scope()
+        {
+            active_ = false;
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    /*
+     * Measures the work of a node from its construction to its destruction, if active.
+     * queued_inputs and queued_outputs return the number of values queued in the inputs and the
+     * output(s) of the node, their differences are counted as values in and out.
+     */
+    template <typename QueuedInputs, typename QueuedOutputs>
+    class NodeScope
+    {
+    public:
+        NodeScope(const InputNode& node, QueuedInputs queued_inputs, QueuedOutputs queued_outputs)
+        : node_(node), queued_inputs_(queued_inputs), queued_outputs_(queued_outputs)
+        {
+            if (active())
+            {
+                inputs_ = queued_inputs_();
+                outputs_ = queued_outputs_();
+                start_ = cycles();
+            }
+        }
+
+        ~NodeScope()
+        {
+            if (active())
+            {
+                auto elapsed = cycles() - start_;
+                global().record(node_, elapsed, inputs_ - queued_inputs_(),
+                                queued_outputs_() - outputs_);
+            }
+        }
+
+        NodeScope(const NodeScope&) = delete;
+        NodeScope& operator=(const NodeScope&) = delete;
+
+    private:
+        const InputNode& node_;
+        QueuedInputs queued_inputs_;
+        QueuedOutputs queued_outputs_;
+        std::size_t inputs_ = 0;
+        std::size_t outputs_ = 0;
+        std::uint64_t start_ = 0;
+    };
+
+    // The time stamp counter, or a steady clock in nanoseconds where there is none
+    static std::uint64_t cycles();
+
+    // The combined metrics with the most estimated cycles, most expensive first
+    std::vector<const MetricProfile*> top(std::size_t count) const;
+
+    // Write a table of the top combined metrics with their most expensive nodes
+    void report(std::ostream& out, std::size_t count) const;
+
+private:
+    void begin(MetricId metric);
+    void record(const InputNode& node, std::uint64_t cycles, std::size_t values_in,
+                std::size_t values_out);
+
+    static inline bool active_ = false;
+
+    std::uint32_t sample_interval_ = 0;
+    std::vector<MetricProfile> metrics_;
+    // Index into metrics_ plus one by MetricId, zero for metrics that are not profiled
+    std::vector<std::uint32_t> slots_;
+    // Where each node is in metrics_, looked up in sampled updates only
+    std::unordered_map<const InputNode*, std::pair<std::uint32_t, std::uint32_t>> nodes_;
+};
@@ -0,0 +1,132 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "quantile_node.hpp"
+#include "profiler.hpp"
+#include "snapshot.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+QuantileNode::QuantileNode(std::vector<NodePtr<InputNode>> inputs, double quantile,
+                           JoinOptions options)
+: VariadicNode(std::move(inputs), options), quantile_(quantile)
+{
+    selection_.reserve(input_values().size());
+}
+
+metricq::Value QuantileNode::combine(const std::vector<metricq::Value>& input_values)
+{
+    assert(!input_values.empty());
+
+    // Select in a copy, so that input_values stays untouched
+    selection_.assign(input_values.begin(), input_values.end());
+
+    auto position = quantile_ * static_cast<double>(selection_.size() - 1);
+    auto lower_index = static_cast<std::size_t>(std::floor(position));
+    auto lower = selection_.begin() + lower_index;
+    std::nth_element(selection_.begin(), lower, selection_.end());
+
+    auto fraction = position - static_cast<double>(lower_index);
+    if (fraction == 0 || lower + 1 == selection_.end())
+    {
+        return *lower;
+    }
+
+    // After nth_element, the next larger value is the smallest one behind lower
+    auto upper = *std::min_element(lower + 1, selection_.end());
+    return *lower + fraction * (upper - *lower);
+}
+
+metricq::TimePoint WindowedQuantileNode::window_end(metricq::TimePoint time) const
+{
+    auto since_epoch = time.time_since_epoch().count();
+    auto window = window_.count();
+
+    // Round up, so that a value at the very end of a window belongs to it
+    auto windows = since_epoch / window;
+    if (since_epoch % window > 0)
+    {
+        windows++;
+    }
+    return metricq::TimePoint(metricq::TimePoint::duration(windows * window));
+}
+
+void WindowedQuantileNode::update()
+{
+    input_->update();
+
+    Profiler::NodeScope profile(
+        *this, [this] { return input_->queue_length(); }, [this] { return queue_length(); });
+
+    while (input_->has_input())
+    {
+        auto tv = input_->peek();
+        input_->discard();
+
+        auto end = window_end(tv.time);
+        if (end > current_window_end_)
+        {
+            if (current_window_values_ > 0)
+            {
+                put(metricq::TimeValue{ current_window_end_, sketch_.quantile(quantile_) });
+            }
+            sketch_.clear();
+            current_window_end_ = end;
+            current_window_values_ = 0;
+        }
+
+        current_window_values_++;
+        if (!std::isnan(tv.value))
+        {
+            sketch_.add(tv.value);
+        }
+    }
+}
+
+void WindowedQuantileNode::collect_metric_inputs(std::vector<MetricInputNode*>& inputs)
+{
+    input_->collect_metric_inputs(inputs);
+}
+
+void WindowedQuantileNode::collect_nodes(std::vector<const InputNode*>& nodes) const
+{
+    input_->collect_nodes(nodes);
+    nodes.push_back(this);
+}
+
+void WindowedQuantileNode::save_state(SnapshotWriter& writer) const
+{
+    InputQueue::save_state(writer);
+    writer.write(current_window_end_);
+    writer.write(static_cast<std::uint64_t>(current_window_values_));
+    sketch_.save_state(writer);
+    input_->save_state(writer);
+}
+
+void WindowedQuantileNode::restore_state(SnapshotReader& reader)
+{
+    InputQueue::restore_state(reader);
+    current_window_end_ = reader.read_time_point();
+    current_window_values_ = reader.read<std::uint64_t>();
+    sketch_.restore_state(reader);
+    input_->restore_state(reader);
+}
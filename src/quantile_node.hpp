@@ -0,0 +1,90 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include "input_node.hpp"
+#include "join_options.hpp"
+#include "kll_sketch.hpp"
+#include "variadic_node.hpp"
+
+#include <metricq/types.hpp>
+
+#include <memory>
+#include <vector>
+
+/**
+ * The q-quantile of the current values of all inputs, e.g. the median power consumption across
+ * a rack of nodes.  Like the other variadic nodes, NaN inputs are ignored.
+ *
+ * Between two input values, the quantile is linearly interpolated, i.e. the median of an even
+ * number of values is the mean of the two middle ones.
+ */
+class QuantileNode : public VariadicNode
+{
+public:
+    QuantileNode(std::vector<NodePtr<InputNode>> inputs, double quantile,
+                 JoinOptions options = {});
+
+private:
+    metricq::Value combine(const std::vector<metricq::Value>& input_values) override;
+
+private:
+    double quantile_;
+    std::vector<metricq::Value> selection_;
+};
+
+/**
+ * The approximate q-quantile of all values of its input within each window of time.
+ *
+ * Windows are aligned to multiples of the window duration since the epoch.  A value at time t
+ * belongs to the window (start, end] containing t, and the result for a window is produced at
+ * its end, once the first value of a later window arrives.  NaN values are ignored, a window
+ * that only contains NaN values results in NaN.
+ */
+class WindowedQuantileNode : public CalculationNode
+{
+public:
+    WindowedQuantileNode(NodePtr<InputNode> input, double quantile,
+                         metricq::Duration window)
+    : input_(std::move(input)), quantile_(quantile), window_(window)
+    {
+    }
+
+    void update() override;
+
+    void collect_metric_inputs(std::vector<MetricInputNode*>&) override;
+    void collect_nodes(std::vector<const InputNode*>&) const override;
+
+    void save_state(SnapshotWriter&) const override;
+    void restore_state(SnapshotReader&) override;
+
+private:
+    metricq::TimePoint window_end(metricq::TimePoint time) const;
+
+private:
+    NodePtr<InputNode> input_;
+    double quantile_;
+    metricq::Duration window_;
+
+    metricq::TimePoint current_window_end_ = Timestamp::genesis();
+    // Number of values in the current window, including NaNs
+    std::size_t current_window_values_ = 0;
+    KllSketch sketch_;
+};
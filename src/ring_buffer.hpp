@@ -0,0 +1,127 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/**
+ * A FIFO queue in a ring buffer that only ever grows.
+ *
+ * In contrast to std::deque, which allocates and frees a block every few elements as its front
+ * moves on, a queue that is filled and drained over and over stops allocating once it reached its
+ * largest size.  Elements must be default constructible.
+ */
+template <typename T>
+class RingBuffer
+{
+public:
+    void push_back(T value)
+    {
+        if (size_ == slots_.size())
+        {
+            grow();
+        }
+        slots_[(head_ + size_) & (slots_.size() - 1)] = std::move(value);
+        size_++;
+    }
+
+    T& front()
+    {
+        assert(size_ > 0);
+        return slots_[head_];
+    }
+
+    const T& front() const
+    {
+        assert(size_ > 0);
+        return slots_[head_];
+    }
+
+    void pop_front()
+    {
+        assert(size_ > 0);
+        head_ = (head_ + 1) & (slots_.size() - 1);
+        size_--;
+    }
+
+    const T& operator[](std::size_t index) const
+    {
+        return slots_[(head_ + index) & (slots_.size() - 1)];
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    // Call f(data, count) for each contiguous run of elements, from front to back
+    template <typename F>
+    void for_each_span(F&& f) const
+    {
+        if (size_ == 0)
+        {
+            return;
+        }
+        auto first = std::min(size_, slots_.size() - head_);
+        f(slots_.data() + head_, first);
+        if (first < size_)
+        {
+            f(slots_.data(), size_ - first);
+        }
+    }
+
+    std::size_t capacity() const
+    {
+        return slots_.size();
+    }
+
+    // Remove all elements, but keep the memory for new ones
+    void clear()
+    {
+        head_ = 0;
+        size_ = 0;
+    }
+
+private:
+    void grow()
+    {
+        // Power of two sizes, so that wrapping around is a mask instead of a division
+        std::vector<T> slots(std::max<std::size_t>(8, 2 * slots_.size()));
+        for (std::size_t i = 0; i < size_; ++i)
+        {
+            slots[i] = std::move(slots_[(head_ + i) & (slots_.size() - 1)]);
+        }
+        slots_ = std::move(slots);
+        head_ = 0;
+    }
+
+    std::vector<T> slots_;
+    std::size_t head_ = 0;
+    std::size_t size_ = 0;
+};
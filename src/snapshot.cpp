@@ -0,0 +1,232 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "snapshot.hpp"
+#include "fnv1a.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <system_error>
+#include <utility>
+
+namespace
+{
+constexpr char snapshot_magic[8] = { 'M', 'Q', 'C', 'O', 'M', 'B', 'S', 'N' };
+
+struct Header
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t entry_count;
+};
+
+[[noreturn]] void throw_errno(const std::string& what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+class FileDescriptor
+{
+public:
+    FileDescriptor(int fd) : fd_(fd)
+    {
+    }
+
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+    ~FileDescriptor()
+    {
+        if (fd_ >= 0)
+        {
+            ::close(fd_);
+        }
+    }
+
+    operator int() const
+    {
+        return fd_;
+    }
+
+private:
+    int fd_;
+};
+} // namespace
+
+Snapshot Snapshot::load(const std::string& path)
+{
+    FileDescriptor fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throw_errno("failed to open snapshot " + path);
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        throw_errno("failed to stat snapshot " + path);
+    }
+
+    auto size = static_cast<std::size_t>(st.st_size);
+    if (size < sizeof(Header))
+    {
+        throw SnapshotError("snapshot " + path + " is truncated");
+    }
+
+    void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        throw_errno("failed to map snapshot " + path);
+    }
+
+    return Snapshot(data, size);
+}
+
+Snapshot::Snapshot(void* data, std::size_t size) : data_(data), size_(size)
+{
+    try
+    {
+        auto begin = static_cast<const char*>(data_);
+        SnapshotReader reader(begin, begin + size_);
+
+        auto header = reader.read<Header>();
+        if (std::memcmp(header.magic, snapshot_magic, sizeof(snapshot_magic)) != 0)
+        {
+            throw SnapshotError("not a combinator snapshot");
+        }
+        if (header.version != version)
+        {
+            throw SnapshotError("unsupported snapshot version " + std::to_string(header.version));
+        }
+
+        for (std::uint32_t i = 0; i < header.entry_count; ++i)
+        {
+            auto name = reader.read_string();
+            auto fingerprint = reader.read<std::uint64_t>();
+            auto state_size = reader.read<std::uint64_t>();
+            auto state = reader.read_bytes(state_size);
+            entries_.emplace(std::move(name),
+                             MappedEntry{ fingerprint, state, state + state_size });
+        }
+    }
+    catch (...)
+    {
+        ::munmap(data_, size_);
+        throw;
+    }
+}
+
+Snapshot::Snapshot(Snapshot&& other) noexcept
+: data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)),
+  entries_(std::move(other.entries_))
+{
+}
+
+Snapshot& Snapshot::operator=(Snapshot&& other) noexcept
+{
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    std::swap(entries_, other.entries_);
+    return *this;
+}
+
+Snapshot::~Snapshot()
+{
+    if (data_ != nullptr)
+    {
+        ::munmap(data_, size_);
+    }
+}
+
+std::optional<SnapshotReader> Snapshot::find(const std::string& name,
+                                             std::uint64_t fingerprint) const
+{
+    auto it = entries_.find(name);
+    if (it == entries_.end() || it->second.fingerprint != fingerprint)
+    {
+        return std::nullopt;
+    }
+    return SnapshotReader(it->second.begin, it->second.end);
+}
+
+void Snapshot::write(const std::string& path, const std::vector<Entry>& entries)
+{
+    SnapshotWriter writer;
+    Header header;
+    std::memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+    header.version = version;
+    header.entry_count = static_cast<std::uint32_t>(entries.size());
+    writer.write(header);
+
+    for (const auto& entry : entries)
+    {
+        writer.write(entry.name);
+        writer.write(entry.fingerprint);
+        writer.write(static_cast<std::uint64_t>(entry.state.size()));
+        writer.write_bytes(entry.state);
+    }
+
+    const auto& buffer = writer.buffer();
+
+    // Write to a temporary file first and rename it afterwards, so that a crash while writing
+    // never leaves us with a half-written snapshot.
+    auto tmp_path = path + ".tmp";
+    {
+        FileDescriptor fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            throw_errno("failed to create snapshot " + tmp_path);
+        }
+        if (::ftruncate(fd, buffer.size()) != 0)
+        {
+            throw_errno("failed to resize snapshot " + tmp_path);
+        }
+
+        void* data = ::mmap(nullptr, buffer.size(), PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            throw_errno("failed to map snapshot " + tmp_path);
+        }
+        std::memcpy(data, buffer.data(), buffer.size());
+        auto sync_result = ::msync(data, buffer.size(), MS_SYNC);
+        ::munmap(data, buffer.size());
+        if (sync_result != 0)
+        {
+            throw_errno("failed to sync snapshot " + tmp_path);
+        }
+    }
+
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        throw_errno("failed to replace snapshot " + path);
+    }
+}
+
+std::uint64_t Snapshot::fingerprint(const metricq::json& expression)
+{
+    // Object keys are sorted by the json implementation, so the serialization is canonical and
+    // equal expressions always produce equal fingerprints.
+    return fnv1a(expression.dump());
+}
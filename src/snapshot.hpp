@@ -0,0 +1,222 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <metricq/json.hpp>
+#include <metricq/types.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+class SnapshotError : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * Serializes the state of a node tree into a flat binary buffer.
+ *
+ * Values are stored in native byte order; snapshots are only meant to be read back by the same
+ * build on the same host.
+ */
+class SnapshotWriter
+{
+public:
+    template <typename T>
+    void write(const T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        auto offset = buffer_.size();
+        buffer_.resize(offset + sizeof(T));
+        std::memcpy(buffer_.data() + offset, &value, sizeof(T));
+    }
+
+    void write(metricq::TimePoint time)
+    {
+        write(time.time_since_epoch().count());
+    }
+
+    void write(metricq::TimeValue tv)
+    {
+        write(tv.time);
+        write(tv.value);
+    }
+
+    void write(const std::optional<metricq::TimeValue>& tv)
+    {
+        write(tv.has_value());
+        if (tv)
+        {
+            write(*tv);
+        }
+    }
+
+    void write(const std::string& str)
+    {
+        write(static_cast<std::uint32_t>(str.size()));
+        buffer_.insert(buffer_.end(), str.begin(), str.end());
+    }
+
+    void write_bytes(const std::vector<char>& bytes)
+    {
+        buffer_.insert(buffer_.end(), bytes.begin(), bytes.end());
+    }
+
+    const std::vector<char>& buffer() const
+    {
+        return buffer_;
+    }
+
+private:
+    std::vector<char> buffer_;
+};
+
+/**
+ * Reads back state written by a SnapshotWriter, usually straight from a mapped snapshot file.
+ */
+class SnapshotReader
+{
+public:
+    SnapshotReader(const char* begin, const char* end) : pos_(begin), end_(end)
+    {
+    }
+
+    template <typename T>
+    T read()
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T value;
+        std::memcpy(&value, consume(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    metricq::TimePoint read_time_point()
+    {
+        using duration = metricq::TimePoint::duration;
+        return metricq::TimePoint(duration(read<duration::rep>()));
+    }
+
+    metricq::TimeValue read_time_value()
+    {
+        auto time = read_time_point();
+        return { time, read<metricq::Value>() };
+    }
+
+    std::optional<metricq::TimeValue> read_optional_time_value()
+    {
+        if (read<bool>())
+        {
+            return read_time_value();
+        }
+        return std::nullopt;
+    }
+
+    std::string read_string()
+    {
+        auto size = read<std::uint32_t>();
+        return std::string(consume(size), size);
+    }
+
+    const char* read_bytes(std::size_t size)
+    {
+        return consume(size);
+    }
+
+    bool at_end() const
+    {
+        return pos_ == end_;
+    }
+
+private:
+    const char* consume(std::size_t size)
+    {
+        if (static_cast<std::size_t>(end_ - pos_) < size)
+        {
+            throw SnapshotError("snapshot is truncated");
+        }
+        auto begin = pos_;
+        pos_ += size;
+        return begin;
+    }
+
+private:
+    const char* pos_;
+    const char* end_;
+};
+
+/**
+ * A memory-mapped snapshot file containing the node state of several combined metrics.
+ *
+ * Each entry is tagged with the fingerprint of the expression it was taken from, so state is only
+ * restored into a combined metric whose configuration did not change in the meantime.
+ */
+class Snapshot
+{
+public:
+    // Bumped whenever the serialized state of a node type changes.  Snapshots of other versions
+    // are not loaded, so all combined metrics start cold instead of restoring garbage.
+    static constexpr std::uint32_t version = 4;
+
+    struct Entry
+    {
+        std::string name;
+        std::uint64_t fingerprint;
+        std::vector<char> state;
+    };
+
+    static Snapshot load(const std::string& path);
+    static void write(const std::string& path, const std::vector<Entry>& entries);
+
+    static std::uint64_t fingerprint(const metricq::json& expression);
+
+    Snapshot(Snapshot&&) noexcept;
+    Snapshot& operator=(Snapshot&&) noexcept;
+    ~Snapshot();
+
+    // Returns a reader for the state of a combined metric, or nothing if there is no state for
+    // this metric or it was taken from a different expression.
+    std::optional<SnapshotReader> find(const std::string& name, std::uint64_t fingerprint) const;
+
+    std::size_t size() const
+    {
+        return entries_.size();
+    }
+
+private:
+    Snapshot(void* data, std::size_t size);
+
+    struct MappedEntry
+    {
+        std::uint64_t fingerprint;
+        const char* begin;
+        const char* end;
+    };
+
+    void* data_ = nullptr;
+    std::size_t size_ = 0;
+    std::unordered_map<std::string, MappedEntry> entries_;
+};
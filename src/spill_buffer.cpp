@@ -0,0 +1,206 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "spill_buffer.hpp"
+
+#include <metricq/logger/nitro.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <filesystem>
+#include <system_error>
+
+using Log = metricq::logger::nitro::Log;
+
+namespace
+{
+[[noreturn]] void throw_errno(const std::string& what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+} // namespace
+
+SpillLog::SpillLog(const std::string& directory, std::size_t segment_records)
+: directory_(directory), segment_records_(segment_records)
+{
+    assert(segment_records_ > 0);
+    std::filesystem::create_directories(directory_);
+
+    // Segments of a previous run cannot be attributed to metrics anymore, get rid of them.
+    for (const auto& entry : std::filesystem::directory_iterator(directory_))
+    {
+        if (entry.path().extension() == ".spill")
+        {
+            Log::warn() << "Removing stale spill segment " << entry.path().string();
+            std::filesystem::remove(entry.path());
+        }
+    }
+}
+
+SpillLog::~SpillLog()
+{
+    for (auto& segment : segments_)
+    {
+        close_segment(segment);
+    }
+}
+
+void SpillLog::open_segment()
+{
+    auto path = directory_ + "/" + std::to_string(next_segment_++) + ".spill";
+    auto bytes = segment_records_ * sizeof(Record);
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        throw_errno("failed to create spill segment " + path);
+    }
+    if (::ftruncate(fd, bytes) != 0)
+    {
+        ::close(fd);
+        throw_errno("failed to resize spill segment " + path);
+    }
+    void* data = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        throw_errno("failed to map spill segment " + path);
+    }
+
+    segments_.push_back({ path, static_cast<Record*>(data), 0, 0 });
+}
+
+void SpillLog::close_segment(Segment& segment)
+{
+    ::munmap(segment.records, segment_records_ * sizeof(Record));
+    std::remove(segment.path.c_str());
+}
+
+void SpillLog::push(const Record& record)
+{
+    if (segments_.empty() || segments_.back().write_pos == segment_records_)
+    {
+        open_segment();
+    }
+    auto& tail = segments_.back();
+    tail.records[tail.write_pos++] = record;
+    size_++;
+}
+
+const SpillLog::Record& SpillLog::front() const
+{
+    assert(!empty());
+    const auto& head = segments_.front();
+    return head.records[head.read_pos];
+}
+
+void SpillLog::pop()
+{
+    assert(!empty());
+    auto& head = segments_.front();
+    head.read_pos++;
+    size_--;
+
+    // Drop the segment once everything has been read back, either because it is full or because
+    // it is the last one and we caught up with writing.
+    if (head.read_pos == segment_records_ || head.read_pos == head.write_pos)
+    {
+        close_segment(head);
+        segments_.pop_front();
+    }
+}
+
+SpillBuffer::SpillBuffer(OutputSink& sink, const std::string& directory,
+                         std::size_t memory_limit, std::size_t segment_records)
+: sink_(sink), memory_limit_(memory_limit), log_(directory, segment_records)
+{
+}
+
+std::uint32_t SpillBuffer::metric_id(const std::string& metric)
+{
+    auto [it, inserted] = metric_ids_.try_emplace(metric, metric_names_.size());
+    if (inserted)
+    {
+        metric_names_.push_back(metric);
+    }
+    return it->second;
+}
+
+void SpillBuffer::send(std::uint32_t metric, metricq::TimeValue tv)
+{
+    if (memory_.empty() && log_.empty() && sink_.output_ready())
+    {
+        sink_.output(metric_names_[metric], tv);
+        return;
+    }
+
+    SpillLog::Record record{ metric, 0, tv.time.time_since_epoch().count(), tv.value };
+
+    // Once values went to disk, all later values have to follow them there to keep the order.
+    if (log_.empty() && (memory_.size() + 1) * sizeof(SpillLog::Record) <= memory_limit_)
+    {
+        memory_.push_back(record);
+    }
+    else
+    {
+        log_.push(record);
+        spilled_bytes_ += sizeof(SpillLog::Record);
+    }
+}
+
+void SpillBuffer::drain()
+{
+    using duration = metricq::TimePoint::duration;
+
+    while (sink_.output_ready())
+    {
+        const SpillLog::Record* record;
+        if (!memory_.empty())
+        {
+            record = &memory_.front();
+        }
+        else if (!log_.empty())
+        {
+            record = &log_.front();
+        }
+        else
+        {
+            return;
+        }
+
+        sink_.output(metric_names_[record->metric],
+                     { metricq::TimePoint(duration(record->time)), record->value });
+
+        if (!memory_.empty())
+        {
+            memory_.pop_front();
+        }
+        else
+        {
+            log_.pop();
+        }
+    }
+}
@@ -0,0 +1,138 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <metricq/types.hpp>
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * The receiving end of combined metric values, i.e. the connection to the broker.
+ */
+struct OutputSink
+{
+    virtual ~OutputSink() = default;
+
+    // Whether values can currently be handed to output() without piling up.
+    virtual bool output_ready() const = 0;
+    virtual void output(const std::string& metric, metricq::TimeValue tv) = 0;
+};
+
+/**
+ * An append-only log of output values on disk, split into fixed-size, memory-mapped segment
+ * files.  Segments are deleted as soon as all their values have been read back.
+ */
+class SpillLog
+{
+public:
+    struct Record
+    {
+        std::uint32_t metric;
+        std::uint32_t reserved;
+        metricq::TimePoint::duration::rep time;
+        metricq::Value value;
+    };
+
+    SpillLog(const std::string& directory, std::size_t segment_records);
+    SpillLog(const SpillLog&) = delete;
+    SpillLog& operator=(const SpillLog&) = delete;
+    ~SpillLog();
+
+    void push(const Record& record);
+    const Record& front() const;
+    void pop();
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+private:
+    struct Segment
+    {
+        std::string path;
+        Record* records;
+        std::size_t write_pos;
+        std::size_t read_pos;
+    };
+
+    void open_segment();
+    void close_segment(Segment& segment);
+
+private:
+    std::string directory_;
+    std::size_t segment_records_;
+    std::uint64_t next_segment_ = 0;
+    std::deque<Segment> segments_;
+    std::size_t size_ = 0;
+};
+
+/**
+ * Buffers output values while the sink is not ready to accept them.
+ *
+ * Up to memory_limit bytes of values are kept in memory, everything beyond that is appended to
+ * a SpillLog.  Values are always handed to the sink in the order they were sent.
+ */
+class SpillBuffer
+{
+public:
+    static constexpr std::size_t default_segment_records = 1 << 16;
+
+    SpillBuffer(OutputSink& sink, const std::string& directory, std::size_t memory_limit,
+                std::size_t segment_records = default_segment_records);
+
+    std::uint32_t metric_id(const std::string& metric);
+
+    void send(std::uint32_t metric, metricq::TimeValue tv);
+
+    // Hand as many buffered values to the sink as it is ready to accept.
+    void drain();
+
+    // Total number of bytes ever written to disk
+    std::uint64_t spilled_bytes() const
+    {
+        return spilled_bytes_;
+    }
+
+    // Number of bytes currently waiting to be sent, in memory or on disk
+    std::size_t pending_bytes() const
+    {
+        return (memory_.size() + log_.size()) * sizeof(SpillLog::Record);
+    }
+
+private:
+    OutputSink& sink_;
+    std::size_t memory_limit_;
+    std::deque<SpillLog::Record> memory_;
+    SpillLog log_;
+    std::uint64_t spilled_bytes_ = 0;
+
+    std::vector<std::string> metric_names_;
+    std::unordered_map<std::string, std::uint32_t> metric_ids_;
+};
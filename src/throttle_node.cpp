@@ -19,11 +19,16 @@
 // along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "throttle_node.hpp"
+#include "profiler.hpp"
+#include "snapshot.hpp"
 
 void ThrottleNode::update()
 {
     input_->update();
 
+    Profiler::NodeScope profile(
+        *this, [this] { return input_->queue_length(); }, [this] { return queue_length(); });
+
     while (input_->has_input())
     {
         auto tv = input_->peek();
@@ -37,7 +42,27 @@ void ThrottleNode::update()
     }
 }
 
-void ThrottleNode::collect_metric_inputs(MetricInputNodesByName& inputs)
+void ThrottleNode::collect_metric_inputs(std::vector<MetricInputNode*>& inputs)
 {
     return input_->collect_metric_inputs(inputs);
 }
+
+void ThrottleNode::collect_nodes(std::vector<const InputNode*>& nodes) const
+{
+    input_->collect_nodes(nodes);
+    nodes.push_back(this);
+}
+
+void ThrottleNode::save_state(SnapshotWriter& writer) const
+{
+    InputQueue::save_state(writer);
+    writer.write(last_time_point_);
+    input_->save_state(writer);
+}
+
+void ThrottleNode::restore_state(SnapshotReader& reader)
+{
+    InputQueue::restore_state(reader);
+    last_time_point_ = reader.read_time_point();
+    input_->restore_state(reader);
+}
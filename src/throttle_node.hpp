@@ -28,17 +28,21 @@
 struct ThrottleNode : CalculationNode
 {
 public:
-    ThrottleNode(std::unique_ptr<InputNode> input, metricq::Duration cooldown_period)
+    ThrottleNode(NodePtr<InputNode> input, metricq::Duration cooldown_period)
     : input_(std::move(input)), cooldown_period_(cooldown_period)
     {
     }
 
     void update() override;
 
-    void collect_metric_inputs(MetricInputNodesByName&) override;
+    void collect_metric_inputs(std::vector<MetricInputNode*>&) override;
+    void collect_nodes(std::vector<const InputNode*>&) const override;
+
+    void save_state(SnapshotWriter&) const override;
+    void restore_state(SnapshotReader&) override;
 
 private:
-    std::unique_ptr<InputNode> input_;
+    NodePtr<InputNode> input_;
     metricq::Duration cooldown_period_;
     metricq::TimePoint last_time_point_ = Timestamp::genesis();
 };
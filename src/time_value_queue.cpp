@@ -0,0 +1,383 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "time_value_queue.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace
+{
+class BitWriter
+{
+public:
+    BitWriter(std::vector<std::uint64_t>& words) : words_(words)
+    {
+    }
+
+    // Append the lowest `count` bits of `bits`, most significant first
+    void write(std::uint64_t bits, unsigned count)
+    {
+        assert(count <= 64);
+        while (count > 0)
+        {
+            if (used_ == 64 || words_.empty())
+            {
+                words_.push_back(0);
+                used_ = 0;
+            }
+            unsigned chunk = std::min(count, 64 - used_);
+            std::uint64_t part = (bits >> (count - chunk)) & mask(chunk);
+            words_.back() |= part << (64 - used_ - chunk);
+            used_ += chunk;
+            count -= chunk;
+        }
+    }
+
+private:
+    static std::uint64_t mask(unsigned count)
+    {
+        return count == 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << count) - 1;
+    }
+
+    std::vector<std::uint64_t>& words_;
+    unsigned used_ = 64;
+};
+
+class BitReader
+{
+public:
+    BitReader(const std::vector<std::uint64_t>& words) : words_(words)
+    {
+    }
+
+    std::uint64_t read(unsigned count)
+    {
+        assert(count <= 64);
+        std::uint64_t result = 0;
+        while (count > 0)
+        {
+            unsigned chunk = std::min(count, 64 - used_);
+            std::uint64_t word = words_[index_];
+            std::uint64_t part = (word << used_) >> (64 - chunk);
+            result = chunk == 64 ? part : (result << chunk) | part;
+            used_ += chunk;
+            count -= chunk;
+            if (used_ == 64)
+            {
+                index_++;
+                used_ = 0;
+            }
+        }
+        return result;
+    }
+
+    bool read_bit()
+    {
+        return read(1) != 0;
+    }
+
+private:
+    const std::vector<std::uint64_t>& words_;
+    std::size_t index_ = 0;
+    unsigned used_ = 0;
+};
+
+std::uint64_t zigzag(std::int64_t n)
+{
+    return (static_cast<std::uint64_t>(n) << 1) ^ static_cast<std::uint64_t>(n >> 63);
+}
+
+std::int64_t unzigzag(std::uint64_t n)
+{
+    return static_cast<std::int64_t>(n >> 1) ^ -static_cast<std::int64_t>(n & 1);
+}
+
+std::uint64_t value_bits(metricq::Value value)
+{
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+metricq::Value bits_value(std::uint64_t bits)
+{
+    metricq::Value value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+unsigned leading_zeros(std::uint64_t x)
+{
+    return x == 0 ? 64 : __builtin_clzll(x);
+}
+
+unsigned trailing_zeros(std::uint64_t x)
+{
+    return x == 0 ? 64 : __builtin_ctzll(x);
+}
+
+// Delta-of-delta buckets for nanosecond timestamps, prefixes are 0, 10, 110, 1110 and 1111.
+constexpr unsigned dod_bucket_bits[] = { 10, 17, 32 };
+} // namespace
+
+CompressedBlock::CompressedBlock(const std::vector<metricq::TimeValue>& values)
+: size_(values.size())
+{
+    BitWriter writer(words_);
+    if (values.empty())
+    {
+        return;
+    }
+
+    // Unsigned arithmetic, so that differences wrap around instead of overflowing
+    auto prev_time = static_cast<std::uint64_t>(values.front().time.time_since_epoch().count());
+    std::uint64_t prev_delta = 0;
+    std::uint64_t prev_value = value_bits(values.front().value);
+    unsigned prev_leading = 65;
+    unsigned prev_trailing = 0;
+
+    writer.write(prev_time, 64);
+    writer.write(prev_value, 64);
+
+    for (std::size_t i = 1; i < values.size(); ++i)
+    {
+        auto time = static_cast<std::uint64_t>(values[i].time.time_since_epoch().count());
+        std::uint64_t delta = time - prev_time;
+        std::uint64_t dod = zigzag(static_cast<std::int64_t>(delta - prev_delta));
+        prev_time = time;
+        prev_delta = delta;
+
+        if (dod == 0)
+        {
+            writer.write(0b0, 1);
+        }
+        else if (dod < (std::uint64_t(1) << dod_bucket_bits[0]))
+        {
+            writer.write(0b10, 2);
+            writer.write(dod, dod_bucket_bits[0]);
+        }
+        else if (dod < (std::uint64_t(1) << dod_bucket_bits[1]))
+        {
+            writer.write(0b110, 3);
+            writer.write(dod, dod_bucket_bits[1]);
+        }
+        else if (dod < (std::uint64_t(1) << dod_bucket_bits[2]))
+        {
+            writer.write(0b1110, 4);
+            writer.write(dod, dod_bucket_bits[2]);
+        }
+        else
+        {
+            writer.write(0b1111, 4);
+            writer.write(dod, 64);
+        }
+
+        std::uint64_t value = value_bits(values[i].value);
+        std::uint64_t xored = value ^ prev_value;
+        prev_value = value;
+
+        if (xored == 0)
+        {
+            writer.write(0b0, 1);
+            continue;
+        }
+
+        unsigned leading = std::min(leading_zeros(xored), 31u);
+        unsigned trailing = trailing_zeros(xored);
+        if (prev_leading <= 64 && leading >= prev_leading && trailing >= prev_trailing)
+        {
+            // The meaningful bits fit into the window of the previous value
+            writer.write(0b10, 2);
+            writer.write(xored >> prev_trailing, 64 - prev_leading - prev_trailing);
+        }
+        else
+        {
+            unsigned meaningful = 64 - leading - trailing;
+            writer.write(0b11, 2);
+            writer.write(leading, 5);
+            // meaningful is within [1, 64], store 64 as 0
+            writer.write(meaningful & 63, 6);
+            writer.write(xored >> trailing, meaningful);
+            prev_leading = leading;
+            prev_trailing = trailing;
+        }
+    }
+
+    words_.shrink_to_fit();
+}
+
+void CompressedBlock::decode(RingBuffer<metricq::TimeValue>& out) const
+{
+    using duration = metricq::TimePoint::duration;
+
+    if (size_ == 0)
+    {
+        return;
+    }
+
+    BitReader reader(words_);
+    std::uint64_t time = reader.read(64);
+    std::uint64_t delta = 0;
+    std::uint64_t value = reader.read(64);
+    unsigned leading = 0;
+    unsigned trailing = 0;
+
+    out.push_back({ metricq::TimePoint(duration(static_cast<duration::rep>(time))),
+                    bits_value(value) });
+
+    for (std::size_t i = 1; i < size_; ++i)
+    {
+        if (reader.read_bit())
+        {
+            unsigned bits;
+            if (!reader.read_bit())
+            {
+                bits = dod_bucket_bits[0];
+            }
+            else if (!reader.read_bit())
+            {
+                bits = dod_bucket_bits[1];
+            }
+            else if (!reader.read_bit())
+            {
+                bits = dod_bucket_bits[2];
+            }
+            else
+            {
+                bits = 64;
+            }
+            delta += static_cast<std::uint64_t>(unzigzag(reader.read(bits)));
+        }
+        time += delta;
+
+        if (reader.read_bit())
+        {
+            if (reader.read_bit())
+            {
+                leading = static_cast<unsigned>(reader.read(5));
+                unsigned meaningful = static_cast<unsigned>(reader.read(6));
+                if (meaningful == 0)
+                {
+                    meaningful = 64;
+                }
+                trailing = 64 - leading - meaningful;
+            }
+            value ^= reader.read(64 - leading - trailing) << trailing;
+        }
+
+        out.push_back({ metricq::TimePoint(duration(static_cast<duration::rep>(time))),
+                        bits_value(value) });
+    }
+}
+
+void TimeValueQueue::push_back(metricq::TimeValue tv)
+{
+    size_++;
+    if (backlog_empty() && inline_size_ < inline_capacity)
+    {
+        inline_[(inline_head_ + inline_size_) % inline_capacity] = tv;
+        inline_size_++;
+        return;
+    }
+
+    if (!backlog_)
+    {
+        backlog_ = std::make_unique<Backlog>();
+    }
+    auto& [plain, blocks, pending] = *backlog_;
+    // Even below the inline capacity, the first value of the backlog goes to plain
+    if (plain.empty() ||
+        (blocks.empty() && pending.empty() && inline_size_ + plain.size() < compression_threshold_))
+    {
+        plain.push_back(tv);
+        return;
+    }
+
+    pending.push_back(tv);
+    if (pending.size() == block_size)
+    {
+        blocks.emplace_back(pending);
+        pending.clear();
+    }
+}
+
+void TimeValueQueue::pop_front()
+{
+    size_--;
+    if (inline_size_ > 0)
+    {
+        inline_head_ = (inline_head_ + 1) % inline_capacity;
+        inline_size_--;
+        return;
+    }
+
+    auto& [plain, blocks, pending] = *backlog_;
+    assert(!plain.empty());
+    plain.pop_front();
+
+    if (plain.empty())
+    {
+        refill_plain();
+    }
+}
+
+void TimeValueQueue::refill_plain()
+{
+    auto& [plain, blocks, pending] = *backlog_;
+    if (!blocks.empty())
+    {
+        blocks.front().decode(plain);
+        blocks.pop_front();
+    }
+    else
+    {
+        for (auto tv : pending)
+        {
+            plain.push_back(tv);
+        }
+        pending.clear();
+    }
+}
+
+void TimeValueQueue::clear()
+{
+    inline_head_ = 0;
+    inline_size_ = 0;
+    backlog_.reset();
+    size_ = 0;
+}
+
+std::size_t TimeValueQueue::memory_bytes() const
+{
+    std::size_t bytes = inline_size_ * sizeof(metricq::TimeValue);
+    if (!backlog_)
+    {
+        return bytes;
+    }
+    bytes +=
+        (backlog_->plain.capacity() + backlog_->pending.capacity()) * sizeof(metricq::TimeValue);
+    for (const auto& block : backlog_->blocks)
+    {
+        bytes += sizeof(CompressedBlock) + block.memory_bytes();
+    }
+    return bytes;
+}
@@ -0,0 +1,189 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include "ring_buffer.hpp"
+
+#include <metricq/types.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+/**
+ * A block of TimeValues compressed like in Facebook's Gorilla TSDB: timestamps are stored as
+ * delta-of-deltas, values as XOR with their predecessor.  Both are lossless.
+ */
+class CompressedBlock
+{
+public:
+    CompressedBlock(const std::vector<metricq::TimeValue>& values);
+
+    // Append all values of this block to out
+    void decode(RingBuffer<metricq::TimeValue>& out) const;
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    std::size_t memory_bytes() const
+    {
+        return words_.capacity() * sizeof(std::uint64_t);
+    }
+
+private:
+    std::vector<std::uint64_t> words_;
+    std::size_t size_;
+};
+
+/**
+ * A FIFO queue of TimeValues that compresses its backlog.
+ *
+ * The first compression_threshold values are kept as they are, so short queues behave exactly like
+ * a FIFO.  Values beyond that are collected into blocks of block_size values, which are
+ * compressed once full and only decompressed again when the front of the queue reaches them.
+ *
+ * The first few values are stored inline, all others in a backlog that is only allocated once a
+ * queue grows beyond that.  Short queues thus live entirely in the node that owns them, so nodes
+ * placed next to each other, see NodeArena, also have their queued values next to each other.
+ */
+class TimeValueQueue
+{
+public:
+    static constexpr std::size_t block_size = 1024;
+    static constexpr std::size_t default_compression_threshold = 4 * block_size;
+    static constexpr std::size_t inline_capacity = 4;
+
+    TimeValueQueue(std::size_t compression_threshold = default_compression_threshold)
+    : compression_threshold_(compression_threshold)
+    {
+    }
+
+    void push_back(metricq::TimeValue tv);
+
+    metricq::TimeValue front() const
+    {
+        return inline_size_ > 0 ? inline_[inline_head_] : backlog_->plain.front();
+    }
+
+    void pop_front();
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    void clear();
+
+    // Remove all queued values, handing them to f(const TimeValue* data, std::size_t count) in
+    // order, in as few contiguous runs as they are stored in.  Keeps the memory for new values.
+    template <typename F>
+    void drain(F&& f)
+    {
+        auto inline_first = std::min<std::size_t>(inline_size_, inline_capacity - inline_head_);
+        if (inline_first > 0)
+        {
+            f(inline_.data() + inline_head_, inline_first);
+        }
+        if (inline_first < inline_size_)
+        {
+            f(inline_.data(), inline_size_ - inline_first);
+        }
+        inline_head_ = 0;
+        inline_size_ = 0;
+
+        while (!backlog_empty())
+        {
+            backlog_->plain.for_each_span(f);
+            backlog_->plain.clear();
+            refill_plain();
+        }
+        size_ = 0;
+    }
+
+    // Approximate number of bytes used to store the queued values
+    std::size_t memory_bytes() const;
+
+    // Visit all queued values in order, without removing them
+    template <typename F>
+    void for_each(F&& f) const
+    {
+        for (std::size_t i = 0; i < inline_size_; ++i)
+        {
+            f(inline_[(inline_head_ + i) % inline_capacity]);
+        }
+        if (!backlog_)
+        {
+            return;
+        }
+        for (std::size_t i = 0; i < backlog_->plain.size(); ++i)
+        {
+            f(backlog_->plain[i]);
+        }
+        RingBuffer<metricq::TimeValue> decoded;
+        for (const auto& block : backlog_->blocks)
+        {
+            decoded.clear();
+            block.decode(decoded);
+            for (std::size_t i = 0; i < decoded.size(); ++i)
+            {
+                f(decoded[i]);
+            }
+        }
+        for (auto tv : backlog_->pending)
+        {
+            f(tv);
+        }
+    }
+
+private:
+    // Move the next values of the backlog to plain once it ran empty
+    void refill_plain();
+
+    bool backlog_empty() const
+    {
+        return !backlog_ || backlog_->plain.empty();
+    }
+
+    // Invariant: plain is only empty if blocks and pending are empty
+    struct Backlog
+    {
+        RingBuffer<metricq::TimeValue> plain;
+        std::deque<CompressedBlock> blocks;
+        std::vector<metricq::TimeValue> pending;
+    };
+
+    // Invariant: values are only appended inline if the backlog is empty
+    std::array<metricq::TimeValue, inline_capacity> inline_;
+    std::uint8_t inline_head_ = 0;
+    std::uint8_t inline_size_ = 0;
+    std::unique_ptr<Backlog> backlog_;
+    std::size_t size_ = 0;
+    std::size_t compression_threshold_;
+};
@@ -0,0 +1,132 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#include "tracer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+namespace
+{
+constexpr char magic[8] = { 'M', 'Q', 'T', 'R', 'A', 'C', 'E', '1' };
+} // namespace
+
+Tracer& Tracer::global()
+{
+    static Tracer tracer;
+    return tracer;
+}
+
+void Tracer::configure(std::size_t capacity, std::uint32_t sample_interval)
+{
+    events_.assign(std::max<std::size_t>(capacity, 1), TraceEvent{});
+    recorded_ = 0;
+    sample_interval_ = std::max<std::uint32_t>(sample_interval, 1);
+    selected_.clear();
+    steps_.clear();
+}
+
+void Tracer::select(MetricId metric)
+{
+    if (metric >= selected_.size())
+    {
+        selected_.resize(metric + 1, false);
+        steps_.resize(metric + 1, 0);
+    }
+    selected_[metric] = true;
+}
+
+void Tracer::begin(MetricId metric, bool ends_step)
+{
+    if (metric >= selected_.size() || !selected_[metric])
+    {
+        return;
+    }
+    if (steps_[metric] % sample_interval_ == 0)
+    {
+        current_ = metric;
+        active_ = true;
+    }
+    if (ends_step)
+    {
+        steps_[metric]++;
+    }
+}
+
+void Tracer::record(TraceEventKind kind, const void* node, metricq::TimePoint time,
+                    std::uint32_t count0, std::uint32_t count1, std::uint32_t count2,
+                    std::uint32_t count3)
+{
+    auto clock = std::chrono::steady_clock::now().time_since_epoch();
+    auto index = recorded_.fetch_add(1, std::memory_order_relaxed) % events_.size();
+    events_[index] = {
+        std::chrono::duration_cast<std::chrono::nanoseconds>(clock).count(),
+        time.time_since_epoch().count(),
+        reinterpret_cast<std::uint64_t>(node),
+        current_,
+        kind,
+        { count0, count1, count2, count3 },
+    };
+}
+
+std::size_t Tracer::size() const
+{
+    return std::min<std::size_t>(recorded_.load(), events_.size());
+}
+
+void Tracer::dump(const std::string& path) const
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        throw TraceError("failed to create " + path);
+    }
+
+    std::uint64_t count = size();
+    file.write(magic, sizeof(magic));
+    file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    for_each([&file](const TraceEvent& event) {
+        file.write(reinterpret_cast<const char*>(&event), sizeof(event));
+    });
+
+    std::vector<MetricId> selected;
+    for (MetricId id = 0; id < selected_.size(); ++id)
+    {
+        if (selected_[id])
+        {
+            selected.push_back(id);
+        }
+    }
+    std::uint64_t names = selected.size();
+    file.write(reinterpret_cast<const char*>(&names), sizeof(names));
+    for (auto id : selected)
+    {
+        const auto& name = MetricIds::global().name(id);
+        std::uint32_t length = name.size();
+        file.write(reinterpret_cast<const char*>(&id), sizeof(id));
+        file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        file.write(name.data(), length);
+    }
+
+    if (!file.flush())
+    {
+        throw TraceError("failed to write " + path);
+    }
+}
@@ -0,0 +1,165 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include "metric_id.hpp"
+
+#include <metricq/types.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+class TraceError : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+enum class TraceEventKind : std::uint32_t
+{
+    // Values arrived for an input node; counts: values, queue length afterwards
+    input = 1,
+    // A combined metric was updated; counts: values sent, microseconds it waited for the update
+    update = 2,
+    // A binary node was updated; counts: queue lengths of left, right and output
+    binary = 3,
+    // A variadic node was updated; counts: inputs without a value, inputs holding one, output
+    // queue length
+    variadic = 4,
+};
+
+struct TraceEvent
+{
+    // Steady clock, in nanoseconds
+    std::int64_t clock;
+    // Time of the last value involved, in nanoseconds since the epoch
+    std::int64_t time;
+    // Address of the node, to tell apart the nodes of one combined metric
+    std::uint64_t node;
+    MetricId metric;
+    TraceEventKind kind;
+    std::uint32_t counts[4];
+};
+
+static_assert(sizeof(TraceEvent) == 48, "trace files rely on the layout of TraceEvent");
+
+/**
+ * Records structured events about the evaluation of selected combined metrics into a ring
+ * buffer, so that a single misbehaving metric can be debugged in production.
+ *
+ * Only steps of selected metrics are traced, and of those only every sample_interval-th one.  A
+ * step is an update of the combined metric, together with the input that arrived for it before.
+ * Scopes around either apply the same decision, code within them only checks active(), i.e. a
+ * single global flag.  Without COMBINATOR_TRACING, active() is constexpr false and all tracing is
+ * compiled out.
+ *
+ * Events may be recorded concurrently by the threads of the WorkStealingPool, but Scopes and
+ * dump() must be used by a single thread.
+ *
+ * A dump is a file with the magic "MQTRACE1", the number of events (uint64) and the events,
+ * oldest first, followed by the number of selected metrics (uint64) and for each of them its ID
+ * and the length of its name (uint32 each) and the name, all in native byte order.
+ */
+class Tracer
+{
+public:
+#ifdef COMBINATOR_TRACING
+    static constexpr bool compiled = true;
+#else
+    static constexpr bool compiled = false;
+#endif
+
+    static Tracer& global();
+
+    // Keep the last capacity events and trace every sample_interval-th step of each metric
+    void configure(std::size_t capacity, std::uint32_t sample_interval);
+    void select(MetricId metric);
+
+    bool enabled() const
+    {
+        return compiled && !selected_.empty();
+    }
+
+    static bool active()
+    {
+        return compiled && active_;
+    }
+
+    /*
+     * Traces events of a combined metric while it exists, if it is selected and the current step
+     * is sampled.  A Scope of kind update ends the step, any other kind belongs to the next
+     * update, e.g. input.
+     */
+    class Scope
+    {
+    public:
+        Scope(MetricId metric, TraceEventKind kind)
+        {
+            if (global().enabled())
+            {
+                global().begin(metric, kind == TraceEventKind::update);
+            }
+        }
+
+        ~Scope()
+        {
+            active_ = false;
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    void record(TraceEventKind kind, const void* node, metricq::TimePoint time,
+                std::uint32_t count0 = 0, std::uint32_t count1 = 0, std::uint32_t count2 = 0,
+                std::uint32_t count3 = 0);
+
+    // The number of events in the ring buffer
+    std::size_t size() const;
+
+    // Visit all events in the ring buffer, oldest first
+    template <typename F>
+    void for_each(F&& f) const
+    {
+        auto end = recorded_.load();
+        for (auto i = end - size(); i < end; ++i)
+        {
+            f(events_[i % events_.size()]);
+        }
+    }
+
+    // Write all events in the ring buffer to path, see above for the format
+    void dump(const std::string& path) const;
+
+private:
+    void begin(MetricId metric, bool ends_step);
+
+    static inline bool active_ = false;
+
+    std::vector<TraceEvent> events_;
+    std::atomic<std::uint64_t> recorded_ = 0;
+    std::uint32_t sample_interval_ = 1;
+    std::vector<bool> selected_;
+    std::vector<std::uint32_t> steps_;
+    MetricId current_ = 0;
+};
@@ -19,11 +19,16 @@
 // along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "unary_node.hpp"
+#include "profiler.hpp"
+#include "snapshot.hpp"
 
 void UnaryNode::update()
 {
     input_->update();
 
+    Profiler::NodeScope profile(
+        *this, [this] { return input_->queue_length(); }, [this] { return queue_length(); });
+
     while (input_->has_input())
     {
         auto tv = input_->peek();
@@ -32,7 +37,25 @@ void UnaryNode::update()
     }
 }
 
-void UnaryNode::collect_metric_inputs(MetricInputNodesByName& inputs)
+void UnaryNode::collect_metric_inputs(std::vector<MetricInputNode*>& inputs)
 {
     return input_->collect_metric_inputs(inputs);
 }
+
+void UnaryNode::collect_nodes(std::vector<const InputNode*>& nodes) const
+{
+    input_->collect_nodes(nodes);
+    nodes.push_back(this);
+}
+
+void UnaryNode::save_state(SnapshotWriter& writer) const
+{
+    InputQueue::save_state(writer);
+    input_->save_state(writer);
+}
+
+void UnaryNode::restore_state(SnapshotReader& reader)
+{
+    InputQueue::restore_state(reader);
+    input_->restore_state(reader);
+}
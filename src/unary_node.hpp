@@ -28,15 +28,19 @@
 struct UnaryNode : CalculationNode
 {
 public:
-    UnaryNode(std::unique_ptr<InputNode> input) : input_(std::move(input))
+    UnaryNode(NodePtr<InputNode> input) : input_(std::move(input))
     {
     }
 
     void update() override;
     virtual metricq::TimeValue process(metricq::TimeValue a) = 0;
 
-    void collect_metric_inputs(MetricInputNodesByName&) override;
+    void collect_metric_inputs(std::vector<MetricInputNode*>&) override;
+    void collect_nodes(std::vector<const InputNode*>&) const override;
+
+    void save_state(SnapshotWriter&) const override;
+    void restore_state(SnapshotReader&) override;
 
 private:
-    std::unique_ptr<InputNode> input_;
+    NodePtr<InputNode> input_;
 };
@@ -0,0 +1,144 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include "ring_buffer.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <string>
+
+enum class Priority
+{
+    high,
+    normal,
+    low,
+};
+
+inline std::optional<Priority> parse_priority(const std::string& name)
+{
+    if (name == "high")
+    {
+        return Priority::high;
+    }
+    else if (name == "normal")
+    {
+        return Priority::normal;
+    }
+    else if (name == "low")
+    {
+        return Priority::low;
+    }
+    return std::nullopt;
+}
+
+/**
+ * Decides which items to update next when there is more work than time.
+ *
+ * Items are updated in order of their priority and, within each priority, in the order in which
+ * they were scheduled.  A single run only takes as long as its budget, so that new input is
+ * accepted in between and a burst for low priority items cannot hold up high priority ones.
+ * Low priority items that waited for longer than the shed age are handed back to be shed instead.
+ */
+template <typename Item, typename Clock = std::chrono::steady_clock>
+class UpdateScheduler
+{
+public:
+    using TimePoint = typename Clock::time_point;
+    using Duration = typename Clock::duration;
+
+    UpdateScheduler(Duration budget, Duration shed_age) : budget_(budget), shed_age_(shed_age)
+    {
+    }
+
+    // Schedule an update of item, which must not be scheduled already
+    void schedule(Item& item, Priority priority, TimePoint since)
+    {
+        queues_[static_cast<std::size_t>(priority)].push_back({ &item, since });
+    }
+
+    /*
+     * Pass scheduled items to update(item) until the budget is used up, but at least one.  Low
+     * priority items that waited for too long are passed to shed(item, age) first.
+     * Returns whether there are items left for another run.
+     */
+    template <typename Update, typename Shed>
+    bool run(Update&& update, Shed&& shed)
+    {
+        auto start = Clock::now();
+        // Items are queued in the order they were scheduled, so the oldest are at the front
+        auto& low = queues_[static_cast<std::size_t>(Priority::low)];
+        while (!low.empty() && start - low.front().since > shed_age_)
+        {
+            auto entry = low.front();
+            low.pop_front();
+            shed(*entry.item, start - entry.since);
+        }
+
+        bool first = true;
+        for (auto& queue : queues_)
+        {
+            while (!queue.empty())
+            {
+                if (!first && Clock::now() - start >= budget_)
+                {
+                    return true;
+                }
+                first = false;
+
+                auto entry = queue.front();
+                queue.pop_front();
+                update(*entry.item);
+            }
+        }
+        return false;
+    }
+
+    void clear()
+    {
+        for (auto& queue : queues_)
+        {
+            queue.clear();
+        }
+    }
+
+    std::size_t size() const
+    {
+        std::size_t size = 0;
+        for (const auto& queue : queues_)
+        {
+            size += queue.size();
+        }
+        return size;
+    }
+
+private:
+    struct Entry
+    {
+        Item* item;
+        TimePoint since;
+    };
+
+    Duration budget_;
+    Duration shed_age_;
+    std::array<RingBuffer<Entry>, 3> queues_;
+};
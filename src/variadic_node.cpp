@@ -19,8 +19,113 @@
 // along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "variadic_node.hpp"
+#include "profiler.hpp"
+#include "snapshot.hpp"
+#include "tracer.hpp"
+#include "work_stealing_pool.hpp"
 
+#include <algorithm>
+#include <cassert>
 #include <cmath>
+#include <limits>
+
+namespace
+{
+constexpr std::size_t not_headless = std::numeric_limits<std::size_t>::max();
+}
+
+VariadicNode::VariadicNode(std::vector<NodePtr<InputNode>> inputs, JoinOptions options)
+: input_nodes_(std::move(inputs)), options_(options),
+  values_(input_nodes_.size(), std::nan("")), head_times_(input_nodes_.size()),
+  headless_positions_(input_nodes_.size()), held_until_(input_nodes_.size()),
+  held_(input_nodes_.size())
+{
+    scratch_.reserve(input_nodes_.size());
+    headless_.reserve(input_nodes_.size());
+    for (std::size_t i = 0; i < input_nodes_.size(); ++i)
+    {
+        headless_positions_[i] = i;
+        headless_.push_back(i);
+
+        if (dynamic_cast<CalculationNode*>(input_nodes_[i].get()) != nullptr)
+        {
+            subtrees_.push_back(input_nodes_[i].get());
+        }
+    }
+}
+
+void VariadicNode::update_inputs()
+{
+    auto* pool = WorkStealingPool::global();
+    if (pool == nullptr || subtrees_.size() < 2)
+    {
+        for (auto& input : input_nodes_)
+        {
+            input->update();
+        }
+        return;
+    }
+
+    /*
+     * Subtrees do not share any state, so they can merge their own inputs in parallel.  Only the
+     * merge of their results happens here, in the same order as without the pool, so the output
+     * is exactly the same.  Other inputs are queues or constants, which need no update.
+     *
+     * A node with a flat list of many inputs has nothing to update in parallel, as merging its
+     * queues is sequential.  Such lists are split up into subtrees before the node is created,
+     * see InputPatterns::expand(), which happens regardless of the number of threads, so the
+     * output does not depend on it either.
+     */
+    pool->run(subtrees_.size(), [this](std::size_t index) { subtrees_[index]->update(); });
+}
+
+void VariadicNode::set_value(std::size_t index, metricq::Value value)
+{
+    auto old_value = values_[index];
+    if (old_value == value)
+    {
+        return;
+    }
+    valid_values_ -= !std::isnan(old_value);
+    valid_values_ += !std::isnan(value);
+    values_[index] = value;
+    value_changed(index, old_value, value);
+}
+
+void VariadicNode::fetch(std::size_t index)
+{
+    auto& input = input_nodes_[index];
+    if (options_.hold)
+    {
+        // Values that are not newer than the last output only replace the held value
+        while (input->has_input() && input->peek().time <= last_time_)
+        {
+            held_[index] = input->peek();
+            input->discard();
+        }
+    }
+
+    if (input->has_input())
+    {
+        auto tv = input->peek();
+
+        // Swap-remove from the headless inputs
+        auto position = headless_positions_[index];
+        headless_[position] = headless_.back();
+        headless_positions_[headless_[position]] = position;
+        headless_.pop_back();
+        headless_positions_[index] = not_headless;
+
+        held_until_.erase(index);
+        head_times_.set(index, tv.time);
+        set_value(index, tv.value);
+    }
+    else if (options_.hold && held_[index])
+    {
+        held_until_.set(index, held_[index]->time + *options_.hold);
+        set_value(index, held_[index]->value);
+    }
+}
 
 void VariadicNode::update()
 {
@@ -40,67 +145,285 @@ void VariadicNode::update()
      * Hence, NaNs aren't treated differently for the other operations.
      */
 
-    for (auto& input : input_nodes_)
+    update_inputs();
+
+    Profiler::NodeScope profile(
+        *this,
+        [this] {
+            std::size_t queued = 0;
+            for (const auto& input_node : input_nodes_)
+            {
+                queued += input_node->queue_length();
+            }
+            return queued;
+        },
+        [this] { return queued_outputs(); });
+
+    // fetch() removes inputs from headless_, so iterate over a copy
+    scratch_indices_.assign(headless_.begin(), headless_.end());
+    for (auto index : scratch_indices_)
     {
-        input->update();
+        fetch(index);
     }
 
-    while (std::all_of(input_nodes_.begin(), input_nodes_.end(),
-                       [](auto& input) { return input->has_input(); }))
+    /*
+     * Only the inputs whose values are discarded in a step change their value, so producing an
+     * output value only costs as much as updating the aggregate for those inputs, instead of
+     * looking at all inputs.
+     */
+    while (true)
     {
-        std::vector<metricq::TimePoint> input_time_points;
-        input_time_points.reserve(input_nodes_.size());
-        std::vector<metricq::Value> input_values;
-        input_values.reserve(input_nodes_.size());
+        // Every input must either have a value queued or hold one
+        if (head_times_.empty() || headless_.size() != held_until_.size())
+        {
+            break;
+        }
 
-        for (auto& input_node : input_nodes_)
+        auto new_time = head_times_.top_key();
+        if (!held_until_.empty() && held_until_.top_key() < new_time)
         {
-            auto tv = input_node->peek();
-            input_time_points.emplace_back(tv.time);
-            if (!std::isnan(tv.value))
-            {
-                input_values.emplace_back(tv.value);
-            }
+            // A held value went stale, wait for the next value of this input
+            break;
         }
 
-        // Figure out the time all inputs agree on
-        auto it = std::min_element(input_time_points.begin(), input_time_points.end());
-        assert(it != input_time_points.end());
-        auto new_time = *it;
+        last_time_ = new_time;
+        emit(new_time);
 
-        // discard all that are exactly up to the time
-        // ZIP :(
-        for (size_t i = 0; i < input_nodes_.size(); ++i)
+        // discard all that are up to the time
+        scratch_indices_.clear();
+        while (!head_times_.empty() && options_.coincides(head_times_.top_key(), new_time))
         {
-            auto& time = input_time_points.at(i);
-            if (time == new_time)
-            {
-                auto& input = input_nodes_.at(i);
-                input->discard();
-            }
-            else
-            {
-                assert(time > new_time);
-            }
-        }
+            auto index = head_times_.top();
+            head_times_.pop();
 
-        if (input_values.empty())
+            auto& input = input_nodes_[index];
+            held_[index] = input->peek();
+            input->discard();
+
+            headless_positions_[index] = headless_.size();
+            headless_.push_back(index);
+            scratch_indices_.push_back(index);
+        }
+        // Only fetch afterwards, the next values must not be discarded in the same step
+        for (auto index : scratch_indices_)
         {
-            // All values are NaN
-            put(metricq::TimeValue{ new_time, std::nan("") });
-            return;
+            fetch(index);
         }
+    }
 
-        auto new_value = combine(input_values);
+    if (Tracer::active())
+    {
+        Tracer::global().record(TraceEventKind::variadic, this, last_time_, headless_.size(),
+                                held_until_.size(), queue_length());
+    }
+}
+
+void VariadicNode::emit(metricq::TimePoint time)
+{
+    if (valid_values_ == 0)
+    {
+        // All values are NaN
+        put(metricq::TimeValue{ time, std::nan("") });
+    }
+    else
+    {
+        put(metricq::TimeValue{ time, aggregate() });
+    }
+}
 
-        put(metricq::TimeValue{ new_time, new_value });
+metricq::Value VariadicNode::aggregate()
+{
+    scratch_.clear();
+    for (auto value : values_)
+    {
+        if (!std::isnan(value))
+        {
+            scratch_.emplace_back(value);
+        }
     }
+    return combine(scratch_);
 }
 
-void VariadicNode::collect_metric_inputs(MetricInputNodesByName& inputs)
+void VariadicNode::collect_metric_inputs(std::vector<MetricInputNode*>& inputs)
 {
     for (auto& input_node : input_nodes_)
     {
         input_node->collect_metric_inputs(inputs);
     }
 }
+
+void VariadicNode::collect_nodes(std::vector<const InputNode*>& nodes) const
+{
+    for (const auto& input_node : input_nodes_)
+    {
+        input_node->collect_nodes(nodes);
+    }
+    nodes.push_back(this);
+}
+
+void VariadicNode::save_state(SnapshotWriter& writer) const
+{
+    InputQueue::save_state(writer);
+    writer.write(last_time_);
+    for (size_t i = 0; i < input_nodes_.size(); ++i)
+    {
+        writer.write(held_[i]);
+        writer.write(values_[i]);
+        input_nodes_[i]->save_state(writer);
+    }
+}
+
+void VariadicNode::restore_state(SnapshotReader& reader)
+{
+    InputQueue::restore_state(reader);
+    last_time_ = reader.read_time_point();
+    std::vector<metricq::Value> values(input_nodes_.size());
+    for (size_t i = 0; i < input_nodes_.size(); ++i)
+    {
+        held_[i] = reader.read_optional_time_value();
+        values[i] = reader.read<metricq::Value>();
+        input_nodes_[i]->restore_state(reader);
+    }
+
+    /*
+     * Which inputs have a value queued or hold one is derived on the next update.  Their values
+     * are restored as they were, so that the update only changes the same values as it would
+     * have without the restart.
+     */
+    head_times_.clear();
+    held_until_.clear();
+    headless_.clear();
+    for (size_t i = 0; i < input_nodes_.size(); ++i)
+    {
+        headless_positions_[i] = i;
+        headless_.push_back(i);
+        set_value(i, values[i]);
+    }
+}
+
+void SumNode::save_state(SnapshotWriter& writer) const
+{
+    VariadicNode::save_state(writer);
+    writer.write(sum_);
+    writer.write(recompute_);
+}
+
+void SumNode::restore_state(SnapshotReader& reader)
+{
+    VariadicNode::restore_state(reader);
+    // Restoring the values above replaced them in the sum, which rounds differently
+    sum_ = reader.read<RunningSum>();
+    recompute_ = reader.read<RecomputeSchedule>();
+}
+
+const std::vector<std::pair<std::string, AggregateNode::Aggregate>>&
+AggregateNode::aggregate_names()
+{
+    static const std::vector<std::pair<std::string, Aggregate>> names = {
+        { "min", Aggregate::min },
+        { "max", Aggregate::max },
+        { "sum", Aggregate::sum },
+        { "mean", Aggregate::mean },
+        { "count_valid", Aggregate::count_valid },
+    };
+    return names;
+}
+
+AggregateNode::AggregateNode(std::vector<NodePtr<InputNode>> inputs,
+                             std::vector<Aggregate> aggregates, JoinOptions options)
+: VariadicNode(std::move(inputs), options), aggregates_(std::move(aggregates)),
+  min_(input_values().size()), max_(input_values().size())
+{
+    for (std::size_t i = 0; i < aggregates_.size(); ++i)
+    {
+        queues_.emplace_back(std::make_unique<InputQueue>());
+    }
+}
+
+std::vector<std::pair<std::string, InputNode*>> AggregateNode::outputs()
+{
+    std::vector<std::pair<std::string, InputNode*>> result;
+    for (std::size_t i = 0; i < aggregates_.size(); ++i)
+    {
+        for (const auto& [name, aggregate] : aggregate_names())
+        {
+            if (aggregate == aggregates_[i])
+            {
+                result.emplace_back(name, queues_[i].get());
+            }
+        }
+    }
+    return result;
+}
+
+void AggregateNode::value_changed(std::size_t index, metricq::Value old_value,
+                                  metricq::Value new_value)
+{
+    sum_.replace(old_value, new_value);
+    min_.replace(index, new_value);
+    max_.replace(index, new_value);
+}
+
+metricq::Value AggregateNode::compute(Aggregate aggregate) const
+{
+    switch (aggregate)
+    {
+    case Aggregate::min:
+        return min_.value();
+    case Aggregate::max:
+        return max_.value();
+    case Aggregate::sum:
+        return valid_values() == 0 ? std::nan("") : sum_.value();
+    case Aggregate::mean:
+        return valid_values() == 0 ? std::nan("") : sum_.value() / valid_values();
+    case Aggregate::count_valid:
+        return static_cast<metricq::Value>(valid_values());
+    }
+    assert(false);
+    return std::nan("");
+}
+
+void AggregateNode::emit(metricq::TimePoint time)
+{
+    if (recompute_.due(time))
+    {
+        sum_.reset(input_values());
+    }
+
+    for (std::size_t i = 0; i < aggregates_.size(); ++i)
+    {
+        queues_[i]->put(metricq::TimeValue{ time, compute(aggregates_[i]) });
+    }
+}
+
+std::size_t AggregateNode::queued_outputs() const
+{
+    std::size_t queued = 0;
+    for (const auto& queue : queues_)
+    {
+        queued += queue->queue_length();
+    }
+    return queued;
+}
+
+void AggregateNode::save_state(SnapshotWriter& writer) const
+{
+    VariadicNode::save_state(writer);
+    writer.write(sum_);
+    writer.write(recompute_);
+    for (const auto& queue : queues_)
+    {
+        queue->save_state(writer);
+    }
+}
+
+void AggregateNode::restore_state(SnapshotReader& reader)
+{
+    VariadicNode::restore_state(reader);
+    sum_ = reader.read<RunningSum>();
+    recompute_ = reader.read<RecomputeSchedule>();
+    for (auto& queue : queues_)
+    {
+        queue->restore_state(reader);
+    }
+}
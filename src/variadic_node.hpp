@@ -19,28 +19,102 @@
 // along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 
+#include "aggregates.hpp"
+#include "indexed_heap.hpp"
 #include "input_node.hpp"
+#include "join_options.hpp"
 
 #include <metricq/types.hpp>
 
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <functional>
 #include <memory>
+#include <numeric>
+#include <optional>
+#include <string>
 #include <utility>
 #include <vector>
 
 struct VariadicNode : CalculationNode
 {
 public:
-    VariadicNode(std::vector<std::unique_ptr<InputNode>> inputs) : input_nodes_(std::move(inputs))
-    {
-    }
+    VariadicNode(std::vector<NodePtr<InputNode>> inputs, JoinOptions options = {});
 
     void update() override;
     virtual metricq::Value combine(const std::vector<metricq::Value>& input_values) = 0;
 
-    void collect_metric_inputs(MetricInputNodesByName&) override;
+    void collect_metric_inputs(std::vector<MetricInputNode*>&) override;
+    void collect_nodes(std::vector<const InputNode*>&) const override;
+
+    void save_state(SnapshotWriter&) const override;
+    void restore_state(SnapshotReader&) override;
+
+protected:
+    /*
+     * Hooks for nodes that keep their result up to date incrementally instead of combining all
+     * input values for every output value.  value_changed() is called whenever the value of a
+     * single input changes, NaN stands for "no value".  aggregate() is only called if at least
+     * one input value is not NaN.  By default, it combines all non-NaN input values.
+     */
+    virtual void value_changed(std::size_t, metricq::Value, metricq::Value)
+    {
+    }
+
+    virtual metricq::Value aggregate();
+
+    // Produce the output value(s) for the given time from the current input values
+    virtual void emit(metricq::TimePoint time);
+
+    // The number of values queued for the node(s) that consume the output
+    virtual std::size_t queued_outputs() const
+    {
+        return queue_length();
+    }
+
+    const std::vector<metricq::Value>& input_values() const
+    {
+        return values_;
+    }
+
+    // The number of input values that are not NaN
+    std::size_t valid_values() const
+    {
+        return valid_values_;
+    }
 
 private:
-    std::vector<std::unique_ptr<InputNode>> input_nodes_;
+    void update_inputs();
+
+    void set_value(std::size_t index, metricq::Value value);
+
+    // Try to get the next value of an input that has none in head_times_ right now
+    void fetch(std::size_t index);
+
+private:
+    std::vector<NodePtr<InputNode>> input_nodes_;
+    // Inputs that are calculations themselves and can be updated independently of each other
+    std::vector<InputNode*> subtrees_;
+    JoinOptions options_;
+
+    // The value of each input that takes part in the next output value
+    std::vector<metricq::Value> values_;
+    std::size_t valid_values_ = 0;
+    std::vector<metricq::Value> scratch_;
+    std::vector<std::size_t> scratch_indices_;
+
+    // Inputs that have a value queued, by its time
+    IndexedHeap<metricq::TimePoint> head_times_;
+    // Inputs that have no value queued, in no particular order
+    std::vector<std::size_t> headless_;
+    std::vector<std::size_t> headless_positions_;
+    // Inputs that have no value queued but a held one, by the time the held value gets stale
+    IndexedHeap<metricq::TimePoint> held_until_;
+
+    // Last values discarded from each input
+    std::vector<std::optional<metricq::TimeValue>> held_;
+    metricq::TimePoint last_time_ = Timestamp::genesis();
 };
 
 class SumNode : public VariadicNode
@@ -50,32 +124,191 @@ class SumNode : public VariadicNode
         return std::accumulate(input_values.begin(), input_values.end(), metricq::Value());
     }
 
+    void value_changed(std::size_t, metricq::Value old_value, metricq::Value new_value) override
+    {
+        sum_.replace(old_value, new_value);
+    }
+
+    void emit(metricq::TimePoint time) override
+    {
+        if (recompute_.due(time))
+        {
+            sum_.reset(input_values());
+        }
+        VariadicNode::emit(time);
+    }
+
+    metricq::Value aggregate() override
+    {
+        return sum_.value();
+    }
+
 public:
     using VariadicNode::VariadicNode;
+
+    void save_state(SnapshotWriter&) const override;
+    void restore_state(SnapshotReader&) override;
+
+private:
+    RunningSum sum_;
+    RecomputeSchedule recompute_;
 };
 
-class MinNode : public VariadicNode
+template <typename Compare>
+class ExtremumNode : public VariadicNode
 {
     metricq::Value combine(const std::vector<metricq::Value>& input_values) override
     {
-        auto it = std::min_element(input_values.begin(), input_values.end());
+        auto it = std::min_element(input_values.begin(), input_values.end(), Compare());
         assert(it != input_values.end());
         return *it;
     }
 
+    void value_changed(std::size_t index, metricq::Value, metricq::Value new_value) override
+    {
+        extremum_.replace(index, new_value);
+    }
+
+    metricq::Value aggregate() override
+    {
+        return extremum_.value();
+    }
+
 public:
-    using VariadicNode::VariadicNode;
+    ExtremumNode(std::vector<NodePtr<InputNode>> inputs, JoinOptions options = {})
+    : VariadicNode(std::move(inputs), options), extremum_(input_values().size())
+    {
+    }
+
+private:
+    RunningExtremum<Compare> extremum_;
 };
 
-class MaxNode : public VariadicNode
+using MinNode = ExtremumNode<std::less<metricq::Value>>;
+using MaxNode = ExtremumNode<std::greater<metricq::Value>>;
+
+/*
+ * Nodes whose inputs have fixed roles instead of being interchangeable.  The operator sees all
+ * three input values by position, including NaNs, and decides itself how to treat them.  It is a
+ * template parameter, so that it is inlined into emit().
+ */
+template <typename Operator>
+class PositionalNode final : public VariadicNode
 {
+public:
+    PositionalNode(NodePtr<InputNode> first, NodePtr<InputNode> second, NodePtr<InputNode> third,
+                   JoinOptions options = {})
+    : VariadicNode(positional(std::move(first), std::move(second), std::move(third)), options)
+    {
+    }
+
+private:
     metricq::Value combine(const std::vector<metricq::Value>& input_values) override
     {
-        auto it = std::max_element(input_values.begin(), input_values.end());
-        assert(it != input_values.end());
-        return *it;
+        return Operator()(input_values[0], input_values[1], input_values[2]);
+    }
+
+    void emit(metricq::TimePoint time) override
+    {
+        const auto& values = input_values();
+        put(metricq::TimeValue{ time, Operator()(values[0], values[1], values[2]) });
     }
 
+    static std::vector<NodePtr<InputNode>> positional(NodePtr<InputNode> first,
+                                                      NodePtr<InputNode> second,
+                                                      NodePtr<InputNode> third)
+    {
+        std::vector<NodePtr<InputNode>> inputs;
+        inputs.push_back(std::move(first));
+        inputs.push_back(std::move(second));
+        inputs.push_back(std::move(third));
+        return inputs;
+    }
+};
+
+// Picks the "then" input while the condition is non-zero and the "else" input otherwise
+struct SelectOperator
+{
+    metricq::Value operator()(metricq::Value condition, metricq::Value then,
+                              metricq::Value otherwise) const
+    {
+        if (std::isnan(condition))
+        {
+            return condition;
+        }
+        return condition != 0 ? then : otherwise;
+    }
+};
+
+// Limits the input to [min, max], where a NaN bound does not limit it
+struct ClampOperator
+{
+    metricq::Value operator()(metricq::Value value, metricq::Value min, metricq::Value max) const
+    {
+        if (!std::isnan(min))
+        {
+            value = std::max(value, min);
+        }
+        if (!std::isnan(max))
+        {
+            value = std::min(value, max);
+        }
+        return value;
+    }
+};
+
+using SelectNode = PositionalNode<SelectOperator>;
+using ClampNode = PositionalNode<ClampOperator>;
+
+/**
+ * Computes several aggregates over the same inputs in a single pass.
+ *
+ * Instead of its own queue, each selected aggregate is published to a separate output queue, see
+ * outputs().  Like the other variadic nodes, NaN inputs are ignored, so "count_valid" is the
+ * number of inputs that are not NaN and "mean" is NaN if there are none.
+ */
+class AggregateNode : public VariadicNode
+{
 public:
-    using VariadicNode::VariadicNode;
+    enum class Aggregate
+    {
+        min,
+        max,
+        sum,
+        mean,
+        count_valid,
+    };
+
+    static const std::vector<std::pair<std::string, Aggregate>>& aggregate_names();
+
+    AggregateNode(std::vector<NodePtr<InputNode>> inputs,
+                  std::vector<Aggregate> aggregates, JoinOptions options = {});
+
+    // The name of each selected aggregate with the queue its values are published to
+    std::vector<std::pair<std::string, InputNode*>> outputs();
+
+    void save_state(SnapshotWriter&) const override;
+    void restore_state(SnapshotReader&) override;
+
+private:
+    metricq::Value combine(const std::vector<metricq::Value>& input_values) override
+    {
+        return std::accumulate(input_values.begin(), input_values.end(), metricq::Value());
+    }
+
+    void value_changed(std::size_t index, metricq::Value old_value,
+                       metricq::Value new_value) override;
+    void emit(metricq::TimePoint time) override;
+    std::size_t queued_outputs() const override;
+
+    metricq::Value compute(Aggregate aggregate) const;
+
+private:
+    std::vector<Aggregate> aggregates_;
+    std::vector<std::unique_ptr<InputQueue>> queues_;
+
+    RunningSum sum_;
+    RunningExtremum<std::less<metricq::Value>> min_;
+    RunningExtremum<std::greater<metricq::Value>> max_;
+    RecomputeSchedule recompute_;
 };
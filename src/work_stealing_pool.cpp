@@ -0,0 +1,178 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "work_stealing_pool.hpp"
+
+#include <algorithm>
+#include <optional>
+
+namespace
+{
+// The deque owned by the current thread, the caller of run() uses deque 0
+thread_local std::size_t current_deque = 0;
+
+std::unique_ptr<WorkStealingPool> global_pool;
+} // namespace
+
+WorkStealingPool::WorkStealingPool(std::size_t threads)
+{
+    for (std::size_t i = 0; i < std::max<std::size_t>(threads, 1); ++i)
+    {
+        deques_.emplace_back(std::make_unique<Deque>());
+    }
+    for (std::size_t i = 1; i < deques_.size(); ++i)
+    {
+        workers_.emplace_back([this, i]() { work(i); });
+    }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        stop_ = true;
+    }
+    wake_up_.notify_all();
+    for (auto& worker : workers_)
+    {
+        worker.join();
+    }
+}
+
+WorkStealingPool* WorkStealingPool::global()
+{
+    return global_pool.get();
+}
+
+void WorkStealingPool::configure_global(std::size_t threads)
+{
+    global_pool.reset();
+    if (threads > 1)
+    {
+        global_pool = std::make_unique<WorkStealingPool>(threads);
+    }
+}
+
+void WorkStealingPool::run(std::size_t count, const std::function<void(std::size_t)>& task)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    Batch batch{ task, { count }, {}, {} };
+    auto self = current_deque;
+    {
+        std::lock_guard<std::mutex> lock(deques_[self]->mutex);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            deques_[self]->jobs.push_back(Job{ &batch, i });
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        queued_ += count;
+    }
+    wake_up_.notify_all();
+
+    // Help out until every task of this batch is done, possibly with tasks of other batches
+    while (batch.remaining > 0)
+    {
+        if (!run_one(self))
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    if (batch.error)
+    {
+        std::rethrow_exception(batch.error);
+    }
+}
+
+bool WorkStealingPool::run_one(std::size_t self)
+{
+    std::optional<Job> job;
+    {
+        auto& own = *deques_[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty())
+        {
+            job = own.jobs.back();
+            own.jobs.pop_back();
+        }
+    }
+
+    for (std::size_t i = 1; !job && i < deques_.size(); ++i)
+    {
+        auto& victim = *deques_[(self + i) % deques_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty())
+        {
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+        }
+    }
+
+    if (!job)
+    {
+        return false;
+    }
+
+    queued_--;
+    execute(*job);
+    return true;
+}
+
+void WorkStealingPool::execute(Job job)
+{
+    try
+    {
+        job.batch->task(job.index);
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(job.batch->error_mutex);
+        if (!job.batch->error)
+        {
+            job.batch->error = std::current_exception();
+        }
+    }
+    job.batch->remaining--;
+}
+
+void WorkStealingPool::work(std::size_t self)
+{
+    current_deque = self;
+    while (true)
+    {
+        if (run_one(self))
+        {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        wake_up_.wait(lock, [this]() { return stop_ || queued_ > 0; });
+        if (stop_)
+        {
+            return;
+        }
+    }
+}
@@ -0,0 +1,99 @@
+// metricq-combinator
+// Copyright (C) 2019 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-combinator.
+//
+// metricq-combinator is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-combinator is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-combinator.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fork-join thread pool with one task deque per thread.
+ *
+ * run() pushes its tasks onto the deque of the calling thread and helps executing them until all
+ * are done.  Threads take tasks from the back of their own deque and, once that is empty, steal
+ * from the front of the deques of other threads.  Since waiting threads keep executing tasks,
+ * tasks may call run() themselves without blocking the pool.
+ *
+ * Apart from the pool's own workers, only a single thread may call run() at a time.
+ */
+class WorkStealingPool
+{
+public:
+    // Use `threads` threads in total, i.e. the calling thread and threads - 1 workers
+    explicit WorkStealingPool(std::size_t threads);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Run task(0), ..., task(count - 1) and return once all of them finished.  If any of them
+    // throws, the first exception is rethrown after all tasks finished.
+    void run(std::size_t count, const std::function<void(std::size_t)>& task);
+
+    std::size_t threads() const
+    {
+        return deques_.size();
+    }
+
+    // The pool used to update independent subtrees of expressions, nullptr if disabled
+    static WorkStealingPool* global();
+    static void configure_global(std::size_t threads);
+
+private:
+    struct Batch
+    {
+        const std::function<void(std::size_t)>& task;
+        std::atomic<std::size_t> remaining;
+        std::mutex error_mutex;
+        std::exception_ptr error;
+    };
+
+    struct Job
+    {
+        Batch* batch;
+        std::size_t index;
+    };
+
+    struct Deque
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    void work(std::size_t self);
+    bool run_one(std::size_t self);
+    static void execute(Job job);
+
+private:
+    std::vector<std::unique_ptr<Deque>> deques_;
+    std::vector<std::thread> workers_;
+
+    std::atomic<std::size_t> queued_ = 0;
+    std::atomic<bool> stop_ = false;
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_up_;
+};
@@ -0,0 +1,335 @@
+/*
+ * Measures the throughput and latency of a whole Combinator, standing in for the manager and the
+ * broker: a generated configuration and input metadata are delivered as the manager would, and
+ * synthetic input chunks are passed to on_data() as if they came from the broker.  Everything the
+ * combinator sends is captured instead of being sent.
+ *
+ *     metricq-combinator.load_test [combined metrics] [seconds of input] [seconds per second]
+ *
+ * Input is generated as fast as possible unless the last argument gives a rate.  Latencies are
+ * measured from the arrival of the first input chunk of a second until an output value for it
+ * was sent, so they include waiting for other inputs, e.g. for a median over a window.
+ */
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <metricq/json.hpp>
+#include <metricq/logger/nitro.hpp>
+
+#include "../src/combinator.hpp"
+
+using Clock = std::chrono::steady_clock;
+using Seconds = std::chrono::duration<double>;
+
+static void check(bool passed)
+{
+    if (!passed)
+    {
+        std::cerr << "!!! CHECK FAILED !!!\n";
+        std::exit(1);
+    }
+}
+
+// Resident and peak resident memory of this process in bytes
+static std::pair<std::size_t, std::size_t> memory_usage()
+{
+    std::ifstream status("/proc/self/status");
+    std::size_t resident = 0;
+    std::size_t peak = 0;
+    for (std::string line; std::getline(status, line);)
+    {
+        if (line.rfind("VmRSS:", 0) == 0)
+        {
+            resident = std::stoull(line.substr(6)) * 1024;
+        }
+        else if (line.rfind("VmHWM:", 0) == 0)
+        {
+            peak = std::stoull(line.substr(6)) * 1024;
+        }
+    }
+    return { resident, peak };
+}
+
+// Latencies in buckets of 1/20 decade from 1µs on, precise enough for percentiles
+class LatencyHistogram
+{
+public:
+    void add(double seconds)
+    {
+        auto bucket = seconds <= min_latency ? 0 : std::log10(seconds / min_latency) * per_decade;
+        buckets_[std::min<std::size_t>(bucket, buckets_.size() - 1)]++;
+        count_++;
+        max_ = std::max(max_, seconds);
+    }
+
+    double percentile(double q) const
+    {
+        std::size_t seen = 0;
+        for (std::size_t i = 0; i < buckets_.size(); ++i)
+        {
+            seen += buckets_[i];
+            if (seen > 0 && static_cast<double>(seen) >= q * static_cast<double>(count_))
+            {
+                // The upper end of the bucket
+                return std::min(max_, min_latency * std::pow(10.0, (i + 1) / per_decade));
+            }
+        }
+        return max_;
+    }
+
+    std::size_t count() const
+    {
+        return count_;
+    }
+
+    double max() const
+    {
+        return max_;
+    }
+
+private:
+    static constexpr double min_latency = 1e-6;
+    static constexpr double per_decade = 20;
+
+    std::array<std::size_t, 200> buckets_ = {};
+    std::size_t count_ = 0;
+    double max_ = 0;
+};
+
+// Captures everything the combinator sends
+class Capture : public OutputSink
+{
+public:
+    bool output_ready() const override
+    {
+        return true;
+    }
+
+    void output(const std::string&, metricq::TimeValue tv) override
+    {
+        values++;
+        // Values of second k are within (k - 1, k]
+        auto since_start = (tv.time - start_time).count();
+        auto second = (since_start + 999'999'999) / 1'000'000'000;
+        if (second >= 0 && static_cast<std::size_t>(second) < arrived.size())
+        {
+            latencies.add(Seconds(Clock::now() - arrived[second]).count());
+        }
+    }
+
+    metricq::TimePoint start_time;
+    // When the first input chunk for each second arrived
+    std::vector<Clock::time_point> arrived;
+    LatencyHistogram latencies;
+    std::size_t values = 0;
+};
+
+class LoadTest
+{
+public:
+    struct Options
+    {
+        std::size_t combined_metrics = 100;
+        std::size_t seconds = 60;
+        // Seconds of input per second of wall time, as fast as possible if zero
+        double rate = 0;
+        std::size_t values_per_chunk = 10;
+    };
+
+    explicit LoadTest(const Options& options)
+    : options_(options), combinator_(settings(), capture_), rng_(1)
+    {
+    }
+
+    const Capture& run()
+    {
+        // The manager delivers the configuration and then the metadata of all inputs
+        auto start = Clock::now();
+        combinator_.on_transformer_config(make_config());
+        std::vector<std::string> inputs(combinator_.input_metrics.begin(),
+                                        combinator_.input_metrics.end());
+        for (const auto& input : inputs)
+        {
+            combinator_.metadata_[input].rate(options_.values_per_chunk);
+        }
+        combinator_.on_transformer_ready();
+        auto configured = memory_usage().first;
+        std::cerr << "Configured " << options_.combined_metrics << " combined metrics with "
+                  << inputs.size() << " inputs in " << Seconds(Clock::now() - start).count()
+                  << " s, " << configured / 1e6 << " MB resident\n";
+
+        // The broker delivers one chunk per input and second, updates run in between
+        capture_.start_time = metricq::Clock::now();
+        capture_.arrived.resize(options_.seconds + 1);
+        metricq::DataChunk chunk;
+        std::size_t input_values = 0;
+        start = Clock::now();
+        for (std::size_t second = 1; second <= options_.seconds; ++second)
+        {
+            if (options_.rate > 0)
+            {
+                std::this_thread::sleep_until(
+                    start + std::chrono::duration_cast<Clock::duration>(
+                                Seconds((second - 1) / options_.rate)));
+            }
+            capture_.arrived[second] = Clock::now();
+            for (std::size_t i = 0; i < inputs.size(); ++i)
+            {
+                fill_chunk(chunk, second, i);
+                combinator_.on_data(inputs[i], chunk);
+                input_values += chunk.value_size();
+            }
+            combinator_.io_service.poll();
+        }
+        while (combinator_.scheduler_.size() > 0)
+        {
+            combinator_.io_service.poll();
+        }
+        auto elapsed = Seconds(Clock::now() - start).count();
+
+        auto [resident, peak] = memory_usage();
+        const auto& latencies = capture_.latencies;
+        std::cerr << "Sent " << capture_.values << " values for " << input_values
+                  << " input values in " << elapsed << " s\n"
+                  << "`-- throughput: " << input_values / elapsed << " input values/s, "
+                  << capture_.values / elapsed << " output values/s\n"
+                  << "`-- latency: p50 " << latencies.percentile(0.5) * 1e3 << " ms, p90 "
+                  << latencies.percentile(0.9) * 1e3 << " ms, p99 "
+                  << latencies.percentile(0.99) * 1e3 << " ms, max " << latencies.max() * 1e3
+                  << " ms\n"
+                  << "`-- memory: " << resident / 1e6 << " MB resident, " << peak / 1e6
+                  << " MB peak\n";
+        return capture_;
+    }
+
+private:
+    static CombinatorSettings settings()
+    {
+        CombinatorSettings settings;
+        // Would ask the manager for matches
+        settings.pattern_refresh_interval = metricq::Duration::zero();
+        return settings;
+    }
+
+    // A mix of all kinds of operations on inputs shared between combined metrics
+    metricq::json make_config()
+    {
+        auto input_count = std::max<std::size_t>(10, options_.combined_metrics);
+        auto input = [&]() { return "load.input" + std::to_string(rng_() % input_count); };
+        auto inputs = [&](std::size_t count) {
+            auto result = metricq::json::array();
+            while (result.size() < count)
+            {
+                auto name = input();
+                if (std::find(result.begin(), result.end(), name) == result.end())
+                {
+                    result.push_back(name);
+                }
+            }
+            return result;
+        };
+
+        metricq::json metrics = metricq::json::object();
+        for (std::size_t i = 0; i < options_.combined_metrics; ++i)
+        {
+            metricq::json expression;
+            switch (i % 8)
+            {
+            case 0:
+                expression = { { "operation", "+" }, { "left", input() }, { "right", input() } };
+                break;
+            case 1:
+                expression = { { "operation", "sum" }, { "inputs", inputs(8) } };
+                break;
+            case 2:
+                expression = { { "operation", "max" }, { "inputs", inputs(4) }, { "hold", "5s" } };
+                break;
+            case 3:
+                expression = { { "operation", "*" }, { "left", input() }, { "right", 1.5 } };
+                break;
+            case 4:
+                expression = { { "operation", "throttle" },
+                                { "cooldown_period", "5s" },
+                                { "input", input() } };
+                break;
+            case 5:
+                expression = { { "operation", "median" },
+                               { "window", "10s" },
+                               { "input", input() } };
+                break;
+            case 6:
+                expression = { { "operation", "deadband" },
+                               { "threshold", 5 },
+                               { "input", input() } };
+                break;
+            default:
+                expression = { { "operation", "aggregate" },
+                               { "inputs", inputs(4) },
+                               { "outputs", { "min", "max" } } };
+            }
+            metrics["load.combined" + std::to_string(i)] = { { "expression", expression } };
+        }
+        return { { "metrics", metrics } };
+    }
+
+    // Evenly spaced values within (second - 1, second]
+    void fill_chunk(metricq::DataChunk& chunk, std::size_t second, std::size_t input)
+    {
+        chunk.clear_time_delta();
+        chunk.clear_value();
+        auto step = std::chrono::nanoseconds(std::chrono::seconds(1)) / options_.values_per_chunk;
+        auto time = capture_.start_time + std::chrono::seconds(second - 1);
+        std::int64_t previous = 0;
+        for (std::size_t j = 0; j < options_.values_per_chunk; ++j)
+        {
+            time += step;
+            auto since_epoch = time.time_since_epoch().count();
+            chunk.add_time_delta(since_epoch - previous);
+            previous = since_epoch;
+            chunk.add_value(100 + static_cast<double>((input * 7 + second * 13 + j) % 50));
+        }
+    }
+
+    Options options_;
+    Capture capture_;
+    Combinator combinator_;
+    std::mt19937_64 rng_;
+};
+
+int main(int argc, const char* argv[])
+{
+    LoadTest::Options options;
+    if (argc > 1)
+    {
+        options.combined_metrics = std::stoul(argv[1]);
+    }
+    if (argc > 2)
+    {
+        options.seconds = std::stoul(argv[2]);
+    }
+    if (argc > 3)
+    {
+        options.rate = std::stod(argv[3]);
+    }
+
+    // The combinator logs every combined metric it configures
+    metricq::logger::nitro::initialize();
+    metricq::logger::nitro::set_severity(nitro::log::severity_level::warn);
+
+    LoadTest test(options);
+    const auto& capture = test.run();
+    check(capture.values > 0);
+    check(capture.latencies.count() > 0);
+
+    return 0;
+}
@@ -0,0 +1,416 @@
+/*
+ * Simulates weeks of input for a large configuration within minutes, and checks that queues and
+ * memory stay bounded.  Slow leaks and queue creep only show after days of running, e.g. when
+ * the two inputs of a join drift apart.
+ *
+ *     metricq-combinator.soak_test [combined metrics] [days of input]
+ *
+ * Each input samples with its own period, clock drift and timestamp jitter, has gaps of up to two
+ * hours and bursts of NaNs, and is delivered once per minute with its own lag.  The smallest
+ * queue length of each node is tracked per simulated day: if it keeps rising from day to day, the
+ * node is creeping, no matter how much its queue varies within a day.
+ */
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cxxabi.h>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <metricq/json.hpp>
+
+#include "../src/combined_metric.hpp"
+
+using Clock = std::chrono::steady_clock;
+using Seconds = std::chrono::duration<double>;
+
+static void check(bool passed)
+{
+    if (!passed)
+    {
+        std::cerr << "!!! CHECK FAILED !!!\n";
+        std::exit(1);
+    }
+}
+
+// Resident memory of this process in bytes
+static std::size_t resident_memory()
+{
+    std::ifstream status("/proc/self/status");
+    for (std::string line; std::getline(status, line);)
+    {
+        if (line.rfind("VmRSS:", 0) == 0)
+        {
+            return std::stoull(line.substr(6)) * 1024;
+        }
+    }
+    return 0;
+}
+
+static std::string describe(const InputNode& node)
+{
+    int status = 0;
+    std::unique_ptr<char, decltype(&std::free)> type(
+        abi::__cxa_demangle(typeid(node).name(), nullptr, nullptr, &status), &std::free);
+    std::string result = status == 0 ? type.get() : typeid(node).name();
+    if (auto* input = dynamic_cast<const MetricInputNode*>(&node))
+    {
+        result += " " + input->name();
+    }
+    return result;
+}
+
+// One input metric as a real sensor would report it
+class SimulatedInput
+{
+public:
+    SimulatedInput(std::string name, metricq::TimePoint start, std::uint64_t seed)
+    : name(std::move(name)), rng_(seed), start_(start)
+    {
+        // Periods between 5s and 60s, clocks off by up to 200 ppm, delivery lags up to 30s
+        static constexpr std::array<double, 4> periods = { 5e9, 10e9, 10e9, 60e9 };
+        period_ = periods[rng_() % periods.size()] *
+                  (1 + std::uniform_real_distribution<double>(-2e-4, 2e-4)(rng_));
+        lag = std::chrono::seconds(rng_() % 31);
+        advance();
+    }
+
+    // Append all values that were delivered by now
+    void deliver(metricq::TimePoint now, std::vector<metricq::TimeValue>& values)
+    {
+        while (next_time_ + lag <= now)
+        {
+            values.push_back({ next_time_, next_value() });
+            advance();
+        }
+    }
+
+    std::string name;
+    metricq::Duration lag;
+
+private:
+    void advance()
+    {
+        nominal_ += period_;
+        if (std::uniform_real_distribution<double>()(rng_) < 1e-4)
+        {
+            // A gap of one minute to two hours
+            nominal_ += std::uniform_real_distribution<double>(60e9, 7200e9)(rng_);
+        }
+        auto jitter = std::normal_distribution<double>(0, 0.02 * period_)(rng_);
+        auto time = start_ + metricq::Duration(static_cast<std::int64_t>(nominal_ + jitter));
+        next_time_ = std::max(time, next_time_ + metricq::Duration(1));
+    }
+
+    metricq::Value next_value()
+    {
+        level_ += std::normal_distribution<double>(0, 1)(rng_);
+        if (nan_burst_ > 0)
+        {
+            nan_burst_--;
+            return std::nan("");
+        }
+        if (std::uniform_real_distribution<double>()(rng_) < 2e-4)
+        {
+            nan_burst_ = 1 + rng_() % 50;
+        }
+        return level_;
+    }
+
+    std::mt19937_64 rng_;
+    metricq::TimePoint start_;
+    double period_;
+    double nominal_ = 0;
+    metricq::TimePoint next_time_;
+    double level_ = 100;
+    std::size_t nan_burst_ = 0;
+};
+
+// Discards output values, only counting them
+struct CountingConsumer : SpanConsumer
+{
+    void consume(const metricq::TimeValue*, std::size_t count) override
+    {
+        values += count;
+    }
+
+    std::size_t values = 0;
+};
+
+class SoakTest
+{
+public:
+    struct Options
+    {
+        std::size_t combined_metrics = 200;
+        std::size_t days = 21;
+    };
+
+    explicit SoakTest(const Options& options) : options_(options), rng_(5)
+    {
+    }
+
+    void run()
+    {
+        metricq::TimePoint start(std::chrono::seconds(1'600'000'000));
+        configure(start);
+
+        std::vector<NodeStats> stats;
+        for (std::size_t m = 0; m < metrics_.size(); ++m)
+        {
+            auto nodes = metrics_[m].metric.collect_nodes();
+            for (std::size_t i = 0; i < nodes.size(); ++i)
+            {
+                stats.push_back({ nodes[i], m, i, std::numeric_limits<std::size_t>::max(), {}, 0 });
+            }
+        }
+        std::cerr << "Configured " << metrics_.size() << " combined metrics with "
+                  << inputs_.size() << " inputs and " << stats.size() << " nodes\n";
+
+        // The broker delivers input once per minute, updates run after each delivery
+        constexpr auto round = std::chrono::minutes(1);
+        constexpr std::size_t rounds_per_day = 24 * 60;
+        std::vector<std::size_t> total_maxima(options_.days);
+        std::size_t day1_memory = 0;
+        std::size_t input_values = 0;
+        CountingConsumer output;
+        std::vector<metricq::TimeValue> values;
+        auto started = Clock::now();
+
+        for (std::size_t r = 1; r <= options_.days * rounds_per_day; ++r)
+        {
+            auto now = start + r * round;
+            for (std::size_t i = 0; i < inputs_.size(); ++i)
+            {
+                values.clear();
+                inputs_[i].deliver(now, values);
+                input_values += values.size();
+                for (auto tv : values)
+                {
+                    for (auto* node : consumers_[i])
+                    {
+                        node->put(tv);
+                    }
+                }
+            }
+            for (auto& combined : metrics_)
+            {
+                combined.metric.update();
+                for (const auto& [suffix, node] : combined.metric.outputs())
+                {
+                    node->drain(output);
+                }
+            }
+
+            auto day = (r - 1) / rounds_per_day;
+            std::size_t total = 0;
+            for (auto& node : stats)
+            {
+                auto length = node.node->queue_length();
+                total += length;
+                node.day_minimum = std::min(node.day_minimum, length);
+                node.maximum = std::max(node.maximum, length);
+            }
+            total_maxima[day] = std::max(total_maxima[day], total);
+
+            if (r % rounds_per_day == 0)
+            {
+                for (auto& node : stats)
+                {
+                    node.daily_minima.push_back(node.day_minimum);
+                    node.day_minimum = std::numeric_limits<std::size_t>::max();
+                }
+                if (day == 0)
+                {
+                    day1_memory = resident_memory();
+                }
+                std::cerr << "`-- day " << day + 1 << ": at most " << total_maxima[day]
+                          << " queued values, " << resident_memory() / 1e6 << " MB resident\n";
+            }
+        }
+
+        auto elapsed = Seconds(Clock::now() - started).count();
+        auto memory = resident_memory();
+        std::cerr << "Simulated " << options_.days << " days in " << elapsed << " s: "
+                  << input_values << " input values, " << output.values << " output values\n";
+        check(output.values > 0);
+
+        // The first day fills windows and lines up lags, afterwards nothing may keep growing
+        std::cerr << "Checking for nodes whose queues creep...\n";
+        std::size_t creeping = 0;
+        for (const auto& node : stats)
+        {
+            auto first = node.daily_minima.at(1);
+            auto last = node.daily_minima.back();
+            if (last > first + creep_limit)
+            {
+                creeping++;
+                std::cerr << "`-- " << metrics_[node.metric].name << ", node " << node.index
+                          << " (" << describe(*node.node) << "): at least " << first
+                          << " queued values on day 2, " << last << " on day " << options_.days
+                          << ", at most " << node.maximum << '\n';
+            }
+        }
+        check(creeping == 0);
+
+        std::cerr << "Checking that the total queue length is bounded...\n";
+        auto half = options_.days / 2;
+        auto first_half = *std::max_element(total_maxima.begin() + 1, total_maxima.begin() + half);
+        auto second_half = *std::max_element(total_maxima.begin() + half, total_maxima.end());
+        std::cerr << "`-- at most " << first_half << " queued values in the first half, "
+                  << second_half << " in the second\n";
+        check(second_half <= 2 * first_half + creep_limit * metrics_.size());
+
+        std::cerr << "Checking that memory is bounded...\n";
+        std::cerr << "`-- " << day1_memory / 1e6 << " MB resident after a day, " << memory / 1e6
+                  << " MB at the end\n";
+        check(memory <= day1_memory + day1_memory / 4 + 16 * 1024 * 1024);
+    }
+
+private:
+    // How much the smallest queue length of a node may rise from the second to the last day
+    static constexpr std::size_t creep_limit = 16;
+
+    struct Metric
+    {
+        std::string name;
+        CombinedMetric metric;
+    };
+
+    struct NodeStats
+    {
+        const InputNode* node;
+        std::size_t metric;
+        // Depth-first, see CombinedMetric::collect_nodes()
+        std::size_t index;
+        std::size_t day_minimum;
+        std::vector<std::size_t> daily_minima;
+        std::size_t maximum;
+    };
+
+    // A mix of all kinds of operations on inputs shared between combined metrics
+    void configure(metricq::TimePoint start)
+    {
+        auto input_count = std::max<std::size_t>(16, options_.combined_metrics / 2);
+        std::unordered_map<std::string, std::size_t> input_index;
+        for (std::size_t i = 0; i < input_count; ++i)
+        {
+            auto name = "soak.input" + std::to_string(i);
+            input_index[name] = i;
+            inputs_.emplace_back(name, start, rng_());
+        }
+        consumers_.resize(input_count);
+
+        auto input = [&]() { return "soak.input" + std::to_string(rng_() % input_count); };
+        auto inputs = [&](std::size_t count) {
+            auto result = metricq::json::array();
+            while (result.size() < count)
+            {
+                auto name = input();
+                if (std::find(result.begin(), result.end(), name) == result.end())
+                {
+                    result.push_back(name);
+                }
+            }
+            return result;
+        };
+
+        for (std::size_t i = 0; i < options_.combined_metrics; ++i)
+        {
+            metricq::json expression;
+            switch (i % 10)
+            {
+            case 0:
+                expression = { { "operation", "-" }, { "left", input() }, { "right", input() } };
+                break;
+            case 1:
+                expression = { { "operation", "sum" },
+                               { "inputs", inputs(8) },
+                               { "tolerance", "2s" } };
+                break;
+            case 2:
+                expression = { { "operation", "max" },
+                               { "inputs", inputs(4) },
+                               { "hold", "5min" } };
+                break;
+            case 3:
+                expression = { { "operation", "/" },
+                               { "left", { { "operation", "sum" }, { "inputs", inputs(4) } } },
+                               { "right",
+                                 { { "operation", "+" }, { "left", input() }, { "right", 1 } } } };
+                break;
+            case 4:
+                expression = { { "operation", "throttle" },
+                               { "cooldown_period", "1min" },
+                               { "input", input() } };
+                break;
+            case 5:
+                expression = { { "operation", "median" },
+                               { "window", "15min" },
+                               { "input", input() } };
+                break;
+            case 6:
+                expression = { { "operation", "deadband" },
+                               { "threshold", 2 },
+                               { "max_silence", "1h" },
+                               { "input", input() } };
+                break;
+            case 7:
+                expression = { { "operation", "swinging_door" },
+                               { "deviation", 0.5 },
+                               { "input", input() } };
+                break;
+            case 8:
+                expression = { { "operation", "aggregate" },
+                               { "inputs", inputs(6) },
+                               { "outputs", { "min", "max", "mean" } } };
+                break;
+            default:
+                expression = { { "operation", "*" }, { "left", input() }, { "right", 1.5 } };
+            }
+            metrics_.push_back({ "soak.combined" + std::to_string(i), CombinedMetric(expression) });
+        }
+
+        for (auto& combined : metrics_)
+        {
+            for (auto& [input_id, nodes] : combined.metric.collect_metric_inputs())
+            {
+                auto& consumers = consumers_[input_index.at(MetricIds::global().name(input_id))];
+                consumers.insert(consumers.end(), nodes.begin(), nodes.end());
+            }
+        }
+    }
+
+    Options options_;
+    std::mt19937_64 rng_;
+    std::vector<SimulatedInput> inputs_;
+    // The input nodes fed by each input
+    std::vector<std::vector<MetricInputNode*>> consumers_;
+    std::vector<Metric> metrics_;
+};
+
+int main(int argc, const char* argv[])
+{
+    SoakTest::Options options;
+    if (argc > 1)
+    {
+        options.combined_metrics = std::stoul(argv[1]);
+    }
+    if (argc > 2)
+    {
+        options.days = std::stoul(argv[2]);
+    }
+    check(options.days >= 4);
+
+    SoakTest test(options);
+    test.run();
+
+    return 0;
+}
@@ -0,0 +1,257 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <metricq/json.hpp>
+
+#include "../src/aggregates.hpp"
+#include "../src/combined_metric.hpp"
+#include "../src/indexed_heap.hpp"
+
+static void check(bool passed)
+{
+    if (!passed)
+    {
+        std::cerr << "!!! CHECK FAILED !!!\n";
+        std::exit(1);
+    }
+}
+
+constexpr metricq::TimePoint t(double seconds)
+{
+    using duration = metricq::TimePoint::duration;
+    return metricq::TimePoint(duration(static_cast<duration::rep>(seconds * 1e9)));
+}
+
+static bool same(metricq::Value expected, metricq::Value actual)
+{
+    if (std::isnan(expected) || std::isinf(expected))
+    {
+        return std::isnan(expected) ? std::isnan(actual) : expected == actual;
+    }
+    // The naive sum has larger rounding errors than the compensated one
+    return std::abs(expected - actual) <= 1e-3 + 1e-12 * std::abs(expected);
+}
+
+static void test_indexed_heap()
+{
+    std::cerr << "Testing IndexedHeap...\n";
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<int> keys(0, 1000);
+    std::vector<std::optional<int>> reference(64);
+    IndexedHeap<int> heap(reference.size());
+
+    for (int step = 0; step < 100000; ++step)
+    {
+        auto index = rng() % reference.size();
+        if (rng() % 4 == 0)
+        {
+            heap.erase(index);
+            reference[index].reset();
+        }
+        else
+        {
+            auto key = keys(rng);
+            heap.set(index, key);
+            reference[index] = key;
+        }
+
+        auto expected = std::min_element(reference.begin(), reference.end(),
+                                         [](const auto& a, const auto& b) {
+                                             return a && (!b || *a < *b);
+                                         });
+        auto count = std::count_if(reference.begin(), reference.end(),
+                                   [](const auto& key) { return key.has_value(); });
+        check(heap.size() == static_cast<std::size_t>(count));
+        check(heap.empty() || heap.top_key() == **expected);
+    }
+}
+
+static void test_running_sum()
+{
+    std::cerr << "Testing RunningSum with cancelling values...\n";
+    RunningSum sum;
+    sum.add(1e17);
+    sum.add(1);
+    sum.add(-1e17);
+    check(sum.value() == 1);
+
+    sum.add(std::numeric_limits<double>::infinity());
+    check(sum.value() == std::numeric_limits<double>::infinity());
+    sum.add(-std::numeric_limits<double>::infinity());
+    check(std::isnan(sum.value()));
+    sum.remove(std::numeric_limits<double>::infinity());
+    check(sum.value() == -std::numeric_limits<double>::infinity());
+    sum.replace(-std::numeric_limits<double>::infinity(), std::nan(""));
+    check(sum.value() == 1);
+}
+
+// Compare incremental variadic nodes against combining all input values the naive way
+static void test_variadic(const std::string& operation,
+                          std::function<double(const std::vector<double>&)> naive)
+{
+    std::cerr << "Testing " << operation << " against naive computation...\n";
+    constexpr std::size_t input_count = 500;
+    constexpr std::size_t steps = 2000;
+
+    metricq::json inputs = metricq::json::array();
+    for (std::size_t i = 0; i < input_count; ++i)
+    {
+        inputs.push_back("input" + std::to_string(i));
+    }
+    CombinedMetric combined({ { "operation", operation }, { "inputs", inputs } });
+    auto metric_inputs = combined.collect_metric_inputs();
+
+    std::mt19937_64 rng(1234);
+    std::normal_distribution<double> values(0, 1e6);
+    std::vector<std::vector<metricq::TimeValue>> sent(input_count);
+    for (std::size_t i = 0; i < input_count; ++i)
+    {
+        for (std::size_t step = 1; step <= steps; ++step)
+        {
+            // Each input sees only some of the steps, with NaNs and infinities mixed in
+            if (rng() % 3 != 0 && step != steps)
+            {
+                continue;
+            }
+            double value = values(rng);
+            if (rng() % 50 == 0)
+            {
+                value = std::nan("");
+            }
+            else if (rng() % 5000 == 0)
+            {
+                value = (rng() % 2 ? 1 : -1) * std::numeric_limits<double>::infinity();
+            }
+            metricq::TimeValue tv{ t(step), value };
+            sent[i].push_back(tv);
+            metric_inputs.at("input" + std::to_string(i)).at(0)->put(tv);
+        }
+    }
+    combined.update();
+
+    // Without holding values, the output has a value at every time any input has one
+    std::vector<std::size_t> next(input_count, 0);
+    auto& output = combined.input();
+    std::size_t checked = 0;
+    while (output.has_input())
+    {
+        auto out = output.peek();
+        output.discard();
+
+        std::vector<double> current;
+        for (std::size_t i = 0; i < input_count; ++i)
+        {
+            auto value = sent[i][next[i]].value;
+            if (!std::isnan(value))
+            {
+                current.push_back(value);
+            }
+            if (sent[i][next[i]].time == out.time)
+            {
+                next[i]++;
+            }
+        }
+        auto expected = current.empty() ? std::nan("") : naive(current);
+        if (!same(expected, out.value))
+        {
+            std::cerr << "`-- Mismatch at " << out.time.time_since_epoch().count() << ": "
+                      << expected << " != " << out.value << '\n';
+            check(false);
+        }
+        checked++;
+    }
+    std::cerr << "`-- Checked " << checked << " values\n";
+    check(checked == steps);
+}
+
+static void test_aggregate_outputs()
+{
+    std::cerr << "Testing aggregate with multiple outputs...\n";
+    CombinedMetric combined({ { "operation", "aggregate" },
+                              { "inputs", { "foo", "bar", "baz" } },
+                              { "outputs", { "max", "mean", "count_valid" } } });
+
+    const auto& outputs = combined.outputs();
+    check(outputs.size() == 3);
+    check(outputs[0].first == ".max" && outputs[1].first == ".mean" &&
+          outputs[2].first == ".count_valid");
+
+    auto inputs = combined.collect_metric_inputs();
+    inputs.at("foo").at(0)->put({ t(1), 1 });
+    inputs.at("bar").at(0)->put({ t(1), 5 });
+    inputs.at("baz").at(0)->put({ t(1), std::nan("") });
+    inputs.at("foo").at(0)->put({ t(2), std::nan("") });
+    inputs.at("bar").at(0)->put({ t(2), std::nan("") });
+    inputs.at("baz").at(0)->put({ t(2), std::nan("") });
+    combined.update();
+
+    std::vector<std::vector<double>> expected = { { 5, 3, 2 }, { std::nan(""), std::nan(""), 0 } };
+    for (const auto& values : expected)
+    {
+        for (std::size_t i = 0; i < outputs.size(); ++i)
+        {
+            auto& output = *outputs[i].second;
+            check(output.has_input());
+            std::cerr << "`-- Checking " << outputs[i].first << ": " << values[i]
+                      << " == " << output.peek().value << '\n';
+            check(same(values[i], output.peek().value));
+            output.discard();
+        }
+    }
+
+    std::cerr << "Checking that aggregates are not allowed as inputs...\n";
+    try
+    {
+        CombinedMetric nested({ { "operation", "-" },
+                                { "left", { { "operation", "aggregate" }, { "inputs", { "a" } } } },
+                                { "right", "b" } });
+        check(false);
+    }
+    catch (const CombinedMetric::ParseError&)
+    {
+    }
+
+    std::cerr << "Checking that duplicate outputs are rejected...\n";
+    try
+    {
+        CombinedMetric duplicate({ { "operation", "aggregate" },
+                                   { "inputs", { "a", "b" } },
+                                   { "outputs", { "min", "max", "min" } } });
+        check(false);
+    }
+    catch (const CombinedMetric::ParseError&)
+    {
+    }
+}
+
+int main()
+{
+    test_indexed_heap();
+    test_running_sum();
+
+    test_variadic("sum", [](const auto& values) {
+        double sum = 0;
+        for (auto value : values)
+        {
+            sum += value;
+        }
+        return sum;
+    });
+    test_variadic("min", [](const auto& values) {
+        return *std::min_element(values.begin(), values.end());
+    });
+    test_variadic("max", [](const auto& values) {
+        return *std::max_element(values.begin(), values.end());
+    });
+
+    test_aggregate_outputs();
+
+    return 0;
+}
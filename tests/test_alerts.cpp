@@ -0,0 +1,155 @@
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include <metricq/json.hpp>
+
+#include "../src/combined_metric.hpp"
+
+static void check(bool passed)
+{
+    if (!passed)
+    {
+        std::cerr << "!!! CHECK FAILED !!!\n";
+        std::exit(1);
+    }
+}
+
+constexpr metricq::TimePoint t(double seconds)
+{
+    using duration = metricq::TimePoint::duration;
+    return metricq::TimePoint(duration(static_cast<duration::rep>(seconds * 1e9)));
+}
+
+static bool same(metricq::Value a, metricq::Value b)
+{
+    return a == b || (std::isnan(a) && std::isnan(b));
+}
+
+// Feeds the values of "power" and "limit" (at the same times) and returns all output values
+static std::vector<metricq::Value> run(const metricq::json& config,
+                                       const std::vector<metricq::Value>& power,
+                                       const std::vector<metricq::Value>& limit = {})
+{
+    CombinedMetric combined(config);
+    auto inputs = combined.collect_metric_inputs();
+    for (std::size_t i = 0; i < power.size(); ++i)
+    {
+        for (auto* node : inputs.at("power"))
+        {
+            node->put({ t(i + 1), power[i] });
+        }
+        if (!limit.empty())
+        {
+            for (auto* node : inputs.at("limit"))
+            {
+                node->put({ t(i + 1), limit[i] });
+            }
+        }
+    }
+    combined.update();
+
+    std::vector<metricq::Value> result;
+    auto& output = combined.input();
+    while (output.has_input())
+    {
+        result.push_back(output.peek().value);
+        output.discard();
+    }
+    return result;
+}
+
+static void check_values(const std::vector<metricq::Value>& output,
+                         const std::vector<metricq::Value>& expected)
+{
+    std::cerr << "`--";
+    for (auto value : output)
+    {
+        std::cerr << ' ' << value;
+    }
+    std::cerr << '\n';
+    check(output.size() == expected.size());
+    for (std::size_t i = 0; i < expected.size(); ++i)
+    {
+        check(same(output[i], expected[i]));
+    }
+}
+
+static void test_comparisons()
+{
+    auto nan = std::nan("");
+    std::vector<metricq::Value> power = { 1, 2, 3, nan };
+    std::vector<metricq::Value> limit = { 2, 2, 2, 2 };
+    std::vector<std::pair<std::string, std::vector<metricq::Value>>> cases = {
+        { ">", { 0, 0, 1, nan } },  { "<", { 1, 0, 0, nan } },  { ">=", { 0, 1, 1, nan } },
+        { "<=", { 1, 1, 0, nan } }, { "==", { 0, 1, 0, nan } },
+    };
+    for (const auto& [op, expected] : cases)
+    {
+        std::cerr << "Testing " << op << "...\n";
+        check_values(
+            run({ { "operation", op }, { "left", "power" }, { "right", "limit" } }, power, limit),
+            expected);
+    }
+}
+
+static void test_select()
+{
+    std::cerr << "Testing select...\n";
+    auto nan = std::nan("");
+    metricq::json condition = { { "operation", ">" }, { "left", "power" }, { "right", "limit" } };
+    metricq::json config = {
+        { "operation", "select" }, { "condition", condition }, { "then", "power" }, { "else", 0 }
+    };
+    check_values(run(config, { 1, 3, nan, 5 }, { 2, 2, 2, 2 }), { 0, 3, nan, 5 });
+
+    std::cerr << "Testing that the selected value may be NaN...\n";
+    config["else"] = "limit";
+    check_values(run(config, { 1, 3 }, { nan, 2 }), { nan, 3 });
+}
+
+static void test_clamp()
+{
+    std::cerr << "Testing clamp...\n";
+    auto nan = std::nan("");
+    metricq::json config = {
+        { "operation", "clamp" }, { "input", "power" }, { "min", 0 }, { "max", 10 }
+    };
+    check_values(run(config, { -5, 5, 15, nan }), { 0, 5, 10, nan });
+
+    std::cerr << "Testing clamp with a single bound from a metric...\n";
+    check_values(run({ { "operation", "clamp" }, { "input", "power" }, { "max", "limit" } },
+                     { -5, 5, 15 }, { 10, nan, 10 }),
+                 { -5, 5, 10 });
+
+    std::cerr << "Testing that clamp needs a bound...\n";
+    try
+    {
+        CombinedMetric combined({ { "operation", "clamp" }, { "input", "power" } });
+        check(false);
+    }
+    catch (const CombinedMetric::ParseError&)
+    {
+    }
+}
+
+static void test_change_only()
+{
+    std::cerr << "Testing an alert that is only sent on changes...\n";
+    metricq::json alert = { { "operation", "deadband" },
+                            { "threshold", 0 },
+                            { "input",
+                              { { "operation", ">" }, { "left", "power" }, { "right", 100 } } } };
+    // The last value before each change is sent along with the change
+    check_values(run(alert, { 50, 60, 70, 150, 160, 170, 80, 90 }), { 0, 0, 1, 1, 0 });
+}
+
+int main()
+{
+    test_comparisons();
+    test_select();
+    test_clamp();
+    test_change_only();
+
+    return 0;
+}
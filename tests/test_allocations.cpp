@@ -0,0 +1,170 @@
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <metricq/json.hpp>
+
+#include "../src/combined_metric.hpp"
+#include "../src/update_scheduler.hpp"
+
+// Count all allocations of the whole program, this test is single-threaded
+static std::size_t allocations = 0;
+
+void* operator new(std::size_t size)
+{
+    allocations++;
+    if (void* pointer = std::malloc(size == 0 ? 1 : size))
+    {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+// Not inlined, so that the compiler does not see memory from new passed to free
+[[gnu::noinline]] static void release(void* pointer)
+{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    release(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+    release(pointer);
+}
+
+static void check(bool passed)
+{
+    if (!passed)
+    {
+        std::cerr << "!!! CHECK FAILED !!!\n";
+        std::exit(1);
+    }
+}
+
+constexpr metricq::TimePoint t(double seconds)
+{
+    using duration = metricq::TimePoint::duration;
+    return metricq::TimePoint(duration(static_cast<duration::rep>(seconds * 1e9)));
+}
+
+/*
+ * Feed steps of input to a combined metric and drain its outputs like the combinator does.
+ * Each input reports a varying number of values per step, at slightly different times.
+ * Returns the number of values put into the combined metric.
+ */
+static std::size_t feed(CombinedMetric& combined, MetricInputNodes& inputs, std::mt19937_64& rng,
+                        std::size_t& step, std::size_t steps)
+{
+    std::size_t values = 0;
+    for (std::size_t end = step + steps; step < end; ++step)
+    {
+        for (auto& [id, nodes] : inputs)
+        {
+            auto count = 1 + rng() % 8;
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                auto time = t(static_cast<double>(step) + (i + (rng() % 100) / 100.0) / count);
+                auto value = rng() % 50 == 0 ? std::nan("") : static_cast<double>(rng() % 1000);
+                for (auto* node : nodes)
+                {
+                    node->put({ time, value });
+                }
+                values++;
+            }
+        }
+
+        combined.update();
+        for (const auto& [suffix, output] : combined.outputs())
+        {
+            while (output->has_input())
+            {
+                output->discard();
+            }
+        }
+    }
+    return values;
+}
+
+static void check_steady_state(const std::string& description, const metricq::json& expression)
+{
+    CombinedMetric combined(expression);
+    auto inputs = combined.collect_metric_inputs();
+    std::mt19937_64 rng(42);
+    std::size_t step = 1;
+
+    // Buffers grow to the largest size they need during warm-up
+    feed(combined, inputs, rng, step, 2000);
+
+    auto before = allocations;
+    auto values = feed(combined, inputs, rng, step, 10000);
+    auto allocated = allocations - before;
+    std::cerr << "`-- " << description << ": " << allocated << " allocations for " << values
+              << " values\n";
+    check(allocated == 0);
+}
+
+static void test_expressions()
+{
+    std::cerr << "Checking that updating expressions allocates no memory in steady state...\n";
+    metricq::json inputs = { "a", "b", "c", "d" };
+    check_steady_state("binary",
+                       { { "operation", "+" },
+                         { "left", { { "operation", "*" }, { "left", "a" }, { "right", 2 } } },
+                         { "right", "b" } });
+    check_steady_state("sum", { { "operation", "sum" }, { "inputs", inputs } });
+    check_steady_state("max with hold",
+                       { { "operation", "max" }, { "inputs", inputs }, { "hold", "10s" } });
+    check_steady_state("median", { { "operation", "median" }, { "inputs", inputs } });
+    check_steady_state("median over time",
+                       { { "operation", "median" }, { "window", "10s" }, { "input", "a" } });
+    check_steady_state("aggregate", { { "operation", "aggregate" }, { "inputs", inputs } });
+    check_steady_state(
+        "throttle",
+        { { "operation", "throttle" }, { "cooldown_period", "5s" }, { "input", "a" } });
+    check_steady_state("deadband", { { "operation", "deadband" },
+                                     { "threshold", 100 },
+                                     { "max_silence", "30s" },
+                                     { "input", "a" } });
+    check_steady_state("swinging door",
+                       { { "operation", "swinging_door" }, { "deviation", 50 }, { "input", "a" } });
+}
+
+static void test_scheduler()
+{
+    std::cerr << "Checking that scheduling updates allocates no memory in steady state...\n";
+    UpdateScheduler<int> scheduler(std::chrono::hours(1), std::chrono::hours(1));
+    std::vector<int> items(100);
+    auto cycle = [&]() {
+        for (auto& item : items)
+        {
+            scheduler.schedule(item, Priority::normal, std::chrono::steady_clock::now());
+        }
+        scheduler.run([](int& item) { item++; }, [](int&, auto) {});
+    };
+    cycle();
+
+    auto before = allocations;
+    for (int i = 0; i < 1000; ++i)
+    {
+        cycle();
+    }
+    std::cerr << "`-- " << allocations - before << " allocations\n";
+    check(allocations == before);
+}
+
+int main()
+{
+    test_expressions();
+    test_scheduler();
+
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <metricq/json.hpp>
+
+#include "../src/backfill.hpp"
+#include "../src/column_file.hpp"
+
+static void check(bool passed)
+{
+    if (!passed)
+    {
+        std::cerr << "!!! CHECK FAILED !!!\n";
+        std::exit(1);
+    }
+}
+
+constexpr metricq::TimePoint t(double seconds)
+{
+    using duration = metricq::TimePoint::duration;
+    return metricq::TimePoint(duration(static_cast<duration::rep>(seconds * 1e9)));
+}
+
+static bool identical(const Backfill::Series& a, const Backfill::Series& b)
+{
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+    for (std::size_t i = 0; i < a.size(); ++i)
+    {
+        if (a[i].time != b[i].time || std::memcmp(&a[i].value, &b[i].value, sizeof(double)) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_column_file()
+{
+    std::cerr << "Testing round trip through a column file...\n";
+    Backfill::Series series = { { t(1), 1.5 }, { t(2), std::nan("") }, { t(3.25), -7 } };
+    auto path = (std::filesystem::temp_directory_path() / "test_backfill.col").string();
+    ColumnFile::write(path, series);
+    check(identical(ColumnFile::read(path), series));
+
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+    try
+    {
+        ColumnFile::read(path);
+        check(false);
+    }
+    catch (const ColumnFileError&)
+    {
+    }
+    std::filesystem::remove(path);
+}
+
+static Backfill::SeriesByName inputs()
+{
+    // Three days of two inputs, reporting every 5s at slightly different times
+    Backfill::SeriesByName series;
+    for (int i = 1; i <= 3 * 24 * 720; ++i)
+    {
+        series["a"].push_back({ t(i * 5.0), 100 + 50 * std::sin(i * 0.001) + i % 7 });
+        series["b"].push_back({ t(i * 5.0 + 0.5), i % 1000 == 0 ? std::nan("") : i % 13 });
+    }
+    return series;
+}
+
+// Evaluate in one chunk and in chunks of a day on 4 threads, which must give identical results
+static Backfill::Stats check_chunked(const metricq::json& metrics, Backfill::SeriesByName& serial)
+{
+    std::cerr << "Evaluating " << metrics.size() << " metric(s) in one chunk...\n";
+    BackfillSettings settings;
+    settings.chunk = std::chrono::hours(24 * 1000);
+    settings.threads = 1;
+    serial = inputs();
+    Backfill serial_backfill(settings);
+    auto names = serial_backfill.run(metrics, serial);
+    check(serial_backfill.stats().chunks == metrics.size());
+
+    std::cerr << "Evaluating in chunks of a day on 4 threads...\n";
+    settings.chunk = std::chrono::hours(24);
+    settings.warmup = std::chrono::hours(1);
+    settings.threads = 4;
+    auto parallel = inputs();
+    Backfill parallel_backfill(settings);
+    check(parallel_backfill.run(metrics, parallel) == names);
+
+    auto stats = parallel_backfill.stats();
+    std::cerr << "`-- " << stats.chunks << " chunks, " << stats.reruns << " reruns\n";
+    check(stats.chunks > metrics.size());
+
+    for (const auto& name : names)
+    {
+        std::cerr << "`-- Checking that " << serial.at(name).size() << " values of " << name
+                  << " are identical...\n";
+        check(!serial.at(name).empty());
+        check(identical(serial.at(name), parallel.at(name)));
+    }
+    return stats;
+}
+
+int main()
+{
+    test_column_file();
+
+    Backfill::SeriesByName serial;
+    auto stats = check_chunked(
+        {
+            { "sum",
+              { { "expression", { { "operation", "+" }, { "left", "a" }, { "right", "b" } } } } },
+            { "sum.throttled",
+              { { "expression",
+                  { { "operation", "throttle" },
+                    { "cooldown_period", "1min" },
+                    { "input", "sum" } } } } },
+            { "a.deadband",
+              { { "expression",
+                  { { "operation", "deadband" }, { "threshold", 10 }, { "input", "a" } } } } },
+        },
+        serial);
+    check(serial.at("sum.throttled").size() < serial.at("sum").size());
+
+    std::cerr << "Checking that sums and aggregates do not need to be evaluated again...\n";
+    stats = check_chunked(
+        {
+            { "total",
+              { { "expression",
+                  { { "operation", "sum" }, { "inputs", { "a", "b" } }, { "hold", "10s" } } } } },
+            { "ab",
+              { { "expression",
+                  { { "operation", "aggregate" },
+                    { "inputs", { "a", "b" } },
+                    { "outputs", { "sum", "mean" } } } } } },
+        },
+        serial);
+    check(stats.reruns == 0);
+
+    std::cerr << "Checking that windows longer than the warmup are evaluated again...\n";
+    stats = check_chunked(
+        {
+            { "b.median",
+              { { "expression",
+                  { { "operation", "median" }, { "window", "5h" }, { "input", "b" } } } } },
+        },
+        serial);
+    check(stats.reruns > 0);
+
+    std::cerr << "Checking that circular dependencies are rejected...\n";
+    try
+    {
+        Backfill backfill(BackfillSettings{});
+        backfill.run({ { "x", { { "expression", { { "operation", "throttle" },
+                                                  { "cooldown_period", "1s" },
+                                                  { "input", "x" } } } } } },
+                     serial);
+        check(false);
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+
+    return 0;
+}
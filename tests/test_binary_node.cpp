@@ -0,0 +1,122 @@
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "../src/binary_node.hpp"
+
+static std::ostream& operator<<(std::ostream& os, metricq::TimeValue tv)
+{
+    return os << "TimeValue { time: " << tv.time.time_since_epoch().count()
+              << ", value: " << tv.value << " }";
+}
+
+static void check(bool passed)
+{
+    if (!passed)
+    {
+        std::cerr << "!!! CHECK FAILED !!!\n";
+        std::exit(1);
+    }
+}
+
+constexpr metricq::TimePoint t(double seconds)
+{
+    using duration = metricq::TimePoint::duration;
+    return metricq::TimePoint(duration(static_cast<duration::rep>(seconds * 1e9)));
+}
+
+// Repeated and late values, which are dropped when holding, and NaNs
+static const std::vector<metricq::TimeValue> input_values = {
+    { t(1), 4 },   { t(2), -2 },          { t(2), 3 },  { t(3), std::nan("") },
+    { t(2.5), 7 }, { t(4), 0 },           { t(5), 10 }, { t(6), std::nan("") },
+    { t(7), 0.5 }, { t(7.5), -1e300 },
+};
+
+static std::vector<metricq::TimeValue> evaluate(BinaryNode& node, InputQueue& input)
+{
+    std::vector<metricq::TimeValue> result;
+    // Feed the input in two parts, so that the second one is checked against the last output
+    for (auto part : { std::make_pair(0, 3), std::make_pair(3, 10) })
+    {
+        for (auto i = part.first; i < part.second; ++i)
+        {
+            input.put(input_values[i]);
+        }
+        node.update();
+        while (node.has_input())
+        {
+            result.push_back(node.peek());
+            node.discard();
+        }
+    }
+    return result;
+}
+
+template <typename Operator, bool ConstantLeft>
+static void test_constant_operand(const char* name, metricq::Value constant, bool hold)
+{
+    std::cerr << "Testing " << name << " with a constant on the "
+              << (ConstantLeft ? "left" : "right") << (hold ? ", holding values" : "") << "...\n";
+    NodeArena arena(4096);
+    JoinOptions options;
+    if (hold)
+    {
+        options.hold = std::chrono::seconds(10);
+    }
+
+    // Built like the parser does, with the constant on the given side
+    auto make = [&](bool specialized, InputQueue*& input) {
+        auto queue = arena.make<InputQueue>();
+        input = queue.get();
+        NodePtr<InputNode> other = std::move(queue);
+        NodePtr<InputNode> constant_input = arena.make<ConstantInput>(constant);
+        auto left = ConstantLeft ? std::move(constant_input) : std::move(other);
+        auto right = ConstantLeft ? std::move(other) : std::move(constant_input);
+        if (specialized)
+        {
+            return make_binary_node<Operator>(arena, std::move(left), std::move(right), options);
+        }
+        return NodePtr<BinaryNode>(arena.make<BinaryOperatorNode<Operator>>(
+            std::move(left), std::move(right), options));
+    };
+
+    InputQueue* specialized_input;
+    InputQueue* generic_input;
+    auto specialized = make(true, specialized_input);
+    auto generic = make(false, generic_input);
+    check(dynamic_cast<ConstantOperandNode<Operator, ConstantLeft>*>(specialized.get()) != nullptr);
+
+    auto expected = evaluate(*generic, *generic_input);
+    auto actual = evaluate(*specialized, *specialized_input);
+    check(hold ? expected.size() < input_values.size() : expected.size() == input_values.size());
+    check(expected.size() == actual.size());
+    for (std::size_t i = 0; i < expected.size(); ++i)
+    {
+        std::cerr << "`-- Checking: " << expected[i] << " == " << actual[i] << '\n';
+        check(expected[i].time == actual[i].time);
+        check(std::memcmp(&expected[i].value, &actual[i].value, sizeof(double)) == 0);
+    }
+}
+
+template <typename Operator>
+static void test_operator(const char* name, metricq::Value constant)
+{
+    for (bool hold : { false, true })
+    {
+        test_constant_operand<Operator, true>(name, constant, hold);
+        test_constant_operand<Operator, false>(name, constant, hold);
+    }
+}
+
+int main()
+{
+    test_operator<AddOperator>("+", 2);
+    test_operator<AddOperator>("+ with a NaN constant", std::nan(""));
+    test_operator<SubtractOperator>("-", 2);
+    test_operator<DivideOperator>("/", 0.5);
+    test_operator<LessOperator>("<", 3);
+
+    return 0;
+}
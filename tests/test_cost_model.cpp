@@ -0,0 +1,116 @@
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <metricq/json.hpp>
+
+#include "../src/cost_model.hpp"
+
+static void check(bool passed)
+{
+    if (!passed)
+    {
+        std::cerr << "!!! CHECK FAILED !!!\n";
+        std::exit(1);
+    }
+}
+
+static bool near(double value, double expected)
+{
+    return std::abs(value - expected) <= 1e-9 * std::abs(expected);
+}
+
+int main()
+{
+    std::unordered_map<std::string, double> rates = { { "fast", 1000 }, { "slow", 0.01 } };
+    metricq::json many = metricq::json::array();
+    for (int i = 0; i < 5000; ++i)
+    {
+        auto name = "node" + std::to_string(i);
+        rates[name] = 1;
+        many.push_back(name);
+    }
+
+    std::vector<std::pair<std::string, metricq::json>> metrics = {
+        { "join", { { "operation", "+" }, { "left", "fast" }, { "right", "slow" } } },
+        { "held",
+          { { "operation", "+" }, { "left", "fast" }, { "right", "slow" }, { "hold", "5min" } } },
+        { "scaled", { { "operation", "*" }, { "left", "fast" }, { "right", 2 } } },
+        { "total", { { "operation", "sum" }, { "inputs", many } } },
+        { "aligned", { { "operation", "sum" }, { "inputs", many }, { "tolerance", "100ms" } } },
+        { "throttled",
+          { { "operation", "throttle" }, { "cooldown_period", "10s" }, { "input", "scaled" } } },
+        { "windowed", { { "operation", "median" }, { "window", "1min" }, { "input", "fast" } } },
+        { "unknown", { { "operation", "-" }, { "left", "fast" }, { "right", "missing" } } },
+        { "clamped", { { "operation", "clamp" }, { "input", "fast" }, { "max", 100 } } },
+        { "selected",
+          { { "operation", "select" },
+            { "condition", { { "operation", ">" }, { "left", "fast" }, { "right", 10 } } },
+            { "then", "fast" },
+            { "else", "slow" },
+            { "hold", "5min" } } },
+    };
+
+    CostModel model(rates);
+    auto estimates = model.estimate(metrics);
+    check(estimates.size() == metrics.size());
+    auto find = [&estimates](const std::string& name) {
+        for (const auto& estimate : estimates)
+        {
+            if (estimate.name == name)
+            {
+                return estimate;
+            }
+        }
+        std::exit(1);
+    };
+
+    std::cerr << "Checking a join of a fast and a slow input...\n";
+    auto join = find("join");
+    std::cerr << "`-- queue depth " << join.queue_depth << ", " << join.memory << " bytes\n";
+    check(near(join.queue_depth, 1e5));
+    check(join.memory > 1e5 * 16);
+    check(near(join.output_rate, 1000.01));
+    check(estimates.front().name == "join");
+    check(find("held").queue_depth == 0);
+    check(find("scaled").output_rate == 1000 && find("scaled").queue_depth == 0);
+
+    std::cerr << "Checking a sum of 5000 inputs...\n";
+    auto total = find("total");
+    std::cerr << "`-- " << total.output_rate << " values/s, " << total.memory << " bytes, "
+              << total.updates_per_value << " updates per value\n";
+    check(total.output_rate == 5000 && total.queue_depth == 1);
+    check(total.memory > 5000 * 128);
+    check(find("aligned").output_rate == 1);
+
+    std::cerr << "Checking rates of combined metrics used as inputs...\n";
+    check(near(find("throttled").output_rate, 0.1));
+    check(near(find("windowed").output_rate, 1 / 60.0));
+
+    std::cerr << "Checking comparisons, select and clamp...\n";
+    check(find("clamped").output_rate == 1000 && find("clamped").queue_depth == 0);
+    check(find("selected").queue_depth == 0 && find("selected").output_rate > 1000);
+
+    std::cerr << "Checking unknown rates...\n";
+    auto unknown = find("unknown");
+    check(std::isnan(unknown.output_rate) && std::isnan(unknown.memory));
+    check(estimates.back().name == "unknown");
+
+    std::cerr << "Checking limits...\n";
+    CostModel::Limits limits;
+    limits.queue_depth = 1000;
+    check(CostModel::exceeds(join, limits));
+    check(!CostModel::exceeds(total, limits));
+    check(!CostModel::exceeds(unknown, limits));
+
+    std::ostringstream report;
+    CostModel::print(report, estimates, limits);
+    std::cerr << report.str();
+    check(report.str().find("join  (exceeds limits)") != std::string::npos);
+
+    return 0;
+}
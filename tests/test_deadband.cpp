@@ -0,0 +1,161 @@
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include <metricq/json.hpp>
+
+#include "../src/combined_metric.hpp"
+
+static std::ostream& operator<<(std::ostream& os, metricq::TimeValue tv)
+{
+    return os << "TimeValue { time: " << tv.time.time_since_epoch().count()
+              << ", value: " << tv.value << " }";
+}
+
+static void check(bool passed)
+{
+    if (!passed)
+    {
+        std::cerr << "!!! CHECK FAILED !!!\n";
+        std::exit(1);
+    }
+}
+
+constexpr metricq::TimePoint t(double seconds)
+{
+    using duration = metricq::TimePoint::duration;
+    return metricq::TimePoint(duration(static_cast<duration::rep>(seconds * 1e9)));
+}
+
+static std::vector<metricq::TimeValue> run(const metricq::json& config,
+                                           const std::vector<metricq::TimeValue>& tvs)
+{
+    CombinedMetric combined(config);
+    auto& input = *combined.collect_metric_inputs().at("power").at(0);
+    for (auto tv : tvs)
+    {
+        input.put(tv);
+    }
+    combined.update();
+
+    std::vector<metricq::TimeValue> result;
+    auto& output = combined.input();
+    while (output.has_input())
+    {
+        result.push_back(output.peek());
+        output.discard();
+    }
+    return result;
+}
+
+static void test_deadband()
+{
+    std::cerr << "Testing deadband...\n";
+    // Noise of +-0.5 around two levels, with a NaN in between
+    std::vector<metricq::TimeValue> tvs;
+    for (int i = 1; i <= 100; ++i)
+    {
+        tvs.push_back({ t(i), (i <= 50 ? 100 : 200) + (i % 2 ? 0.5 : -0.5) });
+    }
+    tvs.push_back({ t(101), std::nan("") });
+    tvs.push_back({ t(102), 200 });
+
+    auto output = run({ { "operation", "deadband" },
+                        { "threshold", 2 },
+                        { "max_silence", "30s" },
+                        { "input", "power" } },
+                      tvs);
+    for (auto tv : output)
+    {
+        std::cerr << "`-- " << tv << '\n';
+    }
+
+    std::vector<metricq::TimeValue> expected = {
+        tvs[0],  // first value
+        tvs[30], // after 30s of silence
+        tvs[49], // last value of the first level
+        tvs[50], // first value of the second level
+        tvs[80], // after 30s of silence
+        tvs[99], // last value before NaN
+        tvs[100], tvs[101],
+    };
+    check(output.size() == expected.size());
+    for (std::size_t i = 0; i < expected.size(); ++i)
+    {
+        check(output[i].time == expected[i].time);
+        check(output[i].value == expected[i].value ||
+              (std::isnan(output[i].value) && std::isnan(expected[i].value)));
+    }
+
+    std::cerr << "Testing relative deadband...\n";
+    output = run(
+        { { "operation", "deadband" }, { "relative_threshold", 0.1 }, { "input", "power" } },
+        { { t(1), 100 }, { t(2), 109 }, { t(3), 111 }, { t(4), 115 } });
+    check(output.size() == 3 && output[1].value == 109 && output[2].value == 111);
+}
+
+static void test_swinging_door()
+{
+    std::cerr << "Testing swinging door...\n";
+    constexpr double deviation = 0.01;
+    std::vector<metricq::TimeValue> tvs;
+    for (int i = 0; i < 10000; ++i)
+    {
+        tvs.push_back({ t(i * 0.1), std::sin(i * 0.001) });
+    }
+
+    auto output = run(
+        { { "operation", "swinging_door" }, { "deviation", deviation }, { "input", "power" } },
+        tvs);
+    std::cerr << "`-- Compressed " << tvs.size() << " values to " << output.size() << '\n';
+    check(output.size() * 10 < tvs.size());
+    check(output.front().time == tvs.front().time);
+
+    // Interpolating linearly between the output values reconstructs each input value closely
+    std::size_t segment = 0;
+    for (auto tv : tvs)
+    {
+        if (tv.time > output.back().time)
+        {
+            break;
+        }
+        while (output[segment + 1].time < tv.time)
+        {
+            segment++;
+        }
+        auto from = output[segment];
+        auto to = output[segment + 1];
+        auto fraction = static_cast<double>((tv.time - from.time).count()) /
+                        static_cast<double>((to.time - from.time).count());
+        auto interpolated = from.value + fraction * (to.value - from.value);
+        check(std::abs(interpolated - tv.value) <= deviation + 1e-9);
+    }
+
+    std::cerr << "Testing swinging door with a repeated timestamp at a segment break...\n";
+    output = run({ { "operation", "swinging_door" }, { "deviation", 0.1 }, { "input", "power" } },
+                 { { t(0), 0 },
+                   { t(1), 0 },
+                   { t(1), 5 },
+                   { t(2), 0 },
+                   { t(3), 0 },
+                   { t(4), 10 },
+                   { t(5), 10 } });
+    // The value repeating the time of the new segment start is skipped, the door still closes
+    std::vector<metricq::TimeValue> expected = {
+        { t(0), 0 }, { t(1), 0 }, { t(3), 0 }, { t(4), 10 }
+    };
+    check(output.size() == expected.size());
+    for (std::size_t i = 0; i < expected.size(); ++i)
+    {
+        std::cerr << "`-- " << output[i] << '\n';
+        check(output[i].time == expected[i].time && output[i].value == expected[i].value);
+    }
+}
+
+int main()
+{
+    test_deadband();
+    test_swinging_door();
+
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <metricq/json.hpp>
+
+#include "../src/combined_metric.hpp"
+
+static void check(bool passed)
+{
+    if (!passed)
+    {
+        std::cerr << "!!! CHECK FAILED !!!\n";
+        std::exit(1);
+    }
+}
+
+constexpr metricq::TimePoint t(double seconds)
+{
+    using duration = metricq::TimePoint::duration;
+    return metricq::TimePoint(duration(static_cast<duration::rep>(seconds * 1e9)));
+}
+
+template <typename F>
+static double seconds(F&& f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Builds, updates and reloads many small expressions, the way a large configuration does
+int main()
+{
+    constexpr std::size_t expression_count = 50000;
+    constexpr std::size_t rounds = 20;
+
+    std::vector<metricq::json> configs;
+    configs.reserve(expression_count);
+    for (std::size_t i = 0; i < expression_count; ++i)
+    {
+        auto prefix = "node" + std::to_string(i);
+        configs.push_back({ { "operation", "+" },
+                            { "left", prefix + ".cpu" },
+                            { "right",
+                              { { "operation", "*" },
+                                { "left", prefix + ".gpu" },
+                                { "right", 0.5 } } } });
+    }
+
+    // Like the combinator, keep a copy of each expression next to it, so that allocations for
+    // the nodes are interleaved with others
+    std::vector<metricq::json> expressions;
+    std::vector<CombinedMetric> combined;
+    std::vector<MetricInputNodes> inputs;
+    expressions.reserve(expression_count);
+    combined.reserve(expression_count);
+    inputs.reserve(expression_count);
+    auto build = [&] {
+        for (const auto& config : configs)
+        {
+            expressions.push_back(config);
+            combined.emplace_back(config);
+            inputs.push_back(combined.back().collect_metric_inputs());
+        }
+    };
+    auto build_time = seconds(build);
+
+    std::cerr << "Checking that the nodes of each expression are close to each other...\n";
+    for (std::size_t i = 0; i < expression_count; ++i)
+    {
+        auto root = reinterpret_cast<std::uintptr_t>(&combined[i].input());
+        for (const auto& [id, nodes] : inputs[i])
+        {
+            auto node = reinterpret_cast<std::uintptr_t>(nodes.at(0));
+            check((node > root ? node - root : root - node) < 4096);
+        }
+    }
+
+    std::size_t output_count = 0;
+    auto update_time = seconds([&] {
+        for (std::size_t round = 1; round <= rounds; ++round)
+        {
+            for (std::size_t i = 0; i < expression_count; ++i)
+            {
+                for (const auto& [id, nodes] : inputs[i])
+                {
+                    nodes.at(0)->put({ t(round), static_cast<double>(round) });
+                }
+                combined[i].update();
+                auto& output = combined[i].input();
+                while (output.has_input())
+                {
+                    output.discard();
+                    output_count++;
+                }
+            }
+        }
+    });
+    check(output_count == expression_count * rounds);
+
+    auto reload_time = seconds([&] {
+        inputs.clear();
+        combined.clear();
+        expressions.clear();
+        build();
+    });
+
+    std::cerr << "`-- " << expression_count << " expressions: built in " << build_time
+              << " s, " << rounds << " rounds of updates in " << update_time
+              << " s, reloaded in " << reload_time << " s\n";
+
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <metricq/json.hpp>
+
+#include "../src/combined_metric.hpp"
+#include "../src/input_patterns.hpp"
+
+static void check(bool passed)
+{
+    if (!passed)
+    {
+        std::cerr << "!!! CHECK FAILED !!!\n";
+        std::exit(1);
+    }
+}
+
+constexpr metricq::TimePoint t(double seconds)
+{
+    using duration = metricq::TimePoint::duration;
+    return metricq::TimePoint(duration(static_cast<duration::rep>(seconds * 1e9)));
+}
+
+// The largest number of inputs of any node in an expression
+static std::size_t max_fan_in(const metricq::json& expression)
+{
+    std::size_t result = 0;
+    if (auto inputs = expression.find("inputs"); inputs != expression.end())
+    {
+        result = inputs->size();
+        for (const auto& input : *inputs)
+        {
+            result = std::max(result, max_fan_in(input));
+        }
+    }
+    return result;
+}
+
+int main()
+{
+    std::set<std::string> known = { "rack1.node1.power", "rack1.node2.power", "rack1.node2.temp",
+                                    "rack2.node1.power", "rack1.pdu.node1.power" };
+
+    std::cerr << "Checking that globs stay within a component of the name...\n";
+    auto expanded = InputPatterns::expand(
+        { { "operation", "sum" }, { "inputs", { { { "glob", "rack1.*.power" } } } } }, known);
+    std::cerr << "`-- " << expanded.dump() << '\n';
+    check(expanded.at("inputs") ==
+          metricq::json({ "rack1.node1.power", "rack1.node2.power" }));
+
+    std::cerr << "Checking that matches are not used twice...\n";
+    expanded = InputPatterns::expand({ { "operation", "max" },
+                                       { "inputs",
+                                         { "rack2.node1.power",
+                                           { { "glob", "rack**.power" } },
+                                           { { "regex", "rack[0-9]\\.node1\\.power" } } } } },
+                                     known);
+    std::cerr << "`-- " << expanded.dump() << '\n';
+    check(expanded.at("inputs").size() == 4);
+
+    std::cerr << "Checking that large sums are split up into a balanced tree...\n";
+    std::set<std::string> many;
+    for (int i = 0; i < 4000; ++i)
+    {
+        many.insert("node" + std::to_string(i) + ".power");
+    }
+    metricq::json config = { { "operation", "sum" },
+                             { "hold", "1s" },
+                             { "inputs", { { { "glob", "node*.power" } } } } };
+    expanded = InputPatterns::expand(config, many);
+    std::cerr << "`-- Largest fan-in is " << max_fan_in(expanded) << '\n';
+    check(max_fan_in(expanded) <= InputPatterns::default_max_fan_in);
+    check(expanded.at("hold") == "1s");
+    check(!expanded.at("inputs").at(0).contains("hold"));
+
+    CombinedMetric combined(expanded);
+    auto inputs = combined.collect_metric_inputs();
+    check(inputs.size() == many.size());
+    double expected = 0;
+    int i = 0;
+    for (auto& [name, nodes] : inputs)
+    {
+        check(nodes.size() == 1);
+        nodes.at(0)->put({ t(1), static_cast<double>(++i) });
+        expected += i;
+    }
+    combined.update();
+    auto& output = combined.input();
+    check(output.queue_length() == 1);
+    std::cerr << "`-- Checking sum: " << output.peek().value << " == " << expected << '\n';
+    check(output.peek().value == expected);
+
+    std::cerr << "Checking that large sums without patterns are split up as well...\n";
+    std::vector<std::string> names(many.begin(), many.end());
+    expanded = InputPatterns::expand({ { "operation", "max" }, { "inputs", names } }, known);
+    check(max_fan_in(expanded) <= InputPatterns::default_max_fan_in);
+    check(CombinedMetric(expanded).collect_metric_inputs().size() == many.size());
+
+    std::cerr << "Checking that invalid patterns are rejected...\n";
+    try
+    {
+        InputPatterns::expand({ { "operation", "sum" }, { "inputs", { { { "regex", "(" } } } } },
+                              known);
+        check(false);
+    }
+    catch (const CombinedMetric::ParseError&)
+    {
+    }
+
+    return 0;
+}
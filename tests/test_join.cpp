@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include <metricq/json.hpp>
+
+#include "../src/combined_metric.hpp"
+
+static std::ostream& operator<<(std::ostream& os, metricq::TimeValue tv)
+{
+    return os << "TimeValue { time: " << tv.time.time_since_epoch().count()
+              << ", value: " << tv.value << " }";
+}
+
+static void check(bool passed)
+{
+    if (!passed)
+    {
+        std::cerr << "!!! CHECK FAILED !!!\n";
+        std::exit(1);
+    }
+}
+
+constexpr metricq::TimePoint t(double seconds)
+{
+    using duration = metricq::TimePoint::duration;
+    return metricq::TimePoint(duration(static_cast<duration::rep>(seconds * 1e9)));
+}
+
+static void fill(CombinedMetric& combined, const char* name,
+                 std::initializer_list<metricq::TimeValue> tvs)
+{
+    auto inputs = combined.collect_metric_inputs();
+    check(inputs.count(name) == 1);
+    for (auto tv : tvs)
+    {
+        inputs.at(name).at(0)->put(tv);
+    }
+}
+
+static void check_output(CombinedMetric& combined, std::initializer_list<metricq::TimeValue> tvs)
+{
+    combined.update();
+    auto& output = combined.input();
+    std::cerr << "Checking that output has correct length...\n";
+    check(output.queue_length() == tvs.size());
+    for (auto tv : tvs)
+    {
+        auto out = output.peek();
+        std::cerr << "`-- Checking: " << tv << " == " << out << '\n';
+        check(tv.time == out.time && tv.value == out.value);
+        output.discard();
+    }
+}
+
+template <typename Op>
+static void test_hold(metricq::json config, Op op)
+{
+    std::cerr << "Testing " << config.dump() << '\n';
+    CombinedMetric combined(config);
+
+    // A slow calibration factor, that is applied to the fast input until it is 10s old
+    fill(combined, "fast", { { t(1), 1 }, { t(2), 2 }, { t(3), 3 } });
+    fill(combined, "slow", { { t(0.5), 10 } });
+    check_output(combined, {
+                               { t(0.5), op(1, 10) },
+                               { t(1), op(1, 10) },
+                               { t(2), op(2, 10) },
+                               { t(3), op(3, 10) },
+                           });
+
+    // A late value of the slow input only replaces the held value
+    fill(combined, "slow", { { t(2.5), 100 } });
+    fill(combined, "fast", { { t(4), 4 }, { t(12.5), 5 }, { t(13), 6 } });
+    check_output(combined, { { t(4), op(4, 100) }, { t(12.5), op(5, 100) } });
+
+    // Once the held value is stale, we wait for the slow input again
+    fill(combined, "slow", { { t(14), 1000 } });
+    check_output(combined, { { t(13), op(6, 1000) }, { t(14), op(6, 1000) } });
+}
+
+static void test_tolerance(metricq::json config)
+{
+    std::cerr << "Testing " << config.dump() << '\n';
+    CombinedMetric combined(config);
+
+    // Both inputs sample once per second, with a few microseconds of jitter
+    fill(combined, "foo", { { t(1.000002), 1 }, { t(2.000000), 2 }, { t(3.000004), 3 } });
+    fill(combined, "bar", { { t(1.000000), 10 }, { t(2.000003), 20 }, { t(3.000001), 30 } });
+    fill(combined, "foo", { { t(3.5), 4 } });
+    fill(combined, "bar", { { t(4.0), 40 } });
+    check_output(combined, {
+                               { t(1.000000), 11 },
+                               { t(2.000000), 22 },
+                               { t(3.000001), 33 },
+                               { t(3.5), 44 },
+                           });
+}
+
+int main()
+{
+    auto multiply = [](double fast, double slow) { return fast * slow; };
+    auto maximum = [](double fast, double slow) { return std::max(fast, slow); };
+
+    test_hold({ { "operation", "*" }, { "left", "fast" }, { "right", "slow" }, { "hold", "10s" } },
+              multiply);
+    test_hold({ { "operation", "*" }, { "left", "slow" }, { "right", "fast" }, { "hold", "10s" } },
+              multiply);
+    test_hold({ { "operation", "max" }, { "inputs", { "fast", "slow" } }, { "hold", "10s" } },
+              maximum);
+    test_hold({ { "operation", "max" }, { "inputs", { "slow", "fast" } }, { "hold", "10s" } },
+              maximum);
+
+    test_tolerance({
+        { "operation", "+" },
+        { "left", "foo" },
+        { "right", "bar" },
+        { "tolerance", "10us" },
+    });
+    test_tolerance({
+        { "operation", "sum" },
+        { "inputs", { "foo", "bar" } },
+        { "tolerance", "10us" },
+    });
+
+    return 0;
+}
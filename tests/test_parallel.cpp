@@ -0,0 +1,132 @@
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <metricq/json.hpp>
+
+#include "../src/combined_metric.hpp"
+#include "../src/input_patterns.hpp"
+#include "../src/work_stealing_pool.hpp"
+
+static void check(bool passed)
+{
+    if (!passed)
+    {
+        std::cerr << "!!! CHECK FAILED !!!\n";
+        std::exit(1);
+    }
+}
+
+constexpr metricq::TimePoint t(double seconds)
+{
+    using duration = metricq::TimePoint::duration;
+    return metricq::TimePoint(duration(static_cast<duration::rep>(seconds * 1e9)));
+}
+
+static void test_pool()
+{
+    std::cerr << "Testing nested tasks on the pool...\n";
+    WorkStealingPool pool(4);
+    std::vector<std::atomic<int>> counts(100);
+    pool.run(10, [&](std::size_t outer) {
+        pool.run(10, [&](std::size_t inner) { counts[outer * 10 + inner]++; });
+    });
+    for (auto& count : counts)
+    {
+        check(count == 1);
+    }
+
+    std::cerr << "Testing that exceptions are passed to the caller...\n";
+    try
+    {
+        pool.run(8, [](std::size_t index) {
+            if (index == 5)
+            {
+                throw std::runtime_error("task failed");
+            }
+        });
+        check(false);
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+}
+
+static std::vector<metricq::TimeValue> evaluate(const metricq::json& expression,
+                                                std::size_t chunks)
+{
+    CombinedMetric combined(expression);
+    auto inputs = combined.collect_metric_inputs();
+
+    std::mt19937_64 rng(99);
+    std::normal_distribution<double> values(100, 50);
+    std::vector<metricq::TimeValue> result;
+    for (std::size_t chunk = 0; chunk < chunks; ++chunk)
+    {
+        // Inputs report at slightly different times, so subtrees produce different timestamps
+        for (auto& [name, nodes] : inputs)
+        {
+            auto jitter = static_cast<double>(rng() % 1000) / 1e6;
+            auto value = rng() % 100 == 0 ? std::nan("") : values(rng);
+            nodes.at(0)->put({ t(chunk + 1 + jitter), value });
+        }
+        combined.update();
+        auto& output = combined.input();
+        while (output.has_input())
+        {
+            result.push_back(output.peek());
+            output.discard();
+        }
+    }
+    return result;
+}
+
+int main()
+{
+    test_pool();
+
+    std::set<std::string> metrics;
+    for (int i = 0; i < 2000; ++i)
+    {
+        metrics.insert("node" + std::to_string(i) + ".power");
+    }
+    // Flat input lists are split up into subtrees just like the inputs matched by a pattern
+    std::vector<std::pair<std::string, metricq::json>> configs = {
+        { "sum", { { { "glob", "node*.power" } } } },
+        { "max", { { { "glob", "node*.power" } } } },
+        { "sum", metricq::json(std::vector<std::string>(metrics.begin(), metrics.end())) },
+    };
+    for (const auto& [operation, inputs] : configs)
+    {
+        auto expression =
+            InputPatterns::expand({ { "operation", operation }, { "inputs", inputs } }, metrics);
+        check(expression.at("inputs").size() < metrics.size());
+
+        std::cerr << "Evaluating " << operation << " serially...\n";
+        WorkStealingPool::configure_global(1);
+        auto serial = evaluate(expression, 20);
+
+        std::cerr << "Evaluating " << operation << " in parallel...\n";
+        WorkStealingPool::configure_global(4);
+        check(WorkStealingPool::global() != nullptr);
+        auto parallel = evaluate(expression, 20);
+        WorkStealingPool::configure_global(1);
+
+        std::cerr << "Checking that " << serial.size() << " values are identical...\n";
+        check(!serial.empty());
+        check(serial.size() == parallel.size());
+        for (std::size_t i = 0; i < serial.size(); ++i)
+        {
+            check(serial[i].time == parallel[i].time);
+            check(std::memcmp(&serial[i].value, &parallel[i].value, sizeof(double)) == 0);
+        }
+    }
+
+    return 0;
+}
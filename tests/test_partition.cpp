@@ -0,0 +1,210 @@
+#include <deque>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <metricq/json.hpp>
+
+#include "../src/combined_metric.hpp"
+#include "../src/partition.hpp"
+
+static void check(bool passed)
+{
+    if (!passed)
+    {
+        std::cerr << "!!! CHECK FAILED !!!\n";
+        std::exit(1);
+    }
+}
+
+constexpr metricq::TimePoint t(double seconds)
+{
+    using duration = metricq::TimePoint::duration;
+    return metricq::TimePoint(duration(static_cast<duration::rep>(seconds * 1e9)));
+}
+
+static metricq::json make_config()
+{
+    metricq::json metrics = {
+        { "a.sum", { { "operation", "+" }, { "left", "a1" }, { "right", "a2" } } },
+        { "a.double", { { "operation", "*" }, { "left", "a.sum" }, { "right", 2 } } },
+        { "c.agg",
+          { { "operation", "aggregate" },
+            { "inputs", { "c1", "c2", "shared" } },
+            { "outputs", { "min", "max" } } } },
+        { "c.range", { { "operation", "-" }, { "left", "c.agg.max" }, { "right", "c.agg.min" } } },
+    };
+    for (int i = 0; i < 40; ++i)
+    {
+        auto node = "node" + std::to_string(i);
+        metrics[node + ".total"] = { { "operation", "+" },
+                                     { "left", node + ".x" },
+                                     { "right", "shared" } };
+    }
+    return metrics;
+}
+
+// A combinator instance that takes over one shard of the configuration
+struct Instance
+{
+    Instance(const metricq::json& config, std::size_t shard_index, std::size_t shard_count)
+    {
+        std::vector<Partition::Metric> described;
+        for (const auto& [name, expression] : config.items())
+        {
+            described.push_back(Partition::describe(name, expression));
+        }
+        auto shards = Partition::assign(described, shard_count);
+        for (std::size_t i = 0; i < described.size(); ++i)
+        {
+            if (shards[i] != shard_index)
+            {
+                continue;
+            }
+            const auto& name = described[i].name;
+            auto& metric = metrics.emplace(name, CombinedMetric(config.at(name))).first->second;
+            inputs.emplace(name, metric.collect_metric_inputs());
+            subscriptions.insert(described[i].inputs.begin(), described[i].inputs.end());
+        }
+    }
+
+    std::map<std::string, CombinedMetric> metrics;
+    std::map<std::string, MetricInputNodes> inputs;
+    std::set<std::string> subscriptions;
+};
+
+// Stands in for the broker: passes each value to all instances that subscribed to its metric,
+// and the output of combined metrics back in as input, until nothing is left
+static std::map<std::string, std::vector<metricq::TimeValue>>
+run(std::vector<Instance>& instances,
+    std::deque<std::pair<std::string, metricq::TimeValue>> messages)
+{
+    std::map<std::string, std::vector<metricq::TimeValue>> published;
+    while (!messages.empty())
+    {
+        auto [metric, tv] = messages.front();
+        messages.pop_front();
+        for (auto& instance : instances)
+        {
+            if (!instance.subscriptions.count(metric))
+            {
+                continue;
+            }
+            for (auto& [name, inputs] : instance.inputs)
+            {
+                if (auto it = inputs.find(metric); it != inputs.end())
+                {
+                    for (auto* node : it->second)
+                    {
+                        node->put(tv);
+                    }
+                }
+            }
+            for (auto& [name, combined] : instance.metrics)
+            {
+                combined.update();
+                for (const auto& [suffix, output] : combined.outputs())
+                {
+                    while (output->has_input())
+                    {
+                        published[name + suffix].push_back(output->peek());
+                        messages.emplace_back(name + suffix, output->peek());
+                        output->discard();
+                    }
+                }
+            }
+        }
+    }
+    return published;
+}
+
+int main()
+{
+    auto config = make_config();
+
+    std::deque<std::pair<std::string, metricq::TimeValue>> messages;
+    for (int step = 1; step <= 5; ++step)
+    {
+        for (const auto& input : { "a1", "a2", "c1", "c2", "shared" })
+        {
+            messages.emplace_back(input, metricq::TimeValue(t(step), step * 10.0));
+        }
+        for (int i = 0; i < 40; ++i)
+        {
+            messages.emplace_back("node" + std::to_string(i) + ".x",
+                                  metricq::TimeValue(t(step), step + i));
+        }
+    }
+
+    std::cerr << "Running a single instance...\n";
+    std::vector<Instance> single;
+    single.emplace_back(config, 0, 1);
+    auto expected = run(single, messages);
+    check(expected.size() == config.size() + 1);
+
+    std::cerr << "Running three instances with the same configuration...\n";
+    std::vector<Instance> instances;
+    for (std::size_t index = 0; index < 3; ++index)
+    {
+        instances.emplace_back(config, index, 3);
+        std::cerr << "`-- Instance " << index << " takes over "
+                  << instances.back().metrics.size() << " combined metric(s), subscribes to "
+                  << instances.back().subscriptions.size() << " metric(s)\n";
+    }
+
+    std::cerr << "Checking that each combined metric is taken over exactly once...\n";
+    std::map<std::string, std::size_t> owner;
+    for (std::size_t index = 0; index < instances.size(); ++index)
+    {
+        check(!instances[index].metrics.empty());
+        check(instances[index].subscriptions.size() < single[0].subscriptions.size());
+        for (const auto& [name, _] : instances[index].metrics)
+        {
+            check(owner.emplace(name, index).second);
+        }
+    }
+    check(owner.size() == config.size());
+    check(owner.at("a.sum") == owner.at("a.double"));
+    check(owner.at("c.agg") == owner.at("c.range"));
+
+    std::cerr << "Checking that the results are the same...\n";
+    auto sharded = run(instances, messages);
+    check(sharded.size() == expected.size());
+    for (const auto& [metric, values] : expected)
+    {
+        const auto& sharded_values = sharded.at(metric);
+        check(sharded_values.size() == values.size());
+        for (std::size_t i = 0; i < values.size(); ++i)
+        {
+            check(sharded_values[i].time == values[i].time &&
+                  sharded_values[i].value == values[i].value);
+        }
+    }
+
+    std::cerr << "Checking that the order of the configuration does not matter...\n";
+    std::vector<Partition::Metric> forward, backward;
+    for (const auto& [name, expression] : config.items())
+    {
+        forward.push_back(Partition::describe(name, expression));
+    }
+    backward.assign(forward.rbegin(), forward.rend());
+    auto forward_shards = Partition::assign(forward, 3);
+    auto backward_shards = Partition::assign(backward, 3);
+    for (std::size_t i = 0; i < forward.size(); ++i)
+    {
+        check(forward_shards[i] == backward_shards[forward.size() - 1 - i]);
+    }
+
+    std::cerr << "Checking that invalid expressions are described without throwing...\n";
+    auto invalid = Partition::describe("invalid", { { "operation", "aggregate" },
+                                                    { "inputs", { "a" } },
+                                                    { "outputs", { "min", 3 } } });
+    check(invalid.outputs == std::vector<std::string>{ "invalid.min" });
+    invalid = Partition::describe("invalid", { { "operation", 3 }, { "inputs", { "a" } } });
+    check(invalid.outputs == std::vector<std::string>{ "invalid" });
+
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <metricq/json.hpp>
+
+#include "../src/combined_metric.hpp"
+#include "../src/metric_id.hpp"
+#include "../src/profiler.hpp"
+
+static void check(bool passed)
+{
+    if (!passed)
+    {
+        std::cerr << "!!! CHECK FAILED !!!\n";
+        std::exit(1);
+    }
+}
+
+constexpr metricq::TimePoint t(double seconds)
+{
+    using duration = metricq::TimePoint::duration;
+    return metricq::TimePoint(duration(static_cast<duration::rep>(seconds * 1e9)));
+}
+
+// Update a combined metric once per second of input like the combinator, profiling each update
+static void run(MetricId id, CombinedMetric& combined, int steps)
+{
+    auto inputs = combined.collect_metric_inputs();
+    for (int step = 1; step <= steps; ++step)
+    {
+        Profiler::Scope profile(id);
+        for (auto& [name, nodes] : inputs)
+        {
+            nodes.at(0)->put({ t(step), static_cast<double>(step) });
+        }
+        Profiler::global().count(id, inputs.size(), 0);
+        combined.update();
+        auto& output = combined.input();
+        std::size_t sent = 0;
+        for (; output.has_input(); output.discard())
+        {
+            sent++;
+        }
+        Profiler::global().count(id, 0, sent);
+    }
+}
+
+int main()
+{
+    if (!Profiler::compiled)
+    {
+        std::cerr << "Profiling is not compiled in, skipping\n";
+        return 0;
+    }
+
+    auto& ids = MetricIds::global();
+    auto cheap = ids.intern("cheap");
+    auto expensive = ids.intern("expensive");
+    CombinedMetric binary({ { "operation", "+" }, { "left", "a" }, { "right", "b" } });
+    auto many = metricq::json::array();
+    for (int i = 0; i < 500; ++i)
+    {
+        many.push_back("input" + std::to_string(i));
+    }
+    CombinedMetric sum({ { "operation", "throttle" },
+                         { "cooldown_period", "10s" },
+                         { "input", { { "operation", "sum" }, { "inputs", many } } } });
+
+    std::cerr << "Checking that nothing is measured unless configured...\n";
+    auto& profiler = Profiler::global();
+    check(!profiler.enabled());
+    run(cheap, binary, 4);
+    check(!Profiler::active());
+
+    std::cerr << "Checking that every fourth update is measured...\n";
+    profiler.configure(4);
+    check(profiler.enabled());
+    profiler.add(cheap, binary.collect_nodes());
+    profiler.add(expensive, sum.collect_nodes());
+    run(cheap, binary, 100);
+    run(expensive, sum, 100);
+    check(!Profiler::active());
+
+    auto top = profiler.top(5);
+    check(top.size() == 2);
+    check(top[0]->metric == expensive && top[1]->metric == cheap);
+    for (const auto* profile : top)
+    {
+        check(profile->updates == 100 && profile->sampled_updates == 25);
+        check(profile->scale() == 4);
+    }
+
+    std::cerr << "Checking the values counted for each node...\n";
+    // Nodes are in depth-first order, metric inputs are not measured themselves
+    const auto& binary_nodes = top[1]->nodes;
+    check(binary_nodes.size() == 3);
+    check(binary_nodes[2].values_in == 2 * 25 && binary_nodes[2].values_out == 25);
+    check(binary_nodes[0].cycles == 0 && binary_nodes[2].cycles > 0);
+
+    const auto& sum_nodes = top[0]->nodes;
+    check(sum_nodes.size() == 502);
+    const auto& sum_node = sum_nodes[500];
+    const auto& throttle_node = sum_nodes[501];
+    check(sum_node.values_in == 500 * 25 && sum_node.values_out == 25);
+    // The throttle passes about every tenth value
+    check(throttle_node.values_in == 25 && throttle_node.values_out < 25 / 5);
+    check(sum_node.cycles > throttle_node.cycles);
+
+    check(top[0]->values_in == 500 * 100 && top[0]->values_out < 100 / 5);
+    check(top[1]->values_in == 2 * 100 && top[1]->values_out == 100);
+
+    std::cerr << "Checking the report...\n";
+    std::ostringstream report;
+    profiler.report(report, 1);
+    std::cerr << report.str();
+    check(report.str().find("expensive") != std::string::npos);
+    check(report.str().find("cheap") == std::string::npos);
+    check(report.str().find("`-- node 500 (") != std::string::npos);
+
+    std::cerr << "Checking that clear() forgets all nodes...\n";
+    profiler.clear();
+    run(expensive, sum, 4);
+    check(profiler.top(5).empty());
+
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <metricq/json.hpp>
+
+#include "../src/combined_metric.hpp"
+#include "../src/kll_sketch.hpp"
+
+static void check(bool passed)
+{
+    if (!passed)
+    {
+        std::cerr << "!!! CHECK FAILED !!!\n";
+        std::exit(1);
+    }
+}
+
+constexpr metricq::TimePoint t(double seconds)
+{
+    using duration = metricq::TimePoint::duration;
+    return metricq::TimePoint(duration(static_cast<duration::rep>(seconds * 1e9)));
+}
+
+static std::vector<metricq::TimeValue> drain(CombinedMetric& combined)
+{
+    std::vector<metricq::TimeValue> result;
+    combined.update();
+    auto& output = combined.input();
+    while (output.has_input())
+    {
+        result.push_back(output.peek());
+        output.discard();
+    }
+    return result;
+}
+
+static void test_across_inputs()
+{
+    std::cerr << "Testing median and quantile across inputs...\n";
+    CombinedMetric median({ { "operation", "median" }, { "inputs", { "a", "b", "c", "d" } } });
+    CombinedMetric p75({ { "operation", "quantile" },
+                         { "quantile", 0.75 },
+                         { "inputs", { "a", "b", "c", "d" } } });
+
+    for (auto* combined : { &median, &p75 })
+    {
+        auto inputs = combined->collect_metric_inputs();
+        std::vector<std::vector<double>> values = {
+            { 4, 1, 3, 2 },
+            { 10, std::nan(""), 30, 20 },
+            { std::nan(""), std::nan(""), std::nan(""), std::nan("") },
+        };
+        for (std::size_t step = 0; step < values.size(); ++step)
+        {
+            for (std::size_t i = 0; i < 4; ++i)
+            {
+                inputs.at(std::string(1, 'a' + i)).at(0)->put({ t(step + 1), values[step][i] });
+            }
+        }
+    }
+
+    auto medians = drain(median);
+    check(medians.size() == 3);
+    std::cerr << "`-- Medians: " << medians[0].value << ", " << medians[1].value << ", "
+              << medians[2].value << '\n';
+    check(medians[0].value == 2.5 && medians[1].value == 20 && std::isnan(medians[2].value));
+
+    auto p75s = drain(p75);
+    check(p75s.size() == 3);
+    std::cerr << "`-- 75th percentiles: " << p75s[0].value << ", " << p75s[1].value << '\n';
+    check(p75s[0].value == 3.25 && p75s[1].value == 25);
+}
+
+static void test_sketch_accuracy()
+{
+    std::cerr << "Testing accuracy of KllSketch...\n";
+    std::mt19937_64 rng(7);
+    std::lognormal_distribution<double> distribution(0, 1);
+
+    KllSketch sketch;
+    std::vector<double> values(1000000);
+    for (auto& value : values)
+    {
+        value = distribution(rng);
+        sketch.add(value);
+    }
+    std::cerr << "`-- Retained " << sketch.retained() << " of " << sketch.count() << " values\n";
+    check(sketch.retained() < 1000);
+
+    std::sort(values.begin(), values.end());
+    for (double q : { 0.01, 0.25, 0.5, 0.9, 0.99 })
+    {
+        auto estimate = sketch.quantile(q);
+        auto rank = std::lower_bound(values.begin(), values.end(), estimate) - values.begin();
+        auto rank_error = std::abs(static_cast<double>(rank) / values.size() - q);
+        std::cerr << "`-- q = " << q << ": estimate " << estimate << ", rank error " << rank_error
+                  << '\n';
+        check(rank_error < 0.02);
+    }
+}
+
+static void test_over_time()
+{
+    std::cerr << "Testing median within windows of time...\n";
+    CombinedMetric combined(
+        { { "operation", "median" }, { "window", "10s" }, { "input", "power" } });
+    auto& input = *combined.collect_metric_inputs().at("power").at(0);
+
+    // Window (0s, 10s] has 1..10, (10s, 20s] only NaNs, (20s, 30s] is empty
+    for (int i = 1; i <= 10; ++i)
+    {
+        input.put({ t(i), static_cast<double>(i) });
+    }
+    input.put({ t(15), std::nan("") });
+    input.put({ t(35), 42 });
+
+    auto output = drain(combined);
+    check(output.size() == 2);
+    std::cerr << "`-- " << output[0].value << " at " << output[0].time.time_since_epoch().count()
+              << '\n';
+    check(output[0].time == t(10) && (output[0].value == 5 || output[0].value == 6));
+    check(output[1].time == t(20) && std::isnan(output[1].value));
+}
+
+int main()
+{
+    test_across_inputs();
+    test_sketch_accuracy();
+    test_over_time();
+
+    return 0;
+}
@@ -20,7 +20,7 @@ static void check(bool passed)
 }
 
 template <std::size_t N>
-static void check_and_fill_input(MetricInputNodesByName& input_map, const char* name,
+static void check_and_fill_input(MetricInputNodes& input_map, const char* name,
                                  const metricq::TimeValue (&tvs)[N])
 {
     auto inputs_it = input_map.find(name);
@@ -66,7 +66,7 @@ int main()
 
     CombinedMetric combined(config);
 
-    MetricInputNodesByName inputs = combined.collect_metric_inputs();
+    MetricInputNodes inputs = combined.collect_metric_inputs();
 
     check_and_fill_input(inputs, "foo", FOO_INPUT);
     check_and_fill_input(inputs, "bar", BAR_INPUT);
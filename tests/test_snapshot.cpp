@@ -0,0 +1,138 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <metricq/json.hpp>
+
+#include "../src/combined_metric.hpp"
+#include "../src/snapshot.hpp"
+
+static std::ostream& operator<<(std::ostream& os, metricq::TimeValue tv)
+{
+    return os << "TimeValue { time: " << tv.time.time_since_epoch().count()
+              << ", value: " << tv.value << " }";
+}
+
+static void check(bool passed)
+{
+    if (!passed)
+    {
+        std::cerr << "!!! CHECK FAILED !!!\n";
+        std::exit(1);
+    }
+}
+
+constexpr metricq::TimePoint t(double seconds)
+{
+    using duration = metricq::TimePoint::duration;
+    return metricq::TimePoint(duration(static_cast<duration::rep>(seconds * 1e9)));
+}
+
+static void fill(CombinedMetric& combined, const char* name,
+                 std::initializer_list<metricq::TimeValue> tvs)
+{
+    auto inputs = combined.collect_metric_inputs();
+    check(inputs.count(name) == 1);
+    for (auto tv : tvs)
+    {
+        inputs.at(name).at(0)->put(tv);
+    }
+}
+
+static std::vector<metricq::TimeValue> drain(CombinedMetric& combined)
+{
+    std::vector<metricq::TimeValue> result;
+    combined.update();
+    auto& output = combined.input();
+    while (output.has_input())
+    {
+        result.push_back(output.peek());
+        output.discard();
+    }
+    return result;
+}
+
+int main()
+{
+    const char* path = "test_snapshot.bin";
+
+    metricq::json config = {
+        { "operation", "+" },
+        { "left",
+          { { "operation", "throttle" }, { "cooldown_period", "2s" }, { "input", "foo" } } },
+        { "right", "bar" },
+    };
+
+    CombinedMetric original(config);
+    fill(original, "foo", { { t(10), 1 }, { t(11), 2 }, { t(12), 3 }, { t(13), 4 }, { t(14), 5 } });
+    fill(original, "bar", { { t(10.5), 10 } });
+    std::cerr << "Initial output of original:\n";
+    for (auto tv : drain(original))
+    {
+        std::cerr << "`-- " << tv << '\n';
+    }
+
+    std::cerr << "Writing snapshot...\n";
+    {
+        SnapshotWriter writer;
+        original.save_state(writer);
+        Snapshot::write(path, { { "foobar", Snapshot::fingerprint(config), writer.buffer() } });
+    }
+
+    std::cerr << "Restoring snapshot...\n";
+    CombinedMetric restored(config);
+    {
+        auto snapshot = Snapshot::load(path);
+        check(snapshot.size() == 1);
+
+        std::cerr << "Checking that a changed expression is not restored...\n";
+        metricq::json changed = config;
+        changed["operation"] = "-";
+        check(!snapshot.find("foobar", Snapshot::fingerprint(changed)));
+        check(!snapshot.find("barfoo", Snapshot::fingerprint(config)));
+
+        auto reader = snapshot.find("foobar", Snapshot::fingerprint(config));
+        check(reader.has_value());
+        restored.restore_state(*reader);
+    }
+
+    std::cerr << "Checking that a snapshot of another version is not loaded...\n";
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        std::uint32_t old_version = Snapshot::version - 1;
+        file.seekp(8); // Right behind the magic
+        file.write(reinterpret_cast<const char*>(&old_version), sizeof(old_version));
+    }
+    bool rejected = false;
+    try
+    {
+        Snapshot::load(path);
+    }
+    catch (const SnapshotError&)
+    {
+        rejected = true;
+    }
+    check(rejected);
+    std::remove(path);
+
+    for (auto* combined : { &original, &restored })
+    {
+        fill(*combined, "foo", { { t(15), 6 }, { t(16), 7 }, { t(17), 8 } });
+        fill(*combined, "bar", { { t(13), 20 }, { t(16), 30 } });
+    }
+
+    auto expected = drain(original);
+    auto actual = drain(restored);
+
+    std::cerr << "Checking that restored metric continues like the original...\n";
+    check(!expected.empty());
+    check(expected.size() == actual.size());
+    for (std::size_t i = 0; i < expected.size(); ++i)
+    {
+        std::cerr << "`-- Checking: " << expected[i] << " == " << actual[i] << '\n';
+        check(expected[i].time == actual[i].time && expected[i].value == actual[i].value);
+    }
+
+    return 0;
+}
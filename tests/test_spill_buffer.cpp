@@ -0,0 +1,102 @@
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../src/spill_buffer.hpp"
+
+static void check(bool passed)
+{
+    if (!passed)
+    {
+        std::cerr << "!!! CHECK FAILED !!!\n";
+        std::exit(1);
+    }
+}
+
+constexpr metricq::TimePoint t(metricq::TimePoint::duration::rep r)
+{
+    return metricq::TimePoint(metricq::TimePoint::duration(r));
+}
+
+// Stands in for the broker connection, which can be stalled at will
+struct FakeSink : OutputSink
+{
+    bool output_ready() const override
+    {
+        return ready;
+    }
+
+    void output(const std::string& metric, metricq::TimeValue tv) override
+    {
+        check(ready);
+        sent.emplace_back(metric, tv);
+    }
+
+    bool ready = true;
+    std::vector<std::pair<std::string, metricq::TimeValue>> sent;
+};
+
+static std::size_t count_segments(const std::string& directory)
+{
+    std::size_t count = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(directory))
+    {
+        count += entry.path().extension() == ".spill";
+    }
+    return count;
+}
+
+int main()
+{
+    const std::string directory = "test_spill_buffer.d";
+    constexpr std::size_t record_size = sizeof(SpillLog::Record);
+    constexpr int n = 100;
+
+    FakeSink sink;
+    {
+        // Keep 10 values in memory, spill the rest into segments of 8 values each
+        SpillBuffer buffer(sink, directory, 10 * record_size, 8);
+        auto foo = buffer.metric_id("foo");
+        auto bar = buffer.metric_id("bar");
+        check(buffer.metric_id("foo") == foo);
+
+        std::cerr << "Sending while the sink is ready...\n";
+        buffer.send(foo, { t(0), 0 });
+        check(sink.sent.size() == 1);
+        check(buffer.pending_bytes() == 0);
+
+        std::cerr << "Sending while the sink is stalled...\n";
+        sink.ready = false;
+        for (int i = 1; i <= n; i++)
+        {
+            buffer.send(i % 2 ? foo : bar, { t(i), static_cast<double>(i) });
+        }
+        buffer.drain();
+        check(sink.sent.size() == 1);
+        check(buffer.pending_bytes() == n * record_size);
+        check(buffer.spilled_bytes() == (n - 10) * record_size);
+        check(count_segments(directory) == (n - 10 + 7) / 8);
+
+        std::cerr << "Draining after the sink caught up...\n";
+        sink.ready = true;
+        buffer.send(foo, { t(n + 1), static_cast<double>(n + 1) });
+        check(sink.sent.size() == 1);
+        buffer.drain();
+        check(buffer.pending_bytes() == 0);
+        check(count_segments(directory) == 0);
+
+        std::cerr << "Checking that all values arrived in order...\n";
+        check(sink.sent.size() == n + 2);
+        for (int i = 0; i <= n + 1; i++)
+        {
+            const auto& [metric, tv] = sink.sent[i];
+            check(metric == ((i % 2 || i == 0) ? "foo" : "bar"));
+            check(tv.time == t(i) && tv.value == i);
+        }
+    }
+    std::filesystem::remove_all(directory);
+
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "../src/time_value_queue.hpp"
+
+static void check(bool passed)
+{
+    if (!passed)
+    {
+        std::cerr << "!!! CHECK FAILED !!!\n";
+        std::exit(1);
+    }
+}
+
+static bool identical(metricq::TimeValue a, metricq::TimeValue b)
+{
+    // Compare bit patterns, so that NaNs are checked as well
+    return a.time == b.time && std::memcmp(&a.value, &b.value, sizeof(a.value)) == 0;
+}
+
+constexpr metricq::TimePoint t(metricq::TimePoint::duration::rep r)
+{
+    return metricq::TimePoint(metricq::TimePoint::duration(r));
+}
+
+// A 1 kHz power reading with timestamp jitter, a coarse resolution, gaps, NaN bursts and outliers
+static std::vector<metricq::TimeValue> generate(std::size_t n)
+{
+    std::mt19937_64 rng(42);
+    std::normal_distribution<double> jitter(0, 2000);
+    std::uniform_int_distribution<int> event(0, 999);
+
+    std::vector<metricq::TimeValue> values;
+    metricq::TimePoint::duration::rep time = 1'600'000'000'000'000'000;
+    double power = 230.0;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        time += 1'000'000 + static_cast<metricq::TimePoint::duration::rep>(jitter(rng));
+        auto e = event(rng);
+        if (e == 0)
+        {
+            time += 3'600'000'000'000; // gap of an hour
+        }
+        if (e < 10)
+        {
+            power += 0.5 * (e - 5);
+        }
+
+        double value = power;
+        if (e == 1)
+        {
+            value = std::nan("");
+        }
+        else if (e == 2)
+        {
+            value = std::numeric_limits<double>::infinity();
+        }
+        else if (e == 3)
+        {
+            value = -0.0;
+        }
+        values.push_back({ t(time), value });
+    }
+    return values;
+}
+
+// Fill in bursts, drain in bursts, so the queue switches between its representations
+static void check_round_trip(const std::vector<metricq::TimeValue>& values, std::size_t max_fill,
+                             std::size_t max_drain, std::size_t compression_threshold = 100)
+{
+    TimeValueQueue queue(compression_threshold);
+    std::size_t next_in = 0;
+    std::size_t next_out = 0;
+    std::mt19937 rng(23);
+    for (std::size_t round = 1; next_out < values.size(); ++round)
+    {
+        auto burst = std::uniform_int_distribution<std::size_t>(0, max_fill)(rng);
+        for (std::size_t i = 0; i < burst && next_in < values.size(); ++i)
+        {
+            queue.push_back(values[next_in++]);
+        }
+        check(queue.size() == next_in - next_out);
+
+        std::size_t seen = 0;
+        queue.for_each(
+            [&](metricq::TimeValue tv) { check(identical(tv, values[next_out + seen++])); });
+        check(seen == queue.size());
+
+        // Now and then, take out all values at once
+        if (round % 7 == 0)
+        {
+            queue.drain([&](const metricq::TimeValue* data, std::size_t count) {
+                check(count > 0);
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    check(identical(data[i], values[next_out++]));
+                }
+            });
+            check(queue.empty() && next_out == next_in);
+            continue;
+        }
+
+        burst = std::uniform_int_distribution<std::size_t>(0, max_drain)(rng);
+        for (std::size_t i = 0; i < burst && !queue.empty(); ++i)
+        {
+            check(identical(queue.front(), values[next_out++]));
+            queue.pop_front();
+        }
+        check(queue.size() == next_in - next_out);
+        check(queue.empty() == (queue.size() == 0));
+    }
+}
+
+int main()
+{
+    constexpr std::size_t n = 50'000;
+    auto values = generate(n);
+
+    std::cerr << "Checking that a compressing queue returns values unchanged...\n";
+    check_round_trip(values, 5000, 4000);
+
+    std::cerr << "Checking short queues that move values in and out of inline storage...\n";
+    check_round_trip(values, 2 * TimeValueQueue::inline_capacity,
+                     2 * TimeValueQueue::inline_capacity);
+
+    std::cerr << "Checking a queue that compresses everything beyond its inline storage...\n";
+    check_round_trip(values, 5000, 4000, TimeValueQueue::inline_capacity);
+
+    std::cerr << "Checking memory usage of a large backlog...\n";
+    // About ten minutes of 1 kHz data
+    auto long_values = generate(10 * n);
+    TimeValueQueue backlog;
+    for (auto tv : long_values)
+    {
+        backlog.push_back(tv);
+    }
+    auto uncompressed = long_values.size() * sizeof(metricq::TimeValue);
+    std::cerr << "`-- " << backlog.memory_bytes() << " bytes instead of " << uncompressed << '\n';
+    check(backlog.memory_bytes() * 5 < uncompressed);
+
+    return 0;
+}
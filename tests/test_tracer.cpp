@@ -0,0 +1,135 @@
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <metricq/json.hpp>
+
+#include "../src/combined_metric.hpp"
+#include "../src/metric_id.hpp"
+#include "../src/tracer.hpp"
+
+static void check(bool passed)
+{
+    if (!passed)
+    {
+        std::cerr << "!!! CHECK FAILED !!!\n";
+        std::exit(1);
+    }
+}
+
+constexpr metricq::TimePoint t(double seconds)
+{
+    using duration = metricq::TimePoint::duration;
+    return metricq::TimePoint(duration(static_cast<duration::rep>(seconds * 1e9)));
+}
+
+// Feed and update a combined metric once per second of input like the combinator, tracing each
+// step
+static void run(MetricId id, CombinedMetric& combined, int steps)
+{
+    auto inputs = combined.collect_metric_inputs();
+    for (int step = 1; step <= steps; ++step)
+    {
+        {
+            Tracer::Scope trace(id, TraceEventKind::input);
+            for (auto& [name, nodes] : inputs)
+            {
+                nodes.at(0)->put({ t(step), static_cast<double>(step) });
+                if (Tracer::active())
+                {
+                    Tracer::global().record(TraceEventKind::input, nodes.at(0), t(step), 1,
+                                            nodes.at(0)->queue_length());
+                }
+            }
+        }
+        Tracer::Scope trace(id, TraceEventKind::update);
+        combined.update();
+        auto& output = combined.input();
+        while (output.has_input())
+        {
+            output.discard();
+        }
+    }
+}
+
+int main()
+{
+    if (!Tracer::compiled)
+    {
+        std::cerr << "Tracing is not compiled in, skipping\n";
+        return 0;
+    }
+
+    auto& ids = MetricIds::global();
+    auto traced = ids.intern("traced");
+    auto other = ids.intern("other");
+    CombinedMetric binary({ { "operation", "+" }, { "left", "a" }, { "right", "b" } });
+    CombinedMetric sum({ { "operation", "sum" }, { "inputs", { "a", "b", "c" } } });
+
+    std::cerr << "Checking that nothing is traced unless selected...\n";
+    auto& tracer = Tracer::global();
+    tracer.configure(1000, 3);
+    check(!tracer.enabled());
+    run(traced, binary, 10);
+    check(tracer.size() == 0);
+
+    std::cerr << "Checking that every third step of the selected metric is traced...\n";
+    tracer.select(traced);
+    check(tracer.enabled());
+    run(traced, binary, 9);
+    run(other, sum, 9);
+    check(!Tracer::active());
+    std::vector<TraceEvent> events;
+    tracer.for_each([&events](const TraceEvent& event) { events.push_back(event); });
+    // Sampled steps are traced as a whole, i.e. the input of both sides and the update
+    check(events.size() == 9);
+    for (std::size_t i = 0; i < events.size(); ++i)
+    {
+        check(events[i].metric == traced);
+        check(events[i].kind == (i % 3 == 2 ? TraceEventKind::binary : TraceEventKind::input));
+        check(events[i].time == t(1 + 3 * (i / 3)).time_since_epoch().count());
+        check(i % 3 != 2 || events[i].counts[2] == 1);
+        check(i == 0 || events[i].clock >= events[i - 1].clock);
+    }
+
+    std::cerr << "Checking that only the most recent events are kept...\n";
+    tracer.configure(4, 1);
+    tracer.select(other);
+    run(other, sum, 10);
+    check(tracer.size() == 4);
+    events.clear();
+    tracer.for_each([&events](const TraceEvent& event) { events.push_back(event); });
+    check(events.front().kind == TraceEventKind::input);
+    check(events.front().time == t(10).time_since_epoch().count());
+    check(events.back().kind == TraceEventKind::variadic);
+    check(events.back().time == t(10).time_since_epoch().count());
+
+    std::cerr << "Checking the dump...\n";
+    auto path = (std::filesystem::temp_directory_path() / "test_tracer.trace").string();
+    tracer.dump(path);
+    std::ifstream file(path, std::ios::binary);
+    char magic[8];
+    std::uint64_t count = 0;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char*>(&count), sizeof(count));
+    check(std::memcmp(magic, "MQTRACE1", 8) == 0 && count == 4);
+    std::vector<TraceEvent> dumped(count);
+    file.read(reinterpret_cast<char*>(dumped.data()), count * sizeof(TraceEvent));
+    check(std::memcmp(dumped.data(), events.data(), count * sizeof(TraceEvent)) == 0);
+
+    std::uint64_t names = 0;
+    MetricId id = 0;
+    std::uint32_t length = 0;
+    file.read(reinterpret_cast<char*>(&names), sizeof(names));
+    file.read(reinterpret_cast<char*>(&id), sizeof(id));
+    file.read(reinterpret_cast<char*>(&length), sizeof(length));
+    std::string name(length, '\0');
+    file.read(name.data(), length);
+    check(file && names == 1 && id == other && name == "other");
+    std::filesystem::remove(path);
+
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../src/update_scheduler.hpp"
+
+static void check(bool passed)
+{
+    if (!passed)
+    {
+        std::cerr << "!!! CHECK FAILED !!!\n";
+        std::exit(1);
+    }
+}
+
+// A clock that only advances when told to, one millisecond per update in these tests
+struct FakeClock
+{
+    using duration = std::chrono::milliseconds;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::time_point<FakeClock>;
+    static constexpr bool is_steady = true;
+
+    static time_point now()
+    {
+        return current;
+    }
+
+    static inline time_point current{};
+};
+
+struct Item
+{
+    std::string name;
+};
+
+int main()
+{
+    using namespace std::chrono_literals;
+    UpdateScheduler<Item, FakeClock> scheduler(10ms, 1000ms);
+
+    std::vector<Item> low(20), normal(20), high(5);
+    for (std::size_t i = 0; i < low.size(); ++i)
+    {
+        low[i].name = "low" + std::to_string(i);
+        normal[i].name = "normal" + std::to_string(i);
+    }
+    for (std::size_t i = 0; i < high.size(); ++i)
+    {
+        high[i].name = "high" + std::to_string(i);
+    }
+
+    std::vector<std::string> updated;
+    std::vector<std::string> shed;
+    auto update = [&](Item& item) {
+        updated.push_back(item.name);
+        FakeClock::current += 1ms;
+    };
+    auto on_shed = [&](Item& item, auto) { shed.push_back(item.name); };
+
+    std::cerr << "Checking that high priority items are updated first...\n";
+    for (auto& item : low)
+    {
+        scheduler.schedule(item, Priority::low, FakeClock::now());
+    }
+    for (auto& item : normal)
+    {
+        scheduler.schedule(item, Priority::normal, FakeClock::now());
+    }
+    for (auto& item : high)
+    {
+        scheduler.schedule(item, Priority::high, FakeClock::now());
+    }
+    check(scheduler.run(update, on_shed));
+    check(updated.size() == 10);
+    check(updated.front() == "high0" && updated[4] == "high4" && updated[5] == "normal0");
+
+    std::cerr << "Checking that high priority items scheduled later overtake others...\n";
+    updated.clear();
+    scheduler.schedule(high[0], Priority::high, FakeClock::now());
+    check(scheduler.run(update, on_shed));
+    check(updated.front() == "high0" && updated[1] == "normal5");
+
+    std::cerr << "Checking that low priority items are shed once they waited too long...\n";
+    FakeClock::current += 2s;
+    updated.clear();
+    while (scheduler.run(update, on_shed))
+    {
+    }
+    check(shed.size() == low.size() && shed.front() == "low0");
+    check(updated.size() == 6 && updated.back() == "normal19");
+    check(scheduler.size() == 0);
+
+    std::cerr << "Checking that recent low priority items are updated...\n";
+    scheduler.schedule(low[0], Priority::low, FakeClock::now());
+    FakeClock::current += 500ms;
+    updated.clear();
+    check(!scheduler.run(update, on_shed));
+    check(updated.size() == 1 && updated.front() == "low0");
+
+    check(parse_priority("high") == Priority::high && !parse_priority("urgent"));
+
+    return 0;
+}